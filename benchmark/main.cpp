@@ -0,0 +1,216 @@
+#ifdef LSV_PLATFORM_WINDOWS // this is needed for building on windows
+#include <SDL.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <spdlog/fmt/ranges.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "Grammars.h"
+#include "Renderer.h"
+#include "Timings.h"
+#include "Trace.h"
+
+namespace {
+constexpr uint32_t FRAME_COUNT = 64;
+
+struct Format {
+    const char *name;
+    lsv::VertexFormat format;
+};
+
+constexpr Format FORMATS[] = {
+    {"full", lsv::VertexFormat::Full},
+    {"packed", lsv::VertexFormat::Packed},
+    {"segments", lsv::VertexFormat::Segments},
+    {"lines", lsv::VertexFormat::Lines},
+    {"tubes", lsv::VertexFormat::Tubes},
+};
+
+// variants of the gallery grammar drawn at once, a single plant and enough
+// for the cost of submitting them to show if it grew with their number
+constexpr uint32_t GALLERY_SIZES[] = {1, 1000};
+constexpr uint32_t GALLERY_GENERATION = 3;
+constexpr float GALLERY_ANGLE_SPREAD = 10.0f;
+
+// the turtle alone is timed as the best of this many runs
+constexpr uint32_t TURTLE_REPEATS = 10;
+
+double perSecond(double amount, double milliseconds) {
+    return milliseconds > 0.0 ? amount / (milliseconds * 1e-3) : 0.0;
+}
+} // namespace
+
+// runs every reference grammar through each stage for every generation, then
+// draws galleries of the fern, and writes the timings as json to the given
+// path, or stdout without one. a second path receives the trace of the whole
+// run
+int main(int argc, char **argv) {
+    // stdout is reserved for the results
+    spdlog::set_default_logger(spdlog::stderr_color_mt("benchmark"));
+
+    auto renderer = lsv::Renderer();
+    lsv::RenderConfig config{.applicationName = "L System Benchmark",
+                             .headless = true};
+
+    std::vector<std::string> results;
+
+    try {
+        renderer.init(config);
+
+        for (const lsv::ReferenceGrammar &grammar : lsv::referenceGrammars()) {
+            for (const Format &format : FORMATS) {
+                if (!renderer.supportsFormat(format.format)) {
+                    SPDLOG_WARN("skipping unsupported format {}", format.name);
+                    continue;
+                }
+                renderer.setLSystem(
+                    lsv::LSystem(grammar.axiom, grammar.rules, grammar.seed),
+                    grammar.turtle);
+
+                for (uint32_t generation = 0;
+                     generation <= grammar.maxGenerations; generation++) {
+                    lsv::GenerationTimings timings =
+                        renderer.generate(generation, format.format);
+                    lsv::FrameTimings frameTimings =
+                        renderer.drawOffscreen(FRAME_COUNT);
+
+                    const double symbols =
+                        static_cast<double>(renderer.getSymbolCount());
+                    const double segments =
+                        static_cast<double>(renderer.getSegmentCount());
+                    const double bytes =
+                        static_cast<double>(renderer.getMeshSize());
+
+                    SPDLOG_INFO("{} ({}) generation {}: {} symbols, {} "
+                                "segments, rewrite {:.2f} ms, interpret {:.2f} "
+                                "ms, upload {:.2f} ms, gpu frame {:.3f} ms",
+                                grammar.name, format.name, generation,
+                                renderer.getSymbolCount(),
+                                renderer.getSegmentCount(), timings.rewriteMs,
+                                timings.interpretMs, timings.uploadMs,
+                                frameTimings.gpuMs);
+
+                    results.push_back(fmt::format(
+                        R"(    {{"grammar": "{}", "format": "{}", )"
+                        R"("generation": {}, "symbols": {}, )"
+                        R"("segments": {}, )"
+                        R"("upload_bytes": {}, "rewrite_ms": {:.4f}, )"
+                        R"("interpret_ms": {:.4f}, "upload_ms": {:.4f}, )"
+                        R"("frame_cpu_ms": {:.4f}, "frame_gpu_ms": {:.4f}, )"
+                        R"("rewrite_symbols_per_sec": {:.0f}, )"
+                        R"("interpret_symbols_per_sec": {:.0f}, )"
+                        R"("interpret_segments_per_sec": {:.0f}, )"
+                        R"("upload_gb_per_sec": {:.4f}}})",
+                        grammar.name, format.name, generation,
+                        renderer.getSymbolCount(),
+                        renderer.getSegmentCount(), renderer.getMeshSize(),
+                        timings.rewriteMs, timings.interpretMs,
+                        timings.uploadMs, frameTimings.cpuMs,
+                        frameTimings.gpuMs,
+                        perSecond(symbols, timings.rewriteMs),
+                        perSecond(symbols, timings.interpretMs),
+                        perSecond(segments, timings.interpretMs),
+                        perSecond(bytes, timings.uploadMs) * 1e-9));
+                }
+            }
+        }
+
+        // the turtle of every grammar at its last generation on a single
+        // core, which is what the threads of interpret multiply
+        for (const lsv::ReferenceGrammar &grammar : lsv::referenceGrammars()) {
+            const lsv::LSystem lsystem(grammar.axiom, grammar.rules,
+                                       grammar.seed);
+            lsv::DerivationArena arena;
+            const lsv::ModuleString modules =
+                lsystem.derive(grammar.maxGenerations, arena);
+
+            // the best of several runs, without the derivation, the uploads
+            // and the threads of generate
+            double interpretMs = 0.0;
+            uint64_t segmentCount = 0;
+            for (uint32_t repeat = 0; repeat < TURTLE_REPEATS; repeat++) {
+                lsv::Turtle turtle(grammar.turtle, lsystem.getSymbols(),
+                                   lsv::TurtleOutput::Lines);
+                turtle.reserve(modules);
+                lsv::Stopwatch stopwatch;
+                turtle.interpret(modules.symbols, modules.parameters.data(),
+                                 1);
+                const double milliseconds = stopwatch.lap();
+                interpretMs = repeat == 0
+                                  ? milliseconds
+                                  : std::min(interpretMs, milliseconds);
+                segmentCount = turtle.getSegmentCount();
+            }
+
+            SPDLOG_INFO("{} (lines, one core) generation {}: {} segments, "
+                        "interpret {:.2f} ms",
+                        grammar.name, grammar.maxGenerations,
+                        segmentCount, interpretMs);
+
+            results.push_back(fmt::format(
+                R"(    {{"grammar": "{}", "format": "lines", "cores": 1, )"
+                R"("generation": {}, "symbols": {}, "segments": {}, )"
+                R"("interpret_ms": {:.4f}, )"
+                R"("interpret_segments_per_sec": {:.0f}}})",
+                grammar.name, grammar.maxGenerations, modules.symbols.size(),
+                segmentCount, interpretMs,
+                perSecond(static_cast<double>(segmentCount), interpretMs)));
+        }
+
+        // the fern drawn as galleries, which take one indirect draw however
+        // many plants they hold
+        const lsv::ReferenceGrammar &fern = lsv::referenceGrammars()[1];
+        renderer.setLSystem(lsv::LSystem(fern.axiom, fern.rules, fern.seed),
+                            fern.turtle);
+        for (uint32_t plants : GALLERY_SIZES) {
+            renderer.generateGallery(GALLERY_GENERATION, plants,
+                                     GALLERY_ANGLE_SPREAD);
+            lsv::FrameTimings frameTimings =
+                renderer.drawOffscreen(FRAME_COUNT);
+
+            SPDLOG_INFO("{} gallery of {}: cpu frame {:.3f} ms, gpu frame "
+                        "{:.3f} ms",
+                        fern.name, plants, frameTimings.cpuMs,
+                        frameTimings.gpuMs);
+
+            results.push_back(fmt::format(
+                R"(    {{"gallery": "{}", "plants": {}, "generation": {}, )"
+                R"("frame_cpu_ms": {:.4f}, "frame_gpu_ms": {:.4f}}})",
+                fern.name, plants, GALLERY_GENERATION, frameTimings.cpuMs,
+                frameTimings.gpuMs));
+        }
+
+        renderer.cleanup();
+    } catch (const std::runtime_error &e) {
+        SPDLOG_CRITICAL(e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::string json = fmt::format(
+        "{{\n  \"frames\": {},\n  \"results\": [\n{}\n  ]\n}}\n", FRAME_COUNT,
+        fmt::join(results, ",\n"));
+
+    FILE *output = argc > 1 ? std::fopen(argv[1], "w") : stdout;
+    if (!output) {
+        SPDLOG_CRITICAL("failed to open {}", argv[1]);
+        return EXIT_FAILURE;
+    }
+    std::fputs(json.c_str(), output);
+    if (output != stdout) {
+        std::fclose(output);
+    }
+
+    if (argc > 2 && !lsv::writeTrace(argv[2])) {
+        SPDLOG_CRITICAL("failed to write trace to {}", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "Grammars.h"
+#include "Hash.h"
+#include "LSystem.h"
+#include "Turtle.h"
+
+namespace {
+// grammars whose derivations have to come out the same whichever way they
+// are derived. stochastic rules are decided by position and conditions by
+// the parameters, which chunking must not change. the bush thins and
+// recolors its branches, which chunks and subtrees compose relative to
+// where they are placed
+constexpr std::string_view CHECKED_GRAMMARS[] = {
+    "stochastic plant", "parametric tree", "3d bush"};
+
+// chunks the parallel paths are forced into whatever the number of cores,
+// odd so chunk borders fall in the middle of branches
+constexpr size_t CHECK_CHUNK_COUNT = 7;
+
+// largest difference between the segments of two turtles interpreting the
+// same modules, relative to the extent of the bounds
+constexpr float SEGMENT_TOLERANCE = 1e-4f;
+
+struct Digest {
+    size_t symbolCount = 0;
+    uint64_t modules = lsv::HASH_SEED;
+    uint64_t segments = lsv::HASH_SEED;
+
+    bool operator==(const Digest &) const = default;
+
+    void addModule(lsv::SymbolId symbol, const float *parameters,
+                   uint8_t arity) {
+        symbolCount++;
+        modules = lsv::hashValue(modules, symbol);
+        modules = lsv::hashValues(modules, std::span(parameters, arity));
+    }
+
+    void addSegments(const lsv::SegmentData &data) {
+        segments = lsv::hashValues<lsv::Segment>(segments, data.segments);
+    }
+};
+
+// the turtle steps through every module on its own, so equal modules give
+// bit for bit equal segments
+Digest digestModules(const lsv::ModuleString &modules,
+                     const lsv::ReferenceGrammar &grammar,
+                     const lsv::SymbolTable &symbols) {
+    Digest digest;
+    lsv::Turtle turtle(grammar.turtle, symbols, lsv::TurtleOutput::Segments);
+    const float *parameters = modules.parameters.data();
+    for (lsv::SymbolId symbol : modules.symbols) {
+        digest.addModule(symbol, parameters, symbols.getArity(symbol));
+        turtle.step(symbol, parameters);
+        parameters += symbols.getArity(symbol);
+    }
+    digest.addSegments(turtle.finishSegments());
+    return digest;
+}
+
+// a turtle interpreting in chunks composes transforms in another order, so
+// its segments only match up to rounding
+bool segmentsMatch(const lsv::SegmentData &expected,
+                   const lsv::SegmentData &actual) {
+    if (actual.segments.size() != expected.segments.size()) {
+        return false;
+    }
+    const glm::vec3 extent = expected.boundsMax - expected.boundsMin;
+    const float tolerance =
+        SEGMENT_TOLERANCE * std::max({extent.x, extent.y, extent.z, 1.0f});
+    auto near = [&](glm::vec3 a, glm::vec3 b) {
+        const glm::vec3 difference = glm::abs(a - b);
+        return std::max({difference.x, difference.y, difference.z}) <=
+               tolerance;
+    };
+    for (size_t i = 0; i < expected.segments.size(); i++) {
+        const lsv::Segment &a = expected.segments[i];
+        const lsv::Segment &b = actual.segments[i];
+        if (!near(a.start, b.start) || !near(a.end, b.end) ||
+            std::abs(a.radius - b.radius) > tolerance ||
+            a.colorIndex != b.colorIndex) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// derives a generation on the calling thread, in chunks, through the cache
+// and depth first, and checks that all of them give the same modules and
+// segments. the sequential derivation is also interpreted in chunks and,
+// where the grammar allows it, memoized, which both have to draw the same
+// segments up to rounding
+bool checkGeneration(const lsv::ReferenceGrammar &grammar,
+                     const lsv::LSystem &lsystem, uint32_t generation,
+                     lsv::DerivationCache &cache) {
+    const lsv::SymbolTable &symbols = lsystem.getSymbols();
+
+    lsv::DerivationArena sequentialArena;
+    sequentialArena.chunkCount = 1;
+    const lsv::ModuleString sequentialModules =
+        lsystem.derive(generation, sequentialArena);
+    const Digest sequential =
+        digestModules(sequentialModules, grammar, symbols);
+
+    lsv::DerivationArena chunkedArena;
+    chunkedArena.chunkCount = CHECK_CHUNK_COUNT;
+    const Digest chunked = digestModules(
+        lsystem.derive(generation, chunkedArena), grammar, symbols);
+
+    const Digest cached =
+        digestModules(lsystem.derive(generation, cache), grammar, symbols);
+
+    Digest expanded;
+    lsv::Turtle expandedTurtle(grammar.turtle, symbols,
+                               lsv::TurtleOutput::Segments);
+    lsystem.expand(generation, [&](lsv::SymbolId symbol,
+                                   const float *parameters) {
+        expanded.addModule(symbol, parameters, symbols.getArity(symbol));
+        expandedTurtle.step(symbol, parameters);
+    });
+    const lsv::SegmentData expandedSegments = expandedTurtle.finishSegments();
+    expanded.addSegments(expandedSegments);
+
+    bool matches = true;
+    const std::pair<const char *, const Digest &> paths[] = {
+        {"chunked", chunked}, {"cached", cached}, {"depth first", expanded}};
+    for (const auto &[name, digest] : paths) {
+        if (digest != sequential) {
+            SPDLOG_ERROR("{} generation {}: {} derivation differs from the "
+                         "sequential one, {} vs {} symbols, modules {:016x} "
+                         "vs {:016x}, segments {:016x} vs {:016x}",
+                         grammar.name, generation, name, digest.symbolCount,
+                         sequential.symbolCount, digest.modules,
+                         sequential.modules, digest.segments,
+                         sequential.segments);
+            matches = false;
+        }
+    }
+
+    lsv::Turtle chunkedTurtle(grammar.turtle, symbols,
+                              lsv::TurtleOutput::Segments);
+    chunkedTurtle.interpret(sequentialModules.symbols,
+                            sequentialModules.parameters.data(),
+                            CHECK_CHUNK_COUNT);
+    if (!segmentsMatch(expandedSegments, chunkedTurtle.finishSegments())) {
+        SPDLOG_ERROR("{} generation {}: interpreting in chunks draws other "
+                     "segments than interpreting module by module",
+                     grammar.name, generation);
+        matches = false;
+    }
+
+    lsv::Turtle memoizedTurtle(grammar.turtle, symbols,
+                               lsv::TurtleOutput::Segments);
+    if (memoizedTurtle.interpretMemoized(lsystem, generation) &&
+        !segmentsMatch(expandedSegments, memoizedTurtle.finishSegments())) {
+        SPDLOG_ERROR("{} generation {}: interpreting memoized subtrees draws "
+                     "other segments than interpreting module by module",
+                     grammar.name, generation);
+        matches = false;
+    }
+
+    return matches;
+}
+} // namespace
+
+// derives every generation of the checked reference grammars along every
+// path the renderer can take and fails when any two disagree. needs no gpu,
+// so it runs wherever the sources build
+int main() {
+    bool matches = true;
+    try {
+        for (const lsv::ReferenceGrammar &grammar : lsv::referenceGrammars()) {
+            if (std::find(std::begin(CHECKED_GRAMMARS),
+                          std::end(CHECKED_GRAMMARS),
+                          grammar.name) == std::end(CHECKED_GRAMMARS)) {
+                continue;
+            }
+
+            const lsv::LSystem lsystem(grammar.axiom, grammar.rules,
+                                       grammar.seed);
+            lsv::DerivationCache cache;
+            for (uint32_t generation = 0;
+                 generation <= grammar.maxGenerations; generation++) {
+                if (!checkGeneration(grammar, lsystem, generation, cache)) {
+                    matches = false;
+                }
+            }
+            SPDLOG_INFO("{}: generations 0 to {} checked", grammar.name,
+                        grammar.maxGenerations);
+        }
+    } catch (const std::runtime_error &e) {
+        SPDLOG_CRITICAL(e.what());
+        return EXIT_FAILURE;
+    }
+
+    return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,17 @@
+# writes INPUT into OUTPUT as a byte array named NAME in namespace lsv::shaders,
+# run as cmake -DINPUT=... -DOUTPUT=... -DNAME=... -P EmbedFile.cmake
+file(READ ${INPUT} CONTENT HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${CONTENT}")
+# cmake regexes have no counted repetition
+string(REPEAT "0x[0-9a-f][0-9a-f]," 16 ROW)
+string(REGEX REPLACE "(${ROW})" "\\1\n    " BYTES "${BYTES}")
+
+file(
+  WRITE ${OUTPUT}
+  "#pragma once\n\n"
+  "// generated from ${INPUT} by EmbedFile.cmake\n\n"
+  "namespace lsv::shaders {\n"
+  "alignas(4) inline constexpr unsigned char ${NAME}[] = {\n"
+  "    ${BYTES}\n"
+  "};\n"
+  "} // namespace lsv::shaders\n")
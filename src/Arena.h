@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+
+namespace lsv {
+// bump allocator whose storage survives reset() so that buffers rebuilt every
+// generation reuse the same pages instead of going back to the heap
+class Arena {
+public:
+    // invalidates everything previously allocated, storage only grows when
+    // the requested capacity exceeds what is already held
+    void reset(size_t minimumCapacity = 0) {
+        offset = 0;
+        if (minimumCapacity > capacity) {
+            size_t newCapacity = std::max(minimumCapacity, capacity * 2);
+            // deliberately uninitialized, every byte handed out is written
+            // before it is read
+            storage.reset(new std::byte[newCapacity]);
+            capacity = newCapacity;
+        }
+    }
+
+    template <typename T> std::span<T> allocate(size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        size_t alignedOffset = (offset + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (alignedOffset + count * sizeof(T) > capacity) {
+            throw std::bad_alloc();
+        }
+
+        offset = alignedOffset + count * sizeof(T);
+        return {reinterpret_cast<T *>(storage.get() + alignedOffset), count};
+    }
+
+    template <typename T> static constexpr size_t footprint(size_t count) {
+        return count * sizeof(T) + alignof(T) - 1;
+    }
+
+    size_t getCapacity() const { return capacity; }
+
+private:
+    std::unique_ptr<std::byte[]> storage;
+    size_t capacity{0};
+    size_t offset{0};
+};
+} // namespace lsv
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "Expression.h"
+#include "Hash.h"
+
+namespace lsv {
+namespace {
+// deep enough for any expression written by hand, and small enough for the
+// whole stack to live in registers and l1
+constexpr size_t MAX_STACK_DEPTH = 16;
+} // namespace
+
+// recursive descent over the usual c precedence, emitting postfix code
+class Expression::Parser {
+public:
+    Parser(std::string_view text, std::span<const std::string> names,
+           Expression &expression)
+        : text(text), names(names), expression(expression) {}
+
+    void parse() {
+        parseOr();
+        skipSpace();
+        if (position != text.size()) {
+            fail("unexpected character");
+        }
+    }
+
+    size_t getMaxDepth() const { return maxDepth; }
+
+private:
+    std::string text;
+    std::span<const std::string> names;
+    Expression &expression;
+    size_t position{0};
+    size_t depth{0};
+    size_t maxDepth{0};
+
+    [[noreturn]] void fail(const char *message) const {
+        throw std::runtime_error(fmt::format("{} at offset {} in '{}'", message,
+                                             position, text));
+    }
+
+    void skipSpace() {
+        while (position < text.size() &&
+               std::isspace(static_cast<unsigned char>(text[position]))) {
+            position++;
+        }
+    }
+
+    bool accept(std::string_view token) {
+        skipSpace();
+        if (text.compare(position, token.size(), token) != 0) {
+            return false;
+        }
+        position += token.size();
+        return true;
+    }
+
+    void emit(Opcode opcode, uint16_t operand = 0) {
+        expression.code.push_back(Instruction{opcode, operand});
+        if (opcode == Opcode::Constant || opcode == Opcode::Parameter) {
+            maxDepth = std::max(maxDepth, ++depth);
+        } else if (opcode != Opcode::Negate && opcode != Opcode::Not) {
+            depth--;
+        }
+    }
+
+    void parseOr() {
+        parseAnd();
+        while (accept("||")) {
+            parseAnd();
+            emit(Opcode::Or);
+        }
+    }
+
+    void parseAnd() {
+        parseComparison();
+        while (accept("&&")) {
+            parseComparison();
+            emit(Opcode::And);
+        }
+    }
+
+    void parseComparison() {
+        parseAdditive();
+        // two character operators first, "<" would also match "<="
+        constexpr std::pair<std::string_view, Opcode> OPERATORS[] = {
+            {"<=", Opcode::LessEqual}, {">=", Opcode::GreaterEqual},
+            {"==", Opcode::Equal},     {"!=", Opcode::NotEqual},
+            {"<", Opcode::Less},       {">", Opcode::Greater},
+        };
+        for (const auto &[token, opcode] : OPERATORS) {
+            if (accept(token)) {
+                parseAdditive();
+                emit(opcode);
+                return;
+            }
+        }
+    }
+
+    void parseAdditive() {
+        parseMultiplicative();
+        while (true) {
+            if (accept("+")) {
+                parseMultiplicative();
+                emit(Opcode::Add);
+            } else if (accept("-")) {
+                parseMultiplicative();
+                emit(Opcode::Subtract);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void parseMultiplicative() {
+        parseUnary();
+        while (true) {
+            if (accept("*")) {
+                parseUnary();
+                emit(Opcode::Multiply);
+            } else if (accept("/")) {
+                parseUnary();
+                emit(Opcode::Divide);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void parseUnary() {
+        if (accept("-")) {
+            parseUnary();
+            emit(Opcode::Negate);
+        } else if (text.compare(position, 2, "!=") != 0 && accept("!")) {
+            parseUnary();
+            emit(Opcode::Not);
+        } else {
+            parsePower();
+        }
+    }
+
+    // right associative and binding tighter than a leading minus, like
+    // -2^2 == -4
+    void parsePower() {
+        parsePrimary();
+        if (accept("^")) {
+            parseUnary();
+            emit(Opcode::Power);
+        }
+    }
+
+    void parsePrimary() {
+        skipSpace();
+        if (position == text.size()) {
+            fail("expected a value");
+        }
+
+        const unsigned char next = text[position];
+        if (accept("(")) {
+            parseOr();
+            if (!accept(")")) {
+                fail("expected ')'");
+            }
+        } else if (std::isdigit(next) || next == '.') {
+            const char *begin = text.c_str() + position;
+            char *end;
+            const float value = std::strtof(begin, &end);
+            if (end == begin) {
+                fail("expected a number");
+            }
+            position += end - begin;
+            emit(Opcode::Constant, addConstant(value));
+        } else if (std::isalpha(next) || next == '_') {
+            const size_t begin = position;
+            while (position < text.size() &&
+                   (std::isalnum(static_cast<unsigned char>(text[position])) ||
+                    text[position] == '_')) {
+                position++;
+            }
+            const std::string_view name =
+                std::string_view(text).substr(begin, position - begin);
+            auto found = std::find(names.begin(), names.end(), name);
+            if (found == names.end()) {
+                position = begin;
+                fail("unknown parameter");
+            }
+            emit(Opcode::Parameter,
+                 static_cast<uint16_t>(found - names.begin()));
+        } else {
+            fail("expected a value");
+        }
+    }
+
+    uint16_t addConstant(float value) {
+        expression.constants.push_back(value);
+        return static_cast<uint16_t>(expression.constants.size() - 1);
+    }
+};
+
+Expression Expression::parse(std::string_view text,
+                             std::span<const std::string> names) {
+    Expression expression;
+    Parser parser(text, names, expression);
+    parser.parse();
+    if (parser.getMaxDepth() > MAX_STACK_DEPTH) {
+        throw std::runtime_error(
+            fmt::format("expression '{}' is nested too deeply", text));
+    }
+
+    // folded so constant successor parameters can be copied like literals
+    const bool constant =
+        std::none_of(expression.code.begin(), expression.code.end(),
+                     [](const Instruction &instruction) {
+                         return instruction.opcode == Opcode::Parameter;
+                     });
+    if (constant && expression.code.size() > 1) {
+        float values[EXPRESSION_LANES];
+        expression.evaluate(nullptr, values);
+        expression.code = {Instruction{Opcode::Constant, 0}};
+        expression.constants = {values[0]};
+    }
+
+    return expression;
+}
+
+void Expression::evaluate(const float *parameters, float *values) const {
+    float stack[MAX_STACK_DEPTH][EXPRESSION_LANES];
+    size_t top = 0;
+
+    // each instruction is one loop over the lanes, simple enough for the
+    // compiler to turn into vector instructions
+    auto unary = [&](auto operation) {
+        float *a = stack[top - 1];
+        for (size_t lane = 0; lane < EXPRESSION_LANES; lane++) {
+            a[lane] = operation(a[lane]);
+        }
+    };
+    auto binary = [&](auto operation) {
+        top--;
+        float *a = stack[top - 1];
+        const float *b = stack[top];
+        for (size_t lane = 0; lane < EXPRESSION_LANES; lane++) {
+            a[lane] = operation(a[lane], b[lane]);
+        }
+    };
+    auto truth = [](bool value) { return value ? 1.0f : 0.0f; };
+
+    for (const Instruction &instruction : code) {
+        switch (instruction.opcode) {
+        case Opcode::Constant:
+            std::fill_n(stack[top++], EXPRESSION_LANES,
+                        constants[instruction.operand]);
+            break;
+        case Opcode::Parameter:
+            std::copy_n(parameters + instruction.operand * EXPRESSION_LANES,
+                        EXPRESSION_LANES, stack[top++]);
+            break;
+        case Opcode::Negate:
+            unary([](float a) { return -a; });
+            break;
+        case Opcode::Not:
+            unary([&](float a) { return truth(a == 0.0f); });
+            break;
+        case Opcode::Add:
+            binary([](float a, float b) { return a + b; });
+            break;
+        case Opcode::Subtract:
+            binary([](float a, float b) { return a - b; });
+            break;
+        case Opcode::Multiply:
+            binary([](float a, float b) { return a * b; });
+            break;
+        case Opcode::Divide:
+            binary([](float a, float b) { return a / b; });
+            break;
+        case Opcode::Power:
+            binary([](float a, float b) { return std::pow(a, b); });
+            break;
+        case Opcode::Less:
+            binary([&](float a, float b) { return truth(a < b); });
+            break;
+        case Opcode::LessEqual:
+            binary([&](float a, float b) { return truth(a <= b); });
+            break;
+        case Opcode::Greater:
+            binary([&](float a, float b) { return truth(a > b); });
+            break;
+        case Opcode::GreaterEqual:
+            binary([&](float a, float b) { return truth(a >= b); });
+            break;
+        case Opcode::Equal:
+            binary([&](float a, float b) { return truth(a == b); });
+            break;
+        case Opcode::NotEqual:
+            binary([&](float a, float b) { return truth(a != b); });
+            break;
+        case Opcode::And:
+            binary([&](float a, float b) {
+                return truth(a != 0.0f && b != 0.0f);
+            });
+            break;
+        case Opcode::Or:
+            binary([&](float a, float b) {
+                return truth(a != 0.0f || b != 0.0f);
+            });
+            break;
+        }
+    }
+
+    std::copy_n(stack[0], EXPRESSION_LANES, values);
+}
+
+uint64_t Expression::hash(uint64_t seed) const {
+    uint64_t hash = seed;
+    for (const Instruction &instruction : code) {
+        hash = hashValue(hash, instruction.opcode);
+        hash = hashValue(hash, instruction.operand);
+    }
+    return hashValues<float>(hash, constants);
+}
+} // namespace lsv
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lsv {
+// modules evaluated at once, the parameters of a batch are laid out
+// parameter major so every instruction runs over contiguous lanes
+constexpr size_t EXPRESSION_LANES = 8;
+
+// an arithmetic or logical expression over the formal parameters of a rule,
+// compiled once into stack bytecode. comparisons and logic yield 1 or 0
+class Expression {
+public:
+    Expression() = default;
+
+    // names are the formal parameters the expression may refer to, in the
+    // order their values are passed
+    static Expression parse(std::string_view text,
+                            std::span<const std::string> names);
+
+    // true when the value doesn't depend on any parameter
+    bool isConstant() const {
+        return code.size() == 1 && code[0].opcode == Opcode::Constant;
+    }
+    // the value of a constant expression
+    float getConstant() const { return constants[0]; }
+
+    // parameter i of lane j is read from parameters[i * EXPRESSION_LANES + j]
+    // and the value of lane j written to values[j]. every lane is evaluated,
+    // lanes without a module just produce garbage
+    void evaluate(const float *parameters, float *values) const;
+
+    // fnv-1a over the bytecode, so equally compiled expressions hash equally
+    uint64_t hash(uint64_t seed) const;
+
+private:
+    enum class Opcode : uint8_t {
+        Constant,
+        Parameter,
+        Negate,
+        Not,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Power,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        And,
+        Or,
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        // constant or parameter index
+        uint16_t operand;
+    };
+
+    class Parser;
+
+    std::vector<Instruction> code;
+    std::vector<float> constants;
+};
+} // namespace lsv
@@ -0,0 +1,297 @@
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#ifdef LSV_PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "GeometryCache.h"
+#include "Hash.h"
+
+namespace lsv {
+namespace {
+constexpr uint32_t GEOMETRY_CACHE_MAGIC = 0x4756534c; // "LSVG"
+// bump whenever the turtle output or any vertex layout changes, files of
+// other versions are ignored
+constexpr uint32_t GEOMETRY_CACHE_VERSION = 4;
+// blocks start on page boundaries so they can be read straight from the
+// mapping
+constexpr uint64_t GEOMETRY_CACHE_ALIGNMENT = 4096;
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t clusterCount;
+    uint64_t symbolCount;
+    uint64_t segmentCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // the palette follows the vertices in the same block
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint64_t paletteSize;
+    uint64_t clusterOffset;
+    uint64_t indexOffset;
+    // indices stored, segments draw more than they store
+    uint64_t storedIndexCount;
+};
+
+uint64_t alignUp(uint64_t offset) {
+    return (offset + GEOMETRY_CACHE_ALIGNMENT - 1) &
+           ~(GEOMETRY_CACHE_ALIGNMENT - 1);
+}
+
+bool isBlockInFile(uint64_t offset, uint64_t size, uint64_t fileSize) {
+    return offset % GEOMETRY_CACHE_ALIGNMENT == 0 && offset <= fileSize &&
+           size <= fileSize - offset;
+}
+} // namespace
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : data(std::exchange(other.data, nullptr)),
+      size(std::exchange(other.size, 0)) {
+#ifdef LSV_PLATFORM_WINDOWS
+    mapping = std::exchange(other.mapping, nullptr);
+#endif
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+#ifdef LSV_PLATFORM_WINDOWS
+        mapping = std::exchange(other.mapping, nullptr);
+#endif
+    }
+    return *this;
+}
+
+std::optional<MappedFile> MappedFile::open(const std::filesystem::path &path) {
+    MappedFile file;
+
+#ifdef LSV_PLATFORM_WINDOWS
+    HANDLE handle =
+        CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+    }
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(handle);
+        return std::nullopt;
+    }
+
+    // the mapping keeps the file open on its own
+    file.mapping =
+        CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (!file.mapping) {
+        return std::nullopt;
+    }
+
+    file.data = static_cast<const std::byte *>(
+        MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!file.data) {
+        return std::nullopt;
+    }
+    file.size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return std::nullopt;
+    }
+
+    struct stat status {};
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        ::close(descriptor);
+        return std::nullopt;
+    }
+
+    // the mapping keeps the file open on its own
+    void *address = mmap(nullptr, static_cast<size_t>(status.st_size),
+                         PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (address == MAP_FAILED) {
+        return std::nullopt;
+    }
+
+    // uploads stream through the blocks front to back
+    madvise(address, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+
+    file.data = static_cast<const std::byte *>(address);
+    file.size = static_cast<size_t>(status.st_size);
+#endif
+
+    return file;
+}
+
+void MappedFile::close() {
+#ifdef LSV_PLATFORM_WINDOWS
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    mapping = nullptr;
+#else
+    if (data) {
+        munmap(const_cast<std::byte *>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+uint64_t geometryCacheKey(const LSystem &lsystem,
+                          const TurtleParameters &turtleParameters,
+                          uint32_t generations, VertexFormat format,
+                          bool births) {
+    uint64_t key = lsystem.getHash();
+    key = hashValue(key, turtleParameters.angle);
+    key = hashValue(key, turtleParameters.stepLength);
+    key = hashValue(key, turtleParameters.width);
+    key = hashValue(key, turtleParameters.color);
+    key = hashValue(key, generations);
+    key = hashValue(key, static_cast<uint32_t>(format));
+    key = hashValue(key, births);
+    return key;
+}
+
+bool writeGeometryCache(const std::filesystem::path &path, uint64_t key,
+                        const GeometryBlocks &blocks) {
+    FileHeader header{
+        .magic = GEOMETRY_CACHE_MAGIC,
+        .version = GEOMETRY_CACHE_VERSION,
+        .key = key,
+        .format = static_cast<uint32_t>(blocks.format),
+        .indexCount = blocks.indexCount,
+        .instanceCount = blocks.instanceCount,
+        .clusterCount = static_cast<uint32_t>(blocks.clusters.size()),
+        .symbolCount = blocks.symbolCount,
+        .segmentCount = blocks.segmentCount,
+        .boundsMin = blocks.boundsMin,
+        .boundsMax = blocks.boundsMax,
+        .vertexOffset = alignUp(sizeof(FileHeader)),
+        .vertexSize = blocks.vertices.size(),
+        .paletteSize = blocks.palette.size(),
+        .clusterOffset = 0,
+        .indexOffset = 0,
+        .storedIndexCount = blocks.indices.size(),
+    };
+    header.clusterOffset = alignUp(header.vertexOffset + header.vertexSize +
+                                   header.paletteSize);
+    header.indexOffset =
+        alignUp(header.clusterOffset + blocks.clusters.size_bytes());
+
+    // written next to the cache and moved over it like the pipeline cache,
+    // so a mapping never sees a partially written file
+    // named after the thread, jobs writing the same key at once would
+    // otherwise interleave their writes
+    const std::filesystem::path temporaryPath =
+        std::filesystem::path(path).concat(fmt::format(
+            ".{:x}.tmp",
+            std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+
+    uint64_t written = 0;
+    auto writeBlock = [&](uint64_t offset, std::span<const std::byte> data) {
+        static const char padding[GEOMETRY_CACHE_ALIGNMENT]{};
+        file.write(padding, static_cast<std::streamsize>(offset - written));
+        file.write(reinterpret_cast<const char *>(data.data()),
+                   static_cast<std::streamsize>(data.size()));
+        written = offset + data.size();
+    };
+
+    writeBlock(0, std::as_bytes(std::span(&header, 1)));
+    writeBlock(header.vertexOffset, blocks.vertices);
+    writeBlock(header.vertexOffset + header.vertexSize, blocks.palette);
+    writeBlock(header.clusterOffset, std::as_bytes(blocks.clusters));
+    writeBlock(header.indexOffset, std::as_bytes(blocks.indices));
+    file.close();
+
+    std::error_code error;
+    if (!file) {
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
+
+std::optional<CachedGeometry>
+openGeometryCache(const std::filesystem::path &path, uint64_t key) {
+    std::optional<MappedFile> file = MappedFile::open(path);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    std::span<const std::byte> data = file->getData();
+    // the block checks below only hold for sizes that can't overflow
+    FileHeader header{};
+    if (data.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+
+    const uint64_t clusterSize =
+        uint64_t{header.clusterCount} * sizeof(Cluster);
+    const uint64_t indexSize = header.storedIndexCount * sizeof(uint32_t);
+    const bool valid =
+        header.magic == GEOMETRY_CACHE_MAGIC &&
+        header.version == GEOMETRY_CACHE_VERSION && header.key == key &&
+        header.format <= static_cast<uint32_t>(VertexFormat::Tubes) &&
+        header.vertexSize <= data.size() && header.paletteSize <= data.size() &&
+        header.storedIndexCount <= data.size() &&
+        isBlockInFile(header.vertexOffset,
+                      header.vertexSize + header.paletteSize, data.size()) &&
+        isBlockInFile(header.clusterOffset, clusterSize, data.size()) &&
+        isBlockInFile(header.indexOffset, indexSize, data.size());
+    if (!valid) {
+        SPDLOG_WARN("ignoring stale geometry cache {}", path.string());
+        return std::nullopt;
+    }
+
+    GeometryBlocks blocks{
+        .format = static_cast<VertexFormat>(header.format),
+        .symbolCount = header.symbolCount,
+        .segmentCount = header.segmentCount,
+        .indexCount = header.indexCount,
+        .instanceCount = header.instanceCount,
+        .boundsMin = header.boundsMin,
+        .boundsMax = header.boundsMax,
+        .vertices = data.subspan(header.vertexOffset, header.vertexSize),
+        .palette = data.subspan(header.vertexOffset + header.vertexSize,
+                                header.paletteSize),
+        .clusters = {reinterpret_cast<const Cluster *>(data.data() +
+                                                       header.clusterOffset),
+                     header.clusterCount},
+        .indices = {reinterpret_cast<const uint32_t *>(data.data() +
+                                                       header.indexOffset),
+                    header.storedIndexCount},
+    };
+
+    return CachedGeometry{.file = std::move(*file), .blocks = blocks};
+}
+} // namespace lsv
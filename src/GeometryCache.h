@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+#include <glm/glm.hpp>
+
+#include "RendererTypes.h"
+#include "LSystem.h"
+#include "Turtle.h"
+
+namespace lsv {
+// read only view of a whole file, the pages are only read from disk once
+// they are touched
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // nullopt when the file can't be opened or is empty
+    static std::optional<MappedFile> open(const std::filesystem::path &path);
+
+    std::span<const std::byte> getData() const { return {data, size}; }
+
+private:
+    const std::byte *data{nullptr};
+    size_t size{0};
+#ifdef LSV_PLATFORM_WINDOWS
+    void *mapping{nullptr};
+#endif
+
+    void close();
+};
+
+// one uploadable mesh in the layout uploadMeshData expects, the counts are
+// the ones it is drawn with
+struct GeometryBlocks {
+    VertexFormat format;
+    uint64_t symbolCount;
+    uint64_t segmentCount;
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // stored back to back, the palette is empty for formats without one.
+    // full meshes keep the births of their segments there when they grow
+    std::span<const std::byte> vertices;
+    std::span<const std::byte> palette;
+    std::span<const Cluster> clusters;
+    std::span<const uint32_t> indices;
+};
+
+// a cache file kept mapped, blocks point into the mapping
+struct CachedGeometry {
+    MappedFile file;
+    GeometryBlocks blocks;
+};
+
+// identifies the output of a generation, the derivation strategy is left out
+// since every strategy produces the same mesh
+uint64_t geometryCacheKey(const LSystem &lsystem,
+                          const TurtleParameters &turtleParameters,
+                          uint32_t generations, VertexFormat format,
+                          bool births);
+
+// returns false when the file couldn't be written
+bool writeGeometryCache(const std::filesystem::path &path, uint64_t key,
+                        const GeometryBlocks &blocks);
+// nullopt when there is no valid cache for the key at path
+std::optional<CachedGeometry>
+openGeometryCache(const std::filesystem::path &path, uint64_t key);
+} // namespace lsv
@@ -0,0 +1,57 @@
+#include "Grammars.h"
+
+namespace lsv {
+const std::vector<ReferenceGrammar> &referenceGrammars() {
+    static const std::vector<ReferenceGrammar> grammars{
+        ReferenceGrammar{
+            .name = "dragon curve",
+            .axiom = "FX",
+            .rules = {{'X', "X+YF+"}, {'Y', "-FX-Y"}},
+            .turtle = {.angle = 90.0f, .width = 0.1f},
+            .maxGenerations = 16,
+        },
+        ReferenceGrammar{
+            .name = "barnsley fern",
+            .axiom = "X",
+            .rules = {{'X', "F+[[X]-X]-F[-FX]+X"}, {'F', "FF"}},
+            .turtle = {.angle = 25.0f},
+            .maxGenerations = 8,
+        },
+        // abop figure 1.25, the symbols without a turtle command only shape
+        // the derivation
+        ReferenceGrammar{
+            .name = "3d bush",
+            .axiom = "A",
+            .rules = {{'A', "[&FL!A]/////'[&FL!A]///////'[&FL!A]"},
+                      {'F', "S/////F"},
+                      {'S', "FL"},
+                      {'L', "['''^^{-f+f+f-|-f+f+f}]"}},
+            .turtle = {.angle = 22.5f, .width = 0.1f},
+            .maxGenerations = 8,
+        },
+        // abop figure 1.27, every branch rewrites with one of three rules
+        ReferenceGrammar{
+            .name = "stochastic plant",
+            .axiom = "F",
+            .rules = {{'F', "F[+F]F[-F]F", 0.33f},
+                      {'F', "F[+F]F", 0.33f},
+                      {'F', "F[-F]F", 0.34f}},
+            .seed = 1,
+            .turtle = {.angle = 25.7f},
+            .maxGenerations = 9,
+        },
+        // branches shrink every generation and stop once they are short,
+        // every module runs the condition and both length expressions
+        ReferenceGrammar{
+            .name = "parametric tree",
+            .axiom = "A(1)",
+            .rules = {{'A', "F(l)[&(30)A(l*0.8)]/(137.5)[&(30)A(l*0.7)]", 1.0f,
+                       "l", "l > 0.005"}},
+            .turtle = {.angle = 30.0f, .width = 0.02f},
+            .maxGenerations = 24,
+        },
+    };
+
+    return grammars;
+}
+} // namespace lsv
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "LSystem.h"
+#include "Turtle.h"
+
+namespace lsv {
+// well known grammars with the turtle settings they are usually drawn with
+struct ReferenceGrammar {
+    const char *name;
+    std::string axiom;
+    std::vector<Rule> rules;
+    // picks the derivation of stochastic grammars
+    uint64_t seed = 0;
+    TurtleParameters turtle;
+    // deepest generation that still fits comfortably in memory
+    uint32_t maxGenerations;
+};
+
+const std::vector<ReferenceGrammar> &referenceGrammars();
+} // namespace lsv
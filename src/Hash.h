@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace lsv {
+// fnv-1a, only used to tell grammars, derived keys and outputs apart. every
+// hash in the tree goes through here so that keys extending another one
+// stay in step with it
+constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+inline uint64_t hashBytes(uint64_t hash, std::span<const std::byte> bytes) {
+    for (std::byte byte : bytes) {
+        hash = (hash ^ static_cast<uint8_t>(byte)) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+uint64_t hashValues(uint64_t hash, std::span<const T> values) {
+    return hashBytes(hash, std::as_bytes(values));
+}
+
+template <typename T> uint64_t hashValue(uint64_t hash, const T &value) {
+    return hashBytes(hash, std::as_bytes(std::span(&value, 1)));
+}
+} // namespace lsv
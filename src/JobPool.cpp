@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "JobPool.h"
+
+namespace lsv {
+namespace {
+// the pool and queue of the worker running on this thread, if any
+thread_local const JobPool *currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+} // namespace
+
+JobPool::JobPool(size_t workerCount) {
+    workerCount = std::max<size_t>(workerCount, 1);
+
+    for (size_t i = 0; i < workerCount; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(
+            [this, i](std::stop_token stop) { work(stop, i); });
+    }
+}
+
+JobPool::~JobPool() {
+    for (std::jthread &worker : workers) {
+        worker.request_stop();
+    }
+    // wakes the workers sleeping on the epoch, they then see the stop
+    epoch.fetch_add(1);
+    epoch.notify_all();
+    workers.clear();
+}
+
+JobPool &JobPool::shared() {
+    // leaked, joining the workers at exit could race the destruction of
+    // other statics they touch, like the trace rings
+    static JobPool *pool = new JobPool();
+    return *pool;
+}
+
+size_t JobPool::defaultWorkerCount() {
+    const unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+}
+
+void JobPool::submit(Job job) {
+    const size_t index = currentPool == this
+                             ? currentQueue
+                             : nextQueue.fetch_add(1) % queues.size();
+
+    pending.fetch_add(1);
+    {
+        std::lock_guard lock(queues[index]->mutex);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+
+    // only costs a wake up when a worker is asleep
+    epoch.fetch_add(1);
+    epoch.notify_one();
+}
+
+void JobPool::wait() {
+    for (size_t count = pending.load(); count != 0; count = pending.load()) {
+        pending.wait(count);
+    }
+}
+
+void JobPool::runChunks(size_t chunkCount,
+                        const std::function<void(size_t)> &function) {
+    if (chunkCount <= 1) {
+        if (chunkCount == 1) {
+            function(0);
+        }
+        return;
+    }
+
+    // shared with the helper jobs, which may only start once every chunk
+    // was claimed and the caller has returned
+    struct Chunks {
+        const std::function<void(size_t)> *function;
+        size_t count;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> finished{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::exception_ptr exception;
+    };
+
+    auto chunks = std::make_shared<Chunks>();
+    chunks->function = &function;
+    chunks->count = chunkCount;
+
+    // the function is only called for claimed chunks, which the caller
+    // waits for, so late helpers never touch it
+    auto runClaimed = [](Chunks &state) {
+        for (size_t chunk = state.next.fetch_add(1); chunk < state.count;
+             chunk = state.next.fetch_add(1)) {
+            if (!state.failed.load(std::memory_order_relaxed)) {
+                try {
+                    (*state.function)(chunk);
+                } catch (...) {
+                    std::lock_guard lock(state.mutex);
+                    if (!state.exception) {
+                        state.exception = std::current_exception();
+                    }
+                    state.failed = true;
+                }
+            }
+            if (state.finished.fetch_add(1) + 1 == state.count) {
+                state.finished.notify_all();
+            }
+        }
+    };
+
+    const size_t helperCount = std::min(chunkCount - 1, workers.size());
+    for (size_t i = 0; i < helperCount; i++) {
+        submit([chunks, runClaimed] { runClaimed(*chunks); });
+    }
+    runClaimed(*chunks);
+
+    for (size_t count = chunks->finished.load(); count != chunkCount;
+         count = chunks->finished.load()) {
+        chunks->finished.wait(count);
+    }
+    // finished is only bumped after a chunk has stored its exception
+    if (chunks->exception) {
+        std::rethrow_exception(chunks->exception);
+    }
+}
+
+void JobPool::work(std::stop_token stop, size_t index) {
+    currentPool = this;
+    currentQueue = index;
+
+    while (!stop.stop_requested()) {
+        // read before looking at the queues, so a job submitted after they
+        // were found empty changes the epoch and the wait returns at once
+        const uint32_t seen = epoch.load();
+        Job job = take(index);
+        if (!job) {
+            if (stop.stop_requested()) {
+                return;
+            }
+            epoch.wait(seen);
+            continue;
+        }
+
+        try {
+            job();
+        } catch (const std::exception &e) {
+            SPDLOG_ERROR("job failed: {}", e.what());
+        } catch (...) {
+            SPDLOG_ERROR("job failed");
+        }
+
+        if (pending.fetch_sub(1) == 1) {
+            pending.notify_all();
+        }
+    }
+}
+
+JobPool::Job JobPool::take(size_t index) {
+    for (size_t i = 0; i < queues.size(); i++) {
+        Queue &queue = *queues[(index + i) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.jobs.empty()) {
+            continue;
+        }
+
+        Job job;
+        if (i == 0) {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        } else {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        return job;
+    }
+    return {};
+}
+} // namespace lsv
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lsv {
+// fixed set of workers with one queue each, a worker runs its own jobs
+// newest first and steals the oldest ones of the others when it runs dry.
+// jobs submitted from a worker go to that worker's queue. submitting and
+// taking a job only lock the queue they touch, there is no lock shared by
+// all workers
+class JobPool {
+public:
+    using Job = std::function<void()>;
+
+    // by default one worker per core besides the calling thread
+    explicit JobPool(size_t workerCount = defaultWorkerCount());
+    // jobs that haven't started by then are dropped
+    ~JobPool();
+
+    JobPool(const JobPool &) = delete;
+    JobPool &operator=(const JobPool &) = delete;
+
+    void submit(Job job);
+    // blocks until every job submitted so far has finished
+    void wait();
+
+    // runs function(chunk) for every chunk on the calling thread and the
+    // workers, returning once all of them are done. the first exception a
+    // chunk throws is rethrown here and the chunks not started by then are
+    // skipped. safe to call from a job, the caller only ever waits for
+    // chunks that are already running
+    void runChunks(size_t chunkCount,
+                   const std::function<void(size_t)> &function);
+
+    // the one pool the renderer and parallelChunks share, so the cores
+    // aren't oversubscribed by pools of their own. never destroyed, its
+    // workers sleep until the process exits
+    static JobPool &shared();
+
+    static size_t defaultWorkerCount();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> nextQueue{0};
+
+    // jobs that haven't finished, wait() sleeps on it reaching 0
+    std::atomic<size_t> pending{0};
+    // bumped by every submit, idle workers sleep on it changing
+    std::atomic<uint32_t> epoch{0};
+
+    // declared last so the workers are joined before the queues go away
+    std::vector<std::jthread> workers;
+
+    void work(std::stop_token stop, size_t index);
+    // empty when every queue is
+    Job take(size_t index);
+};
+} // namespace lsv
@@ -0,0 +1,750 @@
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "Hash.h"
+#include "LSystem.h"
+#include "Parallel.h"
+
+namespace lsv {
+namespace {
+// enough lanes for every parameter of any symbol
+constexpr size_t MAX_LANE_PARAMETERS = UINT8_MAX * EXPRESSION_LANES;
+
+// rules picked by no condition rewrite modules to themselves
+constexpr uint32_t NO_CANDIDATE = UINT32_MAX;
+
+// modules of one symbol or production evaluated together
+struct ModuleBatch {
+    uint32_t count{0};
+    uint64_t indices[EXPRESSION_LANES];
+    const float *inputs[EXPRESSION_LANES];
+    float *outputs[EXPRESSION_LANES];
+};
+
+// transposes the parameters of the batch into lanes, parameter major.
+// lanes past the batch keep whatever they held and are ignored
+void gatherLanes(const ModuleBatch &batch, uint32_t arity, float *lanes) {
+    for (uint32_t p = 0; p < arity; p++) {
+        for (uint32_t lane = 0; lane < batch.count; lane++) {
+            lanes[p * EXPRESSION_LANES + lane] = batch.inputs[lane][p];
+        }
+    }
+}
+} // namespace
+
+SymbolId SymbolTable::intern(char name, uint8_t arity) {
+    unsigned char key = name;
+    if (ids[key] >= 0) {
+        SymbolId id = static_cast<SymbolId>(ids[key]);
+        if (arities[id] != arity) {
+            throw std::runtime_error(
+                fmt::format("symbol '{}' used with {} and {} parameters", name,
+                            arities[id], arity));
+        }
+        return id;
+    }
+
+    ids[key] = static_cast<int16_t>(names.size());
+    names.push_back(name);
+    arities.push_back(arity);
+    return static_cast<SymbolId>(ids[key]);
+}
+
+std::optional<SymbolId> SymbolTable::find(char name) const {
+    int16_t id = ids[static_cast<unsigned char>(name)];
+    if (id < 0) {
+        return std::nullopt;
+    }
+    return static_cast<SymbolId>(id);
+}
+
+LSystem::LSystem(std::string axiom, std::vector<Rule> rules, uint64_t seed)
+    : rules(std::move(rules)), seed(seed) {
+    std::vector<Expression> parsedAxiom;
+    parseModules(axiom, {}, axiomSymbols, parsedAxiom);
+    // nothing to refer to, so every axiom parameter folds to a constant
+    for (const Expression &expression : parsedAxiom) {
+        axiomParameters.push_back(expression.getConstant());
+    }
+
+    struct ParsedRule {
+        std::vector<std::string> names;
+        std::vector<SymbolId> symbols;
+        std::vector<Expression> parameters;
+        std::optional<Expression> condition;
+    };
+
+    std::vector<ParsedRule> parsedRules(this->rules.size());
+    for (size_t i = 0; i < this->rules.size(); i++) {
+        const Rule &rule = this->rules[i];
+        ParsedRule &parsed = parsedRules[i];
+
+        std::string name;
+        for (char c : rule.parameters + ",") {
+            if (c == ',') {
+                if (!name.empty()) {
+                    parsed.names.push_back(std::move(name));
+                }
+                name.clear();
+            } else if (!std::isspace(static_cast<unsigned char>(c))) {
+                name.push_back(c);
+            }
+        }
+
+        parseModules(rule.successor, parsed.names, parsed.symbols,
+                     parsed.parameters);
+
+        if (!rule.condition.empty()) {
+            Expression condition =
+                Expression::parse(rule.condition, parsed.names);
+            // conditions that always hold are dropped, ones that never do
+            // still keep the rule from applying
+            if (!condition.isConstant() || condition.getConstant() == 0.0f) {
+                parsed.condition = std::move(condition);
+            }
+        }
+    }
+
+    productions.resize(symbols.size());
+    for (size_t id = 0; id < symbols.size(); id++) {
+        productions[id] = Production{
+            .symbolCount = 1,
+            .parameterCount = symbols.getArity(static_cast<SymbolId>(id)),
+            .arity = symbols.getArity(static_cast<SymbolId>(id)),
+            .identity = true,
+        };
+    }
+    identities = productions;
+
+    // every rule of a symbol, in the order they were given
+    std::vector<std::vector<size_t>> symbolRules(symbols.size());
+    for (size_t i = 0; i < this->rules.size(); i++) {
+        const Rule &rule = this->rules[i];
+        if (!(rule.probability > 0.0f) || std::isinf(rule.probability)) {
+            throw std::runtime_error(
+                fmt::format("rule for symbol '{}' has probability {}",
+                            rule.predecessor, rule.probability));
+        }
+
+        std::optional<SymbolId> id = symbols.find(rule.predecessor);
+        if (!id) {
+            // the predecessor never occurs anywhere so the rule can't fire
+            continue;
+        }
+
+        const size_t nameCount = parsedRules[i].names.size();
+        if (nameCount > 0 && nameCount != symbols.getArity(*id)) {
+            throw std::runtime_error(fmt::format(
+                "rule for symbol '{}' names {} parameters but it has {}",
+                rule.predecessor, nameCount, symbols.getArity(*id)));
+        }
+        symbolRules[*id].push_back(i);
+    }
+
+    auto addProduction = [&](size_t rule, uint32_t arity) {
+        ParsedRule &parsed = parsedRules[rule];
+        Production production{
+            .symbolOffset = static_cast<uint32_t>(successorSymbols.size()),
+            .symbolCount = static_cast<uint32_t>(parsed.symbols.size()),
+            .parameterOffset =
+                static_cast<uint32_t>(successorParameters.size()),
+            .parameterCount = static_cast<uint32_t>(parsed.parameters.size()),
+            .arity = arity,
+            .identity = false,
+        };
+        successorSymbols.insert(successorSymbols.end(), parsed.symbols.begin(),
+                                parsed.symbols.end());
+
+        // computed parameters keep a 0 in successorParameters, so offsets
+        // into it still line up with the successor symbols
+        for (const Expression &expression : parsed.parameters) {
+            const bool constant = expression.isConstant();
+            successorParameters.push_back(
+                constant ? expression.getConstant() : 0.0f);
+            production.evaluated |= !constant;
+        }
+        if (production.evaluated) {
+            production.expressionOffset =
+                static_cast<uint32_t>(successorExpressions.size());
+            production.batch = evaluatedCount++;
+            successorExpressions.insert(successorExpressions.end(),
+                                        parsed.parameters.begin(),
+                                        parsed.parameters.end());
+        }
+
+        if (parsed.condition) {
+            production.condition = static_cast<int32_t>(conditions.size());
+            conditions.push_back(*parsed.condition);
+        }
+        parametricRules |= production.evaluated || parsed.condition;
+        return production;
+    };
+
+    for (size_t id = 0; id < symbols.size(); id++) {
+        const std::vector<size_t> &ruleIndices = symbolRules[id];
+        Production &production = productions[id];
+        const bool conditional =
+            std::any_of(ruleIndices.begin(), ruleIndices.end(),
+                        [&](size_t rule) {
+                            return parsedRules[rule].condition.has_value();
+                        });
+
+        if (ruleIndices.size() == 1 && !conditional) {
+            production = addProduction(ruleIndices[0], production.arity);
+        } else if (!ruleIndices.empty()) {
+            // candidates are tracked as a bit per alternative
+            if (conditional && ruleIndices.size() > 32) {
+                throw std::runtime_error(fmt::format(
+                    "more than 32 rules for symbol '{}' with conditions",
+                    symbols.getName(static_cast<SymbolId>(id))));
+            }
+            stochastic |= ruleIndices.size() > 1;
+
+            double total = 0.0;
+            for (size_t rule : ruleIndices) {
+                total += this->rules[rule].probability;
+            }
+
+            // the first alternative doubles as the production for everything
+            // that doesn't draw, like the histogram and the memoized turtle
+            production = addProduction(ruleIndices[0], production.arity);
+            production.alternativeOffset =
+                static_cast<uint32_t>(alternatives.size());
+            production.alternativeCount =
+                static_cast<uint32_t>(ruleIndices.size());
+            production.conditional = conditional;
+
+            double cumulative = 0.0;
+            for (size_t i = 0; i < ruleIndices.size(); i++) {
+                const float probability =
+                    this->rules[ruleIndices[i]].probability;
+                cumulative += probability;
+                alternatives.push_back(
+                    i == 0 ? production
+                           : addProduction(ruleIndices[i], production.arity));
+                alternatives.back().alternativeCount = 0;
+                alternatives.back().conditional = false;
+                alternativeThresholds.push_back(
+                    static_cast<uint64_t>(cumulative / total * 0x1p32));
+                alternativeProbabilities.push_back(probability);
+            }
+        }
+    }
+
+    // symbol ids are assigned in parse order, so the names in id order plus
+    // the parsed axiom and successors determine every derivation
+    std::vector<char> names(symbols.size());
+    std::vector<uint32_t> layout;
+    for (size_t id = 0; id < symbols.size(); id++) {
+        names[id] = symbols.getName(static_cast<SymbolId>(id));
+        const Production &production = productions[id];
+        layout.insert(layout.end(),
+                      {production.symbolOffset, production.symbolCount,
+                       production.parameterOffset, production.parameterCount,
+                       production.arity, production.identity,
+                       production.conditional});
+    }
+    for (const Production &alternative : alternatives) {
+        layout.insert(layout.end(),
+                      {alternative.symbolOffset, alternative.symbolCount,
+                       alternative.parameterOffset,
+                       alternative.parameterCount,
+                       static_cast<uint32_t>(alternative.condition)});
+    }
+
+    hash = HASH_SEED;
+    hash = hashValues<char>(hash, names);
+    hash = hashValues<uint32_t>(hash, layout);
+    hash = hashValues<SymbolId>(hash, axiomSymbols);
+    hash = hashValues<float>(hash, axiomParameters);
+    hash = hashValues<SymbolId>(hash, successorSymbols);
+    hash = hashValues<float>(hash, successorParameters);
+    for (const Expression &expression : successorExpressions) {
+        hash = expression.hash(hash);
+    }
+    for (const Expression &condition : conditions) {
+        hash = condition.hash(hash);
+    }
+    // the seed only matters to stochastic systems, so deterministic ones
+    // keep their hash whatever it is
+    if (isStochastic()) {
+        hash = hashValues<uint64_t>(hash, alternativeThresholds);
+        hash = hashValues<uint64_t>(hash, std::span(&this->seed, 1));
+    }
+}
+
+void LSystem::parseModules(const std::string &text,
+                           std::span<const std::string> names,
+                           std::vector<SymbolId> &outSymbols,
+                           std::vector<Expression> &outParameters) {
+    size_t i = 0;
+    while (i < text.size()) {
+        char name = text[i++];
+        if (std::isspace(static_cast<unsigned char>(name))) {
+            continue;
+        }
+
+        uint8_t arity = 0;
+        if (i < text.size() && text[i] == '(') {
+            // parameters end at the comma or parenthesis that closes them,
+            // the expressions may nest parentheses of their own
+            size_t begin = ++i;
+            int depth = 0;
+            while (true) {
+                if (i == text.size()) {
+                    throw std::runtime_error(fmt::format(
+                        "unterminated parameter list in '{}'", text));
+                }
+
+                const char c = text[i++];
+                if (c == '(') {
+                    depth++;
+                } else if (c == ')' && depth > 0) {
+                    depth--;
+                } else if (c == ',' || c == ')') {
+                    if (depth > 0) {
+                        continue;
+                    }
+                    outParameters.push_back(Expression::parse(
+                        std::string_view(text).substr(begin, i - 1 - begin),
+                        names));
+                    arity++;
+                    begin = i;
+                    if (c == ')') {
+                        break;
+                    }
+                }
+            }
+        }
+
+        outSymbols.push_back(symbols.intern(name, arity));
+    }
+}
+
+ModuleString LSystem::derive(uint32_t generations,
+                             DerivationArena &arena) const {
+    ModuleString current{axiomSymbols, axiomParameters};
+
+    for (uint32_t i = 0; i < generations; i++) {
+        current = rewrite(current, i, arena.buffers[arena.current],
+                          arena.chunkCount);
+        arena.current ^= 1;
+    }
+
+    return current;
+}
+
+ModuleString LSystem::derive(uint32_t generations,
+                             DerivationCache &cache) const {
+    if (cache.grammarHash != hash) {
+        cache.grammarHash = hash;
+        cache.generations.clear();
+    }
+
+    ModuleString axiom{axiomSymbols, axiomParameters};
+    while (cache.generations.size() < generations) {
+        const size_t index = cache.generations.size();
+        if (cache.arenas.size() <= index) {
+            cache.arenas.push_back(std::make_unique<Arena>());
+        }
+
+        ModuleString previous =
+            index == 0 ? axiom : cache.generations[index - 1];
+        cache.generations.push_back(
+            rewrite(previous, static_cast<uint32_t>(index),
+                    *cache.arenas[index]));
+    }
+
+    return generations == 0 ? axiom : cache.generations[generations - 1];
+}
+
+std::vector<uint64_t> LSystem::symbolHistogram(uint32_t generations) const {
+    // stochastic symbols spread their count over the alternatives, which
+    // only stays exact in floating point for deterministic systems
+    std::vector<double> counts(symbols.size(), 0.0);
+    for (SymbolId symbol : axiomSymbols) {
+        counts[symbol]++;
+    }
+
+    std::vector<double> next(symbols.size());
+    for (uint32_t i = 0; i < generations; i++) {
+        std::fill(next.begin(), next.end(), 0.0);
+        for (size_t id = 0; id < symbols.size(); id++) {
+            const Production &production = productions[id];
+            if (production.identity) {
+                next[id] += counts[id];
+                continue;
+            }
+
+            std::span<const Production> choices(&production, 1);
+            if (production.alternativeCount > 0) {
+                choices = std::span(alternatives)
+                              .subspan(production.alternativeOffset,
+                                       production.alternativeCount);
+            }
+            uint64_t previousThreshold = 0;
+            for (size_t j = 0; j < choices.size(); j++) {
+                double share = 1.0;
+                if (production.alternativeCount > 0) {
+                    const uint64_t threshold =
+                        alternativeThresholds[production.alternativeOffset + j];
+                    share = (threshold - previousThreshold) * 0x1p-32;
+                    previousThreshold = threshold;
+                }
+                for (uint32_t k = 0; k < choices[j].symbolCount; k++) {
+                    next[successorSymbols[choices[j].symbolOffset + k]] +=
+                        counts[id] * share;
+                }
+            }
+        }
+        std::swap(counts, next);
+    }
+
+    std::vector<uint64_t> rounded(symbols.size());
+    for (size_t id = 0; id < symbols.size(); id++) {
+        rounded[id] = static_cast<uint64_t>(std::llround(counts[id]));
+    }
+    return rounded;
+}
+
+void LSystem::exportProductions(std::vector<uint32_t> &outProductions,
+                                std::vector<uint32_t> &outSuccessors) const {
+    outProductions.clear();
+    outSuccessors.clear();
+
+    for (size_t id = 0; id < symbols.size(); id++) {
+        const Production &production = productions[id];
+        outProductions.push_back(static_cast<uint32_t>(outSuccessors.size()));
+        outProductions.push_back(production.symbolCount);
+
+        if (production.identity) {
+            outSuccessors.push_back(static_cast<uint32_t>(id));
+        } else {
+            outSuccessors.insert(
+                outSuccessors.end(),
+                successorSymbols.begin() + production.symbolOffset,
+                successorSymbols.begin() + production.symbolOffset +
+                    production.symbolCount);
+        }
+    }
+}
+
+std::optional<ModuleString> LSystem::getSuccessor(SymbolId symbol) const {
+    const Production &production = productions[symbol];
+    if (production.identity) {
+        return std::nullopt;
+    }
+
+    return ModuleString{
+        std::span(successorSymbols).subspan(production.symbolOffset,
+                                            production.symbolCount),
+        std::span(successorParameters)
+            .subspan(production.parameterOffset, production.parameterCount),
+    };
+}
+
+bool LSystem::isParametric() const {
+    for (size_t id = 0; id < symbols.size(); id++) {
+        if (symbols.getArity(static_cast<SymbolId>(id)) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t LSystem::selectCandidate(const Production &production,
+                                  uint32_t generation, uint64_t index,
+                                  uint32_t candidates) const {
+    if (candidates == 0) {
+        return NO_CANDIDATE;
+    }
+    if (std::has_single_bit(candidates)) {
+        return production.alternativeOffset + std::countr_zero(candidates);
+    }
+
+    // the same draw as unconditional alternatives, spread over the
+    // probabilities of the candidates only
+    double total = 0.0;
+    for (uint32_t k = 0; k < production.alternativeCount; k++) {
+        if (candidates & (1u << k)) {
+            total += alternativeProbabilities[production.alternativeOffset + k];
+        }
+    }
+
+    const double target = drawRandom(generation, index) * 0x1p-32 * total;
+    double cumulative = 0.0;
+    uint32_t chosen = NO_CANDIDATE;
+    for (uint32_t k = 0; k < production.alternativeCount; k++) {
+        if (candidates & (1u << k)) {
+            chosen = production.alternativeOffset + k;
+            cumulative += alternativeProbabilities[chosen];
+            if (target < cumulative) {
+                break;
+            }
+        }
+    }
+    return chosen;
+}
+
+const LSystem::Production &
+LSystem::selectConditional(SymbolId symbol, uint32_t generation,
+                           uint64_t index, const float *parameters) const {
+    // a batch with a single module, so the values match the batched passes
+    // bit for bit
+    const Production &production = productions[symbol];
+    float lanes[MAX_LANE_PARAMETERS];
+    std::fill_n(lanes, production.arity * EXPRESSION_LANES, 0.0f);
+    for (uint32_t p = 0; p < production.arity; p++) {
+        lanes[p * EXPRESSION_LANES] = parameters[p];
+    }
+
+    uint32_t candidates = 0;
+    for (uint32_t k = 0; k < production.alternativeCount; k++) {
+        const Production &alternative =
+            alternatives[production.alternativeOffset + k];
+        float values[EXPRESSION_LANES] = {1.0f};
+        if (alternative.condition >= 0) {
+            conditions[alternative.condition].evaluate(lanes, values);
+        }
+        if (values[0] != 0.0f) {
+            candidates |= 1u << k;
+        }
+    }
+
+    const uint32_t chosen =
+        selectCandidate(production, generation, index, candidates);
+    return chosen == NO_CANDIDATE ? identities[symbol] : alternatives[chosen];
+}
+
+void LSystem::evaluateSuccessor(const Production &production,
+                                const float *parameters,
+                                float *outParameters) const {
+    float lanes[MAX_LANE_PARAMETERS];
+    std::fill_n(lanes, production.arity * EXPRESSION_LANES, 0.0f);
+    for (uint32_t p = 0; p < production.arity; p++) {
+        lanes[p * EXPRESSION_LANES] = parameters[p];
+    }
+
+    for (uint32_t k = 0; k < production.parameterCount; k++) {
+        float values[EXPRESSION_LANES];
+        successorExpressions[production.expressionOffset + k].evaluate(lanes,
+                                                                       values);
+        outParameters[k] = values[0];
+    }
+}
+
+ModuleString LSystem::rewrite(ModuleString input, uint32_t generation,
+                             Arena &output, size_t chunkCount) const {
+    const size_t inputSize = input.size();
+    if (chunkCount == 0) {
+        chunkCount =
+            std::clamp(inputSize / MIN_CHUNK_SIZE, size_t{1}, workerCount());
+    }
+    const size_t chunkSize = (inputSize + chunkCount - 1) / chunkCount;
+
+    auto chunkRange = [&](size_t chunk) {
+        size_t begin = std::min(chunk * chunkSize, inputSize);
+        size_t end = std::min(begin + chunkSize, inputSize);
+        return std::pair{begin, end};
+    };
+
+    struct ChunkOffsets {
+        size_t inputParameters;
+        size_t symbols;
+        size_t parameters;
+    };
+
+    // conditions read the parameters, so with any of them every chunk has to
+    // know where its parameters start before it can count
+    const bool conditional = !conditions.empty();
+    std::vector<size_t> inputOffsets(conditional ? chunkCount + 1 : 0, 0);
+    if (conditional) {
+        parallelChunks(chunkCount, [&](size_t chunk) {
+            auto [begin, end] = chunkRange(chunk);
+            size_t count = 0;
+            for (size_t i = begin; i < end; i++) {
+                count += productions[input.symbols[i]].arity;
+            }
+            inputOffsets[chunk + 1] = count;
+        });
+        for (size_t chunk = 1; chunk <= chunkCount; chunk++) {
+            inputOffsets[chunk] += inputOffsets[chunk - 1];
+        }
+    }
+    // alternative every module of a conditional symbol rewrites with, picked
+    // in the count pass so the write pass doesn't evaluate conditions again
+    std::vector<uint32_t> choices(conditional ? inputSize : 0);
+
+    // count pass: each chunk sums how much it reads and writes, the scan
+    // over chunk totals then gives every chunk its input and output offsets
+    std::vector<ChunkOffsets> offsets(chunkCount + 1, ChunkOffsets{});
+
+    parallelChunks(chunkCount, [&](size_t chunk) {
+        auto [begin, end] = chunkRange(chunk);
+        ChunkOffsets counts{};
+
+        // modules of a conditional symbol wait until a full batch of them
+        // can be evaluated at once
+        std::vector<ModuleBatch> batches(conditional ? symbols.size() : 0);
+        std::vector<float> lanes(conditional ? MAX_LANE_PARAMETERS : 0);
+        auto countBatch = [&](SymbolId symbol, ModuleBatch &batch) {
+            const Production &production = productions[symbol];
+            gatherLanes(batch, production.arity, lanes.data());
+
+            uint32_t candidates[EXPRESSION_LANES] = {};
+            for (uint32_t k = 0; k < production.alternativeCount; k++) {
+                const Production &alternative =
+                    alternatives[production.alternativeOffset + k];
+                float values[EXPRESSION_LANES];
+                std::fill_n(values, EXPRESSION_LANES, 1.0f);
+                if (alternative.condition >= 0) {
+                    conditions[alternative.condition].evaluate(lanes.data(),
+                                                               values);
+                }
+                for (size_t lane = 0; lane < EXPRESSION_LANES; lane++) {
+                    candidates[lane] |= values[lane] != 0.0f ? 1u << k : 0;
+                }
+            }
+
+            for (uint32_t lane = 0; lane < batch.count; lane++) {
+                const uint64_t index = batch.indices[lane];
+                const uint32_t chosen = selectCandidate(
+                    production, generation, index, candidates[lane]);
+                choices[index] = chosen;
+                const Production &rewritten = chosen == NO_CANDIDATE
+                                                  ? identities[symbol]
+                                                  : alternatives[chosen];
+                counts.symbols += rewritten.symbolCount;
+                counts.parameters += rewritten.parameterCount;
+            }
+            batch.count = 0;
+        };
+
+        const float *in =
+            conditional ? input.parameters.data() + inputOffsets[chunk]
+                        : input.parameters.data();
+        for (size_t i = begin; i < end; i++) {
+            const SymbolId symbol = input.symbols[i];
+            if (conditional && productions[symbol].conditional) {
+                ModuleBatch &batch = batches[symbol];
+                batch.indices[batch.count] = i;
+                batch.inputs[batch.count] = in + counts.inputParameters;
+                if (++batch.count == EXPRESSION_LANES) {
+                    countBatch(symbol, batch);
+                }
+                counts.inputParameters += productions[symbol].arity;
+                continue;
+            }
+
+            const Production &production = selectProduction(
+                symbol, generation, i, in + counts.inputParameters);
+            counts.inputParameters += production.arity;
+            counts.symbols += production.symbolCount;
+            counts.parameters += production.parameterCount;
+        }
+        for (size_t symbol = 0; symbol < batches.size(); symbol++) {
+            if (batches[symbol].count > 0) {
+                countBatch(static_cast<SymbolId>(symbol), batches[symbol]);
+            }
+        }
+
+        offsets[chunk + 1] = counts;
+    });
+
+    for (size_t chunk = 1; chunk <= chunkCount; chunk++) {
+        offsets[chunk].inputParameters += offsets[chunk - 1].inputParameters;
+        offsets[chunk].symbols += offsets[chunk - 1].symbols;
+        offsets[chunk].parameters += offsets[chunk - 1].parameters;
+    }
+
+    const size_t symbolCount = offsets.back().symbols;
+    const size_t parameterCount = offsets.back().parameters;
+
+    output.reset(Arena::footprint<SymbolId>(symbolCount) +
+                 Arena::footprint<float>(parameterCount));
+    std::span<SymbolId> outSymbols = output.allocate<SymbolId>(symbolCount);
+    std::span<float> outParameters = output.allocate<float>(parameterCount);
+
+    // write pass: chunks own disjoint output ranges so no synchronization is
+    // needed beyond the join
+    parallelChunks(chunkCount, [&](size_t chunk) {
+        auto [begin, end] = chunkRange(chunk);
+        const float *in =
+            input.parameters.data() + offsets[chunk].inputParameters;
+        SymbolId *symbolOut = outSymbols.data() + offsets[chunk].symbols;
+        float *parameterOut = outParameters.data() + offsets[chunk].parameters;
+
+        // computed parameters are batched per production the same way, their
+        // outputs are filled in once the batch is full
+        std::vector<ModuleBatch> batches(evaluatedCount);
+        std::vector<const Production *> batchProductions(evaluatedCount);
+        std::vector<float> lanes(evaluatedCount > 0 ? MAX_LANE_PARAMETERS : 0);
+        auto writeBatch = [&](const Production &production,
+                              ModuleBatch &batch) {
+            gatherLanes(batch, production.arity, lanes.data());
+            for (uint32_t k = 0; k < production.parameterCount; k++) {
+                float values[EXPRESSION_LANES];
+                successorExpressions[production.expressionOffset + k].evaluate(
+                    lanes.data(), values);
+                for (uint32_t lane = 0; lane < batch.count; lane++) {
+                    batch.outputs[lane][k] = values[lane];
+                }
+            }
+            batch.count = 0;
+        };
+
+        for (size_t i = begin; i < end; i++) {
+            SymbolId symbol = input.symbols[i];
+            // drawn again rather than stored, the draw only depends on the
+            // module index so it picks what the count pass picked
+            const Production *selected;
+            if (conditional && productions[symbol].conditional) {
+                selected = choices[i] == NO_CANDIDATE
+                               ? &identities[symbol]
+                               : &alternatives[choices[i]];
+            } else {
+                selected = &selectProduction(symbol, generation, i, in);
+            }
+            const Production &production = *selected;
+
+            if (production.identity) {
+                *symbolOut++ = symbol;
+                std::copy_n(in, production.arity, parameterOut);
+            } else {
+                std::copy_n(successorSymbols.data() + production.symbolOffset,
+                            production.symbolCount, symbolOut);
+                std::copy_n(successorParameters.data() +
+                                production.parameterOffset,
+                            production.parameterCount, parameterOut);
+                symbolOut += production.symbolCount;
+
+                if (production.evaluated) {
+                    ModuleBatch &batch = batches[production.batch];
+                    batchProductions[production.batch] = &production;
+                    batch.inputs[batch.count] = in;
+                    batch.outputs[batch.count] = parameterOut;
+                    if (++batch.count == EXPRESSION_LANES) {
+                        writeBatch(production, batch);
+                    }
+                }
+            }
+
+            parameterOut += production.parameterCount;
+            in += production.arity;
+        }
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (batches[i].count > 0) {
+                writeBatch(*batchProductions[i], batches[i]);
+            }
+        }
+    });
+
+    return ModuleString{outSymbols, outParameters};
+}
+} // namespace lsv
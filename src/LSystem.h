@@ -0,0 +1,369 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Arena.h"
+#include "Expression.h"
+#include "Philox.h"
+
+namespace lsv {
+using SymbolId = uint8_t;
+
+// interns single character symbol names into dense ids, every symbol has a
+// fixed parameter count so parameter offsets never need to be stored
+class SymbolTable {
+public:
+    SymbolTable() { ids.fill(-1); }
+
+    SymbolId intern(char name, uint8_t arity);
+    std::optional<SymbolId> find(char name) const;
+
+    char getName(SymbolId id) const { return names[id]; }
+    uint8_t getArity(SymbolId id) const { return arities[id]; }
+    size_t size() const { return names.size(); }
+
+private:
+    std::array<int16_t, 256> ids;
+    std::vector<char> names;
+    std::vector<uint8_t> arities;
+};
+
+// structure of arrays view of a derivation, parameters of all modules are
+// packed back to back in module order
+struct ModuleString {
+    std::span<const SymbolId> symbols;
+    std::span<const float> parameters;
+
+    size_t size() const { return symbols.size(); }
+};
+
+// the two ping-pong generation buffers, reset between generations but never
+// freed so repeated derivations stop touching the heap
+struct DerivationArena {
+    Arena buffers[2];
+    int current{0};
+    // generations are rewritten in exactly this many chunks whatever their
+    // size and the number of cores, 1 rewrites them on the calling thread.
+    // 0 picks the count from both
+    size_t chunkCount{0};
+};
+
+// keeps every generation of the last derived grammar, deriving it again or
+// deeper only rewrites the generations that are missing
+class DerivationCache {
+public:
+    // drops the cached generations but keeps their storage for reuse
+    void clear() { generations.clear(); }
+
+private:
+    friend class LSystem;
+
+    uint64_t grammarHash{0};
+    // generation i + 1 lives in arenas[i], arenas are never moved so the
+    // views into them stay valid while the cache grows
+    std::vector<std::unique_ptr<Arena>> arenas;
+    std::vector<ModuleString> generations;
+};
+
+// rules sharing a predecessor are stochastic, each is picked with its
+// probability relative to the sum of theirs. parametric rules name the
+// parameters of the predecessor to compute successor parameters from, like
+// A(l,w) : l > 2 -> F(l*0.7)[+A(l*0.5,w*0.6)]
+struct Rule {
+    char predecessor;
+    std::string successor;
+    float probability = 1.0f;
+    // comma separated, "l,w" in the example above
+    std::string parameters;
+    // the rule only applies to modules for which this is nonzero, to every
+    // module when empty
+    std::string condition;
+};
+
+class LSystem {
+public:
+    LSystem() = default;
+    // stochastic rules are decided by the seed, the generation and the
+    // position of the module, so every derivation with the same seed is the
+    // same however it is split across threads
+    LSystem(std::string axiom, std::vector<Rule> rules, uint64_t seed = 0);
+
+    // the returned view lives in the arena and is only valid until the arena
+    // is used for another derivation
+    ModuleString derive(uint32_t generations, DerivationArena &arena) const;
+    // the returned view stays valid until the cache is used with another
+    // grammar or cleared
+    ModuleString derive(uint32_t generations, DerivationCache &cache) const;
+
+    // walks the production tree depth first and hands every module of the
+    // final generation to emit(symbol, parameters) in order, memory use is
+    // bounded by the depth instead of the length of the derivation.
+    // emit(symbol, parameters, birth) is also told when the module was born,
+    // the generation it first appeared in plus where in the successor that
+    // introduced it it sits, from 0 at its start towards 1 at its end. the
+    // first module of a successor continues its predecessor when they are the
+    // same symbol, like the F of F -> F[+F]F, and stays as old as it was
+    template <typename F> void expand(uint32_t generations, F &&emit) const;
+
+    // number of occurrences of every symbol after the given number of
+    // generations, computed without deriving so buffers can be sized up front.
+    // only the expected counts for stochastic systems. with conditional rules
+    // it is no bound in either direction, every alternative is weighted by
+    // its probability whether its condition holds or not, and modules that
+    // keep themselves because no condition holds are counted as rewritten. it
+    // is then at most a hint to size buffers by
+    std::vector<uint64_t> symbolHistogram(uint32_t generations) const;
+
+    // flattened (offset, length) pairs per symbol into successors, symbols
+    // without a rule get themselves as successor
+    void exportProductions(std::vector<uint32_t> &outProductions,
+                           std::vector<uint32_t> &outSuccessors) const;
+
+    bool isParametric() const;
+    // true when any symbol has more than one rule
+    bool isStochastic() const { return stochastic; }
+    // true when any rule has a condition or computes successor parameters,
+    // so equal symbols no longer rewrite equally
+    bool hasParametricRules() const { return parametricRules; }
+
+    // identifies the grammar, equal for systems built from the same axiom and
+    // rules
+    uint64_t getHash() const { return hash; }
+
+    ModuleString getAxiom() const { return {axiomSymbols, axiomParameters}; }
+    // nullopt for symbols without a rule, which rewrite to themselves. the
+    // first rule of stochastic symbols, computed parameters are left 0
+    std::optional<ModuleString> getSuccessor(SymbolId symbol) const;
+
+    const SymbolTable &getSymbols() const { return symbols; }
+    const std::vector<Rule> &getRules() const { return rules; }
+
+private:
+    struct Production {
+        uint32_t symbolOffset;
+        uint32_t symbolCount;
+        uint32_t parameterOffset;
+        uint32_t parameterCount;
+        uint32_t arity;
+        bool identity;
+        // range of the rules in alternatives to pick from, empty for
+        // deterministic symbols
+        uint32_t alternativeOffset;
+        uint32_t alternativeCount;
+        // alternatives are only candidates while their condition holds
+        bool conditional;
+        // index into conditions, -1 for alternatives that always apply
+        int32_t condition = -1;
+        // the successor parameters are computed by parameterCount
+        // successorExpressions from expressionOffset on instead of copied
+        bool evaluated;
+        uint32_t expressionOffset;
+        // dense index among the evaluated productions to batch them by
+        uint32_t batch;
+    };
+
+    SymbolTable symbols;
+    std::vector<Rule> rules;
+
+    std::vector<SymbolId> axiomSymbols;
+    std::vector<float> axiomParameters;
+
+    std::vector<Production> productions;
+    std::vector<SymbolId> successorSymbols;
+    std::vector<float> successorParameters;
+
+    std::vector<Production> alternatives;
+    // cumulative probability of every alternative scaled to 2^32, a random
+    // draw below it picks the alternative
+    std::vector<uint64_t> alternativeThresholds;
+    std::vector<float> alternativeProbabilities;
+    uint64_t seed{0};
+    bool stochastic{false};
+
+    std::vector<Expression> successorExpressions;
+    std::vector<Expression> conditions;
+    // what conditional symbols rewrite with when no condition holds
+    std::vector<Production> identities;
+    uint32_t evaluatedCount{0};
+    bool parametricRules{false};
+
+    uint64_t hash{0};
+
+    void parseModules(const std::string &text,
+                      std::span<const std::string> names,
+                      std::vector<SymbolId> &outSymbols,
+                      std::vector<Expression> &outParameters);
+
+    uint32_t drawRandom(uint32_t generation, uint64_t index) const {
+        return philox4x32({static_cast<uint32_t>(index),
+                           static_cast<uint32_t>(index >> 32), generation, 0},
+                          {static_cast<uint32_t>(seed),
+                           static_cast<uint32_t>(seed >> 32)})[0];
+    }
+    // the production rewriting module index of the given generation
+    const Production &selectProduction(SymbolId symbol, uint32_t generation,
+                                       uint64_t index,
+                                       const float *parameters) const;
+    // candidates has a bit set for every alternative of the symbol whose
+    // condition holds, UINT32_MAX when none does
+    uint32_t selectCandidate(const Production &production, uint32_t generation,
+                             uint64_t index, uint32_t candidates) const;
+    // evaluates the conditions of a single module
+    const Production &selectConditional(SymbolId symbol, uint32_t generation,
+                                        uint64_t index,
+                                        const float *parameters) const;
+    // computes the successor parameters of a single module
+    void evaluateSuccessor(const Production &production,
+                           const float *parameters, float *outParameters) const;
+
+    ModuleString rewrite(ModuleString input, uint32_t generation,
+                         Arena &output, size_t chunkCount = 0) const;
+};
+
+inline const LSystem::Production &
+LSystem::selectProduction(SymbolId symbol, uint32_t generation,
+                          uint64_t index, const float *parameters) const {
+    const Production &production = productions[symbol];
+    if (production.alternativeCount == 0) {
+        return production;
+    }
+    if (production.conditional) {
+        return selectConditional(symbol, generation, index, parameters);
+    }
+
+    const uint32_t draw = drawRandom(generation, index);
+    const uint32_t last =
+        production.alternativeOffset + production.alternativeCount - 1;
+    uint32_t alternative = production.alternativeOffset;
+    while (alternative < last && draw >= alternativeThresholds[alternative]) {
+        alternative++;
+    }
+    return alternatives[alternative];
+}
+
+template <typename F>
+void LSystem::expand(uint32_t generations, F &&emit) const {
+    // births are only worked out when emit takes them
+    constexpr bool TRACK_BIRTHS =
+        std::is_invocable_v<F &, SymbolId, const float *, float>;
+
+    struct Frame {
+        const SymbolId *symbols;
+        const float *parameters;
+        uint32_t remaining;
+        uint32_t depth;
+        // the module the frame is the successor of, -1 for the axiom, and
+        // the part of its birth generation it covers
+        int32_t predecessor = -1;
+        float birthGeneration = 0.0f;
+        float birthStart = 0.0f;
+        float birthSpan = 1.0f;
+        uint32_t count = 0;
+    };
+
+    std::vector<Frame> stack;
+    stack.reserve(generations + 1);
+    // modules are reached in order within every generation, so counting them
+    // per depth gives the index stochastic rules are decided by
+    std::vector<uint64_t> indices(generations + 1, 0);
+    // only one frame per depth is live at a time, so computed parameters of
+    // the successor it walks can live in one buffer per depth
+    std::vector<std::vector<float>> evaluatedParameters(
+        parametricRules ? generations + 1 : 0);
+    stack.push_back(Frame{
+        .symbols = axiomSymbols.data(),
+        .parameters = axiomParameters.data(),
+        .remaining = static_cast<uint32_t>(axiomSymbols.size()),
+        .depth = 0,
+        .count = static_cast<uint32_t>(axiomSymbols.size()),
+    });
+
+    while (!stack.empty()) {
+        Frame &frame = stack.back();
+        if (frame.remaining == 0) {
+            stack.pop_back();
+            continue;
+        }
+
+        const SymbolId symbol = *frame.symbols++;
+        const float *parameters = frame.parameters;
+        frame.parameters += productions[symbol].arity;
+        const uint32_t position = frame.count - frame.remaining;
+        frame.remaining--;
+
+        // continuing modules take their share of what the predecessor
+        // covers, new ones their share of the whole successor
+        float birthGeneration = frame.birthGeneration;
+        float birthStart = frame.birthStart;
+        float birthSpan = frame.birthSpan;
+        if constexpr (TRACK_BIRTHS) {
+            if (position == 0 && frame.predecessor == symbol) {
+                birthSpan /= frame.count;
+            } else {
+                birthGeneration = static_cast<float>(frame.depth);
+                birthStart = static_cast<float>(position) / frame.count;
+                birthSpan = 1.0f / frame.count;
+            }
+        }
+        auto emitModule = [&] {
+            if constexpr (TRACK_BIRTHS) {
+                emit(symbol, parameters, birthGeneration + birthStart);
+            } else {
+                emit(symbol, parameters);
+            }
+        };
+        auto descend = [&](const SymbolId *symbols, const float *successor,
+                           uint32_t count) {
+            stack.push_back(Frame{
+                .symbols = symbols,
+                .parameters = successor,
+                .remaining = count,
+                .depth = frame.depth + 1,
+                .predecessor = symbol,
+                .birthGeneration = birthGeneration,
+                .birthStart = birthStart,
+                .birthSpan = birthSpan,
+                .count = count,
+            });
+        };
+
+        if (frame.depth == generations) {
+            emitModule();
+            continue;
+        }
+
+        const Production &production = selectProduction(
+            symbol, frame.depth, indices[frame.depth]++, parameters);
+        // identity productions never change the module, so it can be emitted
+        // right away whatever depth it was reached at. stochastic systems
+        // still have to count it in every generation below
+        if (production.identity) {
+            if (isStochastic()) {
+                descend(frame.symbols - 1, parameters, 1);
+            } else {
+                emitModule();
+            }
+            continue;
+        }
+
+        const float *successor =
+            successorParameters.data() + production.parameterOffset;
+        if (production.evaluated) {
+            std::vector<float> &buffer = evaluatedParameters[frame.depth + 1];
+            buffer.resize(production.parameterCount);
+            evaluateSuccessor(production, parameters, buffer.data());
+            successor = buffer.data();
+        }
+
+        descend(successorSymbols.data() + production.symbolOffset, successor,
+                production.symbolCount);
+    }
+}
+} // namespace lsv
@@ -0,0 +1,90 @@
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+#include "PackedMesh.h"
+
+namespace lsv {
+namespace {
+struct ColorHash {
+    size_t operator()(const glm::vec4 &color) const {
+        size_t hash = 0;
+        for (int i = 0; i < 4; i++) {
+            hash = hash * 31 + std::hash<float>()(color[i]);
+        }
+        return hash;
+    }
+};
+
+glm::u16vec3 quantizePosition(glm::vec3 position, glm::vec3 boundsMin,
+                              glm::vec3 scale) {
+    glm::vec3 normalized =
+        glm::clamp((position - boundsMin) * scale, 0.0f, 1.0f);
+    return glm::u16vec3(glm::round(normalized * 65535.0f));
+}
+
+glm::i16vec2 encodeOctahedral(glm::vec3 normal) {
+    normal /= std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+
+    glm::vec2 encoded(normal.x, normal.y);
+    if (normal.z < 0.0f) {
+        encoded = glm::vec2(
+            (1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    return glm::i16vec2(
+        glm::round(glm::clamp(encoded, -1.0f, 1.0f) * 32767.0f));
+}
+} // namespace
+
+std::optional<PackedMeshData> packMesh(MeshData &mesh) {
+    PackedMeshData packed;
+    packed.boundsMin = mesh.boundsMin;
+    packed.boundsMax = mesh.boundsMax;
+    packed.vertices.reserve(mesh.vertices.size());
+
+    const glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+    const glm::vec3 scale =
+        1.0f / glm::max(extent, glm::vec3(std::numeric_limits<float>::min()));
+
+    // branches mostly share a color, so checking the previous vertex first
+    // skips the hash lookup for nearly every vertex
+    std::unordered_map<glm::vec4, uint16_t, ColorHash> paletteIndices;
+    glm::vec4 lastColor{-1.0f};
+    uint16_t lastIndex = 0;
+
+    for (const Vertex &vertex : mesh.vertices) {
+        if (vertex.color != lastColor) {
+            auto [it, inserted] = paletteIndices.try_emplace(
+                vertex.color, static_cast<uint16_t>(packed.palette.size()));
+            if (inserted) {
+                if (packed.palette.size() >
+                    std::numeric_limits<uint16_t>::max()) {
+                    return std::nullopt;
+                }
+                packed.palette.push_back(vertex.color);
+            }
+            lastColor = vertex.color;
+            lastIndex = it->second;
+        }
+
+        packed.vertices.push_back(PackedVertex{
+            .position =
+                quantizePosition(vertex.position, mesh.boundsMin, scale),
+            .paletteIndex = lastIndex,
+            .normal = encodeOctahedral(vertex.normal),
+            .uv = glm::u16vec2(
+                glm::round(glm::clamp(glm::vec2(vertex.uvX, vertex.uvY), 0.0f,
+                                      1.0f) *
+                           65535.0f)),
+        });
+    }
+
+    packed.indices = std::move(mesh.indices);
+    packed.clusters = std::move(mesh.clusters);
+    mesh = {};
+
+    return packed;
+}
+} // namespace lsv
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "RendererTypes.h"
+#include "Turtle.h"
+
+namespace lsv {
+struct PackedMeshData {
+    std::vector<PackedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec4> palette;
+    std::vector<Cluster> clusters;
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+};
+
+// quantizes a mesh to PackedVertex, the decode lives in vertPackedMain. the
+// data of the mesh is moved into the result, unless the mesh has more colors
+// than a palette index can address. nothing is returned then and the mesh is
+// left as it was
+std::optional<PackedMeshData> packMesh(MeshData &mesh);
+} // namespace lsv
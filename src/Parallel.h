@@ -0,0 +1,26 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+
+#include "JobPool.h"
+
+namespace lsv {
+inline size_t workerCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// symbols per chunk below which a pass isn't split. a chunk is only a job on
+// the shared pool, but smaller ones would spend more time queueing, claiming
+// and joining it, and on the serial summaries between passes, than on their
+// symbols
+constexpr size_t MIN_CHUNK_SIZE = 1 << 16;
+
+// runs function(chunk) for every chunk on the calling thread and the workers
+// of the shared pool, and returns once all of them are done. rethrows the
+// first exception a chunk threw
+template <typename F> void parallelChunks(size_t chunkCount, F &&function) {
+    JobPool::shared().runChunks(chunkCount, function);
+}
+} // namespace lsv
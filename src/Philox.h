@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace lsv {
+// philox4x32-10 from salmon et al., "parallel random numbers: as easy as
+// 1, 2, 3". every counter maps to its own random block, so values can be
+// drawn in any order on any thread and still match a serial run
+constexpr std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> counter,
+                                             std::array<uint32_t, 2> key) {
+    constexpr uint32_t MULTIPLIERS[2] = {0xd2511f53, 0xcd9e8d57};
+    constexpr uint32_t WEYL[2] = {0x9e3779b9, 0xbb67ae85};
+
+    for (int round = 0; round < 10; round++) {
+        const uint64_t product0 = uint64_t{MULTIPLIERS[0]} * counter[0];
+        const uint64_t product1 = uint64_t{MULTIPLIERS[1]} * counter[2];
+        counter = {
+            static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+            static_cast<uint32_t>(product1),
+            static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+            static_cast<uint32_t>(product0),
+        };
+        key[0] += WEYL[0];
+        key[1] += WEYL[1];
+    }
+
+    return counter;
+}
+
+// known answer from the reference implementation
+static_assert(philox4x32({0, 0, 0, 0}, {0, 0}) ==
+              std::array<uint32_t, 4>{0x6627e8d5, 0xe169c58d, 0xbc57ac4c,
+                                      0x9b00dbd8});
+} // namespace lsv
@@ -13,14 +13,13 @@ void PipelineBuilder::clear() {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
     depthStencilState = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
-    dynamicState = {.sType =
-                        VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
     layout = {};
     renderingInfo = {.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
     shaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build(VkDevice device) {
+VkPipeline PipelineBuilder::build(VkDevice device, VkPipelineCache cache) {
     VkPipelineViewportStateCreateInfo viewportState{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
@@ -36,13 +35,10 @@ VkPipeline PipelineBuilder::build(VkDevice device) {
     VkPipelineVertexInputStateCreateInfo vertexInputState{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
 
-    VkDynamicState state[] = {VK_DYNAMIC_STATE_VIEWPORT,
-                              VK_DYNAMIC_STATE_SCISSOR};
-
     VkPipelineDynamicStateCreateInfo dynamicInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-        .dynamicStateCount = 2,
-        .pDynamicStates = state};
+        .dynamicStateCount = static_cast<uint32_t>(dynamicStates.size()),
+        .pDynamicStates = dynamicStates.data()};
 
     VkGraphicsPipelineCreateInfo pipelineInfo{
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
@@ -60,7 +56,7 @@ VkPipeline PipelineBuilder::build(VkDevice device) {
         .layout = layout};
 
     VkPipeline pipeline;
-    if (vkCreateGraphicsPipelines(device, nullptr, 1, &pipelineInfo, nullptr,
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr,
                                   &pipeline) != VK_SUCCESS) {
         return VK_NULL_HANDLE;
     } else {
@@ -74,20 +70,22 @@ PipelineBuilder &PipelineBuilder::setLayout(VkPipelineLayout layout) {
 }
 
 PipelineBuilder &PipelineBuilder::setShaders(VkShaderModule vertexShader,
-                                             VkShaderModule fragmentShader) {
+                                             VkShaderModule fragmentShader,
+                                             const char *vertexEntryPoint,
+                                             const char *fragmentEntryPoint) {
     shaderStages.clear();
 
     VkPipelineShaderStageCreateInfo vertexInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_VERTEX_BIT,
         .module = vertexShader,
-        .pName = "vertMain"};
+        .pName = vertexEntryPoint};
 
     VkPipelineShaderStageCreateInfo fragmentInfo{
         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
         .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-        .module = vertexShader,
-        .pName = "fragMain"};
+        .module = fragmentShader,
+        .pName = fragmentEntryPoint};
 
     shaderStages.push_back(vertexInfo);
     shaderStages.push_back(fragmentInfo);
@@ -95,10 +93,36 @@ PipelineBuilder &PipelineBuilder::setShaders(VkShaderModule vertexShader,
     return *this;
 }
 
+PipelineBuilder &PipelineBuilder::setMeshShaders(
+    VkShaderModule meshShader, const char *taskEntryPoint,
+    const char *meshEntryPoint, VkShaderModule fragmentShader,
+    const char *fragmentEntryPoint) {
+    shaderStages.clear();
+
+    const VkShaderStageFlagBits stages[3] = {VK_SHADER_STAGE_TASK_BIT_EXT,
+                                             VK_SHADER_STAGE_MESH_BIT_EXT,
+                                             VK_SHADER_STAGE_FRAGMENT_BIT};
+    const VkShaderModule modules[3] = {meshShader, meshShader, fragmentShader};
+    const char *entryPoints[3] = {taskEntryPoint, meshEntryPoint,
+                                  fragmentEntryPoint};
+
+    for (int i = 0; i < 3; i++) {
+        shaderStages.push_back(VkPipelineShaderStageCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = stages[i],
+            .module = modules[i],
+            .pName = entryPoints[i]});
+    }
+
+    return *this;
+}
+
 PipelineBuilder &
-PipelineBuilder::setInputTopology(VkPrimitiveTopology topology) {
+PipelineBuilder::setInputTopology(VkPrimitiveTopology topology,
+                                  bool primitiveRestart) {
     inputAssemblyState.topology = topology;
-    inputAssemblyState.primitiveRestartEnable = VK_FALSE;
+    inputAssemblyState.primitiveRestartEnable =
+        primitiveRestart ? VK_TRUE : VK_FALSE;
 
     return *this;
 }
@@ -164,4 +188,65 @@ PipelineBuilder &PipelineBuilder::setDepthTestDisabled() {
 
     return *this;
 }
+
+PipelineBuilder &PipelineBuilder::setDepthTest(bool depthWriteEnable,
+                                               VkCompareOp compareOp) {
+    depthStencilState.depthTestEnable = VK_TRUE;
+    depthStencilState.depthWriteEnable = depthWriteEnable;
+    depthStencilState.depthCompareOp = compareOp;
+    depthStencilState.depthBoundsTestEnable = VK_FALSE;
+    depthStencilState.stencilTestEnable = VK_FALSE;
+    depthStencilState.front = {};
+    depthStencilState.back = {};
+    depthStencilState.minDepthBounds = 0.0f;
+    depthStencilState.maxDepthBounds = 1.0f;
+
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::setDynamicLineWidth() {
+    dynamicStates.push_back(VK_DYNAMIC_STATE_LINE_WIDTH);
+
+    return *this;
+}
+
+void ComputePipelineBuilder::clear() {
+    shaderStage = {.sType =
+                       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    layout = {};
+}
+
+VkPipeline ComputePipelineBuilder::build(VkDevice device,
+                                         VkPipelineCache cache) {
+    VkComputePipelineCreateInfo pipelineInfo{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = shaderStage,
+        .layout = layout};
+
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr,
+                                 &pipeline) != VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    } else {
+        return pipeline;
+    }
+}
+
+ComputePipelineBuilder &
+ComputePipelineBuilder::setLayout(VkPipelineLayout layout) {
+    this->layout = layout;
+    return *this;
+}
+
+ComputePipelineBuilder &
+ComputePipelineBuilder::setShader(VkShaderModule computeShader,
+                                  const char *entryPoint) {
+    shaderStage = VkPipelineShaderStageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+        .module = computeShader,
+        .pName = entryPoint};
+
+    return *this;
+}
 } // namespace lsv
\ No newline at end of file
@@ -10,12 +10,21 @@ public:
     PipelineBuilder() { clear(); }
 
     void clear();
-    VkPipeline build(VkDevice device);
+    VkPipeline build(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
 
     PipelineBuilder &setLayout(VkPipelineLayout layout);
     PipelineBuilder &setShaders(VkShaderModule vertexShader,
-                                VkShaderModule fragmentShader);
-    PipelineBuilder &setInputTopology(VkPrimitiveTopology topology);
+                                VkShaderModule fragmentShader,
+                                const char *vertexEntryPoint = "vertMain",
+                                const char *fragmentEntryPoint = "fragMain");
+    // task and mesh stages replace the vertex stage and input assembly
+    PipelineBuilder &setMeshShaders(VkShaderModule meshShader,
+                                    const char *taskEntryPoint,
+                                    const char *meshEntryPoint,
+                                    VkShaderModule fragmentShader,
+                                    const char *fragmentEntryPoint);
+    PipelineBuilder &setInputTopology(VkPrimitiveTopology topology,
+                                      bool primitiveRestart = false);
     PipelineBuilder &setPolygonMode(VkPolygonMode mode);
     PipelineBuilder &setCullMode(VkCullModeFlags mode, VkFrontFace frontFace);
     PipelineBuilder &setMultisampleDisabled();
@@ -23,6 +32,9 @@ public:
     PipelineBuilder &setColorAttachmentFormat(VkFormat format);
     PipelineBuilder &setDepthFormat(VkFormat format);
     PipelineBuilder &setDepthTestDisabled();
+    PipelineBuilder &setDepthTest(bool depthWriteEnable, VkCompareOp compareOp);
+    // the line width is then set with vkCmdSetLineWidth
+    PipelineBuilder &setDynamicLineWidth();
 
 private:
     std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
@@ -31,9 +43,25 @@ private:
     VkPipelineMultisampleStateCreateInfo multisampleState;
     VkPipelineDepthStencilStateCreateInfo depthStencilState;
     VkPipelineColorBlendAttachmentState colorBlendState;
-    VkPipelineDynamicStateCreateInfo dynamicState;
+    std::vector<VkDynamicState> dynamicStates;
     VkPipelineLayout layout;
     VkPipelineRenderingCreateInfo renderingInfo;
     VkFormat colorAttachmentFormat;
 };
+
+class ComputePipelineBuilder {
+public:
+    ComputePipelineBuilder() { clear(); }
+
+    void clear();
+    VkPipeline build(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
+
+    ComputePipelineBuilder &setLayout(VkPipelineLayout layout);
+    ComputePipelineBuilder &setShader(VkShaderModule computeShader,
+                                      const char *entryPoint);
+
+private:
+    VkPipelineShaderStageCreateInfo shaderStage;
+    VkPipelineLayout layout;
+};
 } // namespace lsv
\ No newline at end of file
@@ -1,12 +1,19 @@
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <numeric>
 #include <stdexcept>
 #include <vector>
 #include <chrono>
+#include <thread>
 
 #include <spdlog/spdlog.h>
 #include <SDL2/SDL.h>
@@ -26,6 +33,11 @@
 
 #include "Renderer.h"
 #include "PipelineBuilder.h"
+#include "Trace.h"
+#include "shaders/cull_spv.h"
+#include "shaders/lsystem_spv.h"
+#include "shaders/mesh_spv.h"
+#include "shaders/tubes_spv.h"
 
 #define VK_CHECK(x)                                                            \
     do {                                                                       \
@@ -37,22 +49,294 @@
     } while (0)
 
 namespace lsv {
+namespace {
+// must match the constants at the top of lsystem.slang
+constexpr uint32_t COMPUTE_GROUP_SIZE = 256;
+constexpr uint32_t TURTLE_GROUP_SIZE = 64;
+constexpr uint32_t TURTLE_CHUNK_SIZE = 256;
+constexpr uint32_t TURTLE_MAX_LOCAL_DEPTH = 32;
+constexpr size_t TURTLE_CHUNK_STRIDE = 160;
+constexpr size_t TURTLE_TRANSFORM_STRIDE = 48;
+
+// must match GROUP_SIZE and REDUCE_GROUP_SIZE in cull.slang
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+constexpr uint32_t DEPTH_REDUCE_GROUP_SIZE = 8;
+
+constexpr uint32_t MAX_DISPATCH_GROUPS = 65535;
+
+// mesh vertices are read through their address, recolor copies them into a
+// new buffer
+constexpr VkBufferUsageFlags MESH_VERTEX_USAGE =
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+// must match SIDES in tubes.slang
+constexpr uint32_t CYLINDER_SIDES = 8;
+
+// must match TASK_SEGMENTS in tubes.slang
+constexpr uint32_t TUBE_TASK_SEGMENTS = 32;
+
+// offscreen frames have no viewport to follow, a fixed size keeps benchmark
+// results comparable
+constexpr VkExtent2D HEADLESS_DRAW_EXTENT{.width = 1920, .height = 1080};
+
+// the draw image is allocated in multiples of this and reallocated smaller
+// once it has this many times the area the viewport needs
+constexpr uint32_t DRAW_IMAGE_GRANULARITY = 128;
+constexpr uint64_t DRAW_IMAGE_SHRINK_FACTOR = 2;
+
+// dynamic resolution never drops below this fraction of the viewport, and
+// ignores scene times within the tolerance of the target
+constexpr float MIN_RENDER_SCALE = 0.25f;
+constexpr float RENDER_SCALE_TOLERANCE = 0.1f;
+constexpr float RENDER_SCALE_DAMPING = 0.25f;
+
+// radians per drawn frame
+constexpr float ROTATION_SPEED = 0.01f;
+// generations grown per drawn frame
+constexpr float GROWTH_SPEED = 0.005f;
+
+// frames drawn after every event when rendering on demand, imgui needs a few
+// to settle hover and layout state
+constexpr int REDRAW_FRAMES = 3;
+
+// frame start, end of the scene pass, end of the imgui pass
+constexpr uint32_t TIMESTAMP_COUNT = 3;
+
+// symbols interpreted between progress updates and checks for cancellation
+constexpr uint64_t PROGRESS_INTERVAL = 1 << 16;
+// the same for a built derivation, which the turtle splits over all cores
+// and so takes in larger slices
+constexpr uint64_t INTERPRET_SLICE = 1 << 22;
+// most segments reserved up front from a histogram that is only a hint, the
+// outputs double from there as the turtle writes them
+constexpr uint64_t MAX_ESTIMATED_SEGMENTS = 1 << 20;
+
+// generations that took less than this are cheaper to redo than to keep on
+// disk
+constexpr double GEOMETRY_CACHE_MIN_MS = 500.0;
+
+// most variants the gallery ui builds at once, each is a full mesh
+constexpr int MAX_GALLERY_VARIANTS = 1024;
+// fraction of its grid cell a gallery mesh is scaled to fill
+constexpr float GALLERY_CELL_FILL = 0.9f;
+// every gallery mesh starts on this to keep its vertices aligned
+constexpr VkDeviceSize GALLERY_MESH_ALIGNMENT = 16;
+
+// written to the working directory by the export trace button
+constexpr const char *TRACE_FILE = "lsv-trace.json";
+
+// indexed by Renderer::GenerationStage
+constexpr const char *GENERATION_STAGE_NAMES[] = {
+    "rewriting",
+    "interpreting",
+    "finishing",
+};
+
+constexpr size_t STAGING_CHUNK_SIZE = 16 << 20;
+constexpr size_t STAGING_CHUNK_COUNT = 4;
+
+// half the staging ring, so the uploads staged in a frame rarely find the
+// ring still full with the ones of the frame before
+constexpr size_t STREAM_BYTES_PER_FRAME =
+    STAGING_CHUNK_SIZE * STAGING_CHUNK_COUNT / 2;
+
+// indices of a chunk are 16 bit offsets from its first vertex, 0xffff is
+// kept free like a restart index would need
+constexpr uint32_t MAX_CHUNK_VERTICES = 0xffff;
+
+// the per user data directory from SDL_GetPrefPath when no directory is
+// given, the working directory when there is none either
+std::filesystem::path cacheDirectory(const char *directory) {
+    if (directory) {
+        return directory;
+    }
+
+    std::filesystem::path path = ".";
+    if (char *prefPath = SDL_GetPrefPath("lsv", "l-system-visualizer")) {
+        path = prefPath;
+        SDL_free(prefPath);
+    }
+    return path;
+}
+
+// groups consecutive clusters into chunks whose vertices fit 16 bit indices.
+// empty when the clusters don't tile the indices in order, like the
+// overlapping clusters of line strips, or a single cluster spans too many
+// vertices
+std::vector<MeshChunk> planChunks(std::span<const uint32_t> indices,
+                                  std::span<const Cluster> clusters) {
+    std::vector<MeshChunk> chunks;
+    uint32_t nextIndex = 0;
+    for (uint32_t i = 0; i < clusters.size(); i++) {
+        const Cluster &cluster = clusters[i];
+        if (cluster.firstIndex != nextIndex || cluster.instanceCount != 1 ||
+            cluster.indexCount > indices.size() - nextIndex) {
+            return {};
+        }
+        nextIndex += cluster.indexCount;
+
+        uint32_t first = UINT32_MAX;
+        uint32_t last = 0;
+        for (uint32_t index :
+             indices.subspan(cluster.firstIndex, cluster.indexCount)) {
+            first = std::min(first, index);
+            last = std::max(last, index);
+        }
+        if (first > last) {
+            first = last = 0;
+        }
+
+        if (!chunks.empty()) {
+            MeshChunk &chunk = chunks.back();
+            const uint32_t chunkFirst = std::min(chunk.firstVertex, first);
+            const uint64_t chunkEnd = std::max<uint64_t>(
+                uint64_t{chunk.firstVertex} + chunk.vertexCount,
+                uint64_t{last} + 1);
+            if (chunkEnd - chunkFirst <= MAX_CHUNK_VERTICES) {
+                chunk.clusterCount++;
+                chunk.indexCount += cluster.indexCount;
+                chunk.firstVertex = chunkFirst;
+                chunk.vertexCount =
+                    static_cast<uint32_t>(chunkEnd - chunkFirst);
+                continue;
+            }
+        }
+
+        if (uint64_t{last} - first + 1 > MAX_CHUNK_VERTICES) {
+            return {};
+        }
+        chunks.push_back(MeshChunk{
+            .firstCluster = i,
+            .clusterCount = 1,
+            .firstIndex = cluster.firstIndex,
+            .indexCount = cluster.indexCount,
+            .firstVertex = first,
+            .vertexCount = last - first + 1,
+        });
+    }
+
+    if (nextIndex != indices.size()) {
+        return {};
+    }
+    return chunks;
+}
+
+// every level of a depth pyramid halves the one before and rounds down until
+// a single texel is left, must match levelExtent in cull.slang
+std::vector<VkExtent2D> depthPyramidLevels(VkExtent2D extent) {
+    std::vector<VkExtent2D> levels{extent};
+    while (extent.width > 1 || extent.height > 1) {
+        extent = VkExtent2D{.width = std::max(extent.width / 2, 1u),
+                            .height = std::max(extent.height / 2, 1u)};
+        levels.push_back(extent);
+    }
+    return levels;
+}
+
+uint32_t dispatchGroups(uint64_t count, uint32_t groupSize) {
+    return static_cast<uint32_t>(std::clamp<uint64_t>(
+        (count + groupSize - 1) / groupSize, 1, MAX_DISPATCH_GROUPS));
+}
+
+void plotTimings(const char *label, const TimingHistory &history) {
+    std::string overlay = fmt::format("{:.2f} ms", history.latest());
+    ImGui::PlotLines(label, history.samples.data(), TimingHistory::SIZE,
+                     history.offset, overlay.c_str(), 0.0f, FLT_MAX,
+                     ImVec2(0.0f, 40.0f));
+}
+
+void drawMemoryStatistics(VmaAllocator allocator) {
+    constexpr double MIB = 1024.0 * 1024.0;
+
+    const VkPhysicalDeviceMemoryProperties *memoryProperties;
+    vmaGetMemoryProperties(allocator, &memoryProperties);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(allocator, budgets);
+
+    for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++) {
+        const VmaBudget &budget = budgets[heap];
+        const bool deviceLocal = memoryProperties->memoryHeaps[heap].flags &
+                                 VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        const std::string label = fmt::format(
+            "heap {} ({}): {:.1f} of {:.1f} MiB", heap,
+            deviceLocal ? "device" : "host", budget.usage / MIB,
+            budget.budget / MIB);
+        ImGui::ProgressBar(
+            budget.budget > 0
+                ? static_cast<float>(static_cast<double>(budget.usage) /
+                                     budget.budget)
+                : 0.0f,
+            ImVec2(-FLT_MIN, 0.0f), label.c_str());
+        ImGui::Text("  %u allocations, %.1f MiB in %u blocks of %.1f MiB",
+                    budget.statistics.allocationCount,
+                    budget.statistics.allocationBytes / MIB,
+                    budget.statistics.blockCount,
+                    budget.statistics.blockBytes / MIB);
+    }
+
+    // walks every allocation, which is only worth it while the panel is open
+    VmaTotalStatistics statistics;
+    vmaCalculateStatistics(allocator, &statistics);
+    const VmaDetailedStatistics &total = statistics.total;
+    ImGui::Text("largest allocation: %.1f MiB",
+                total.statistics.allocationCount > 0
+                    ? total.allocationSizeMax / MIB
+                    : 0.0);
+    ImGui::Text("unused: %u ranges, %.1f MiB", total.unusedRangeCount,
+                (total.statistics.blockBytes -
+                 total.statistics.allocationBytes) /
+                    MIB);
+}
+
+void logJobFailure(const char *job, std::exception_ptr exception) {
+    try {
+        std::rethrow_exception(exception);
+    } catch (const std::exception &e) {
+        SPDLOG_ERROR("{} failed: {}", job, e.what());
+    } catch (...) {
+        SPDLOG_ERROR("{} failed", job);
+    }
+}
+
+bool isStaged(const QueuedCopies &queued) {
+    return queued.nextCopy == queued.copies.size();
+}
+
+// the newest transfer reading anything staged for the stream
+uint64_t lastStagedValue(const MeshStream &stream) {
+    return std::max(stream.copies.timelineValue,
+                    stream.chunkValues.empty() ? 0 : stream.chunkValues.back());
+}
+} // namespace
+
 void Renderer::init(RenderConfig config) {
     if (isInitialized) {
         return;
     }
 
+    headless = config.headless;
+    presentMode = config.presentMode;
+    maxFrameRate = config.maxFrameRate;
+    renderOnDemand = config.renderOnDemand;
+    // an idle on demand session shouldn't animate
+    rotate = !renderOnDemand;
     windowExtent = VkExtent2D{.width = config.width, .height = config.height};
-    mainDrawExtent = VkExtent2D{.width = 1920, .height = 1080};
-
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_WindowFlags windowFlags =
-        (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
-    window = SDL_CreateWindow(config.applicationName, SDL_WINDOWPOS_UNDEFINED,
-                              SDL_WINDOWPOS_UNDEFINED, windowExtent.width,
-                              windowExtent.height, windowFlags);
-    if (!window) {
-        throw std::runtime_error("failed to create window");
+    // the viewport takes over sizing the draw image from the first frame on
+    mainDrawExtent = headless ? HEADLESS_DRAW_EXTENT : windowExtent;
+
+    if (!headless) {
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_WindowFlags windowFlags =
+            (SDL_WindowFlags)(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+        window = SDL_CreateWindow(
+            config.applicationName, SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED, windowExtent.width, windowExtent.height,
+            windowFlags);
+        if (!window) {
+            throw std::runtime_error("failed to create window");
+        }
     }
 
 #ifndef NDEBUG
@@ -65,6 +349,7 @@ void Renderer::init(RenderConfig config) {
     vkb::Instance vkbInst = instanceBuilder.set_app_name(config.applicationName)
                                 .request_validation_layers(useValidationLayers)
                                 .use_default_debug_messenger()
+                                .set_headless(headless)
                                 .require_api_version(1, 3, 0)
                                 .build()
                                 .value();
@@ -72,9 +357,12 @@ void Renderer::init(RenderConfig config) {
     instance = vkbInst.instance;
     debugMessenger = vkbInst.debug_messenger;
 
-    SDL_Vulkan_CreateSurface(window, instance, &surface);
-    if (surface == VK_NULL_HANDLE) {
-        throw std::runtime_error("failed to create surface");
+    surface = VK_NULL_HANDLE;
+    if (!headless) {
+        SDL_Vulkan_CreateSurface(window, instance, &surface);
+        if (surface == VK_NULL_HANDLE) {
+            throw std::runtime_error("failed to create surface");
+        }
     }
 
     VkPhysicalDeviceVulkan11Features features11{
@@ -84,6 +372,8 @@ void Renderer::init(RenderConfig config) {
 
     VkPhysicalDeviceVulkan12Features features12{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .drawIndirectCount = VK_TRUE,
+        .timelineSemaphore = VK_TRUE,
         .bufferDeviceAddress = VK_TRUE,
     };
 
@@ -93,27 +383,88 @@ void Renderer::init(RenderConfig config) {
         .synchronization2 = VK_TRUE,
     };
 
+    // indirect commands pick their first segment or gallery object through
+    // firstInstance, which has to stay 0 without drawIndirectFirstInstance
+    VkPhysicalDeviceFeatures features{
+        .multiDrawIndirect = VK_TRUE,
+        .drawIndirectFirstInstance = VK_TRUE,
+    };
+
     vkb::PhysicalDeviceSelector deviceSelector{vkbInst};
-    vkb::PhysicalDevice vkbPhysicalDevice =
-        deviceSelector.set_minimum_version(1, 3)
-            .set_required_features_11(features11)
-            .set_required_features_12(features12)
-            .set_required_features_13(features13)
-            .set_surface(surface)
-            .select()
-            .value();
+    deviceSelector.set_minimum_version(1, 3)
+        .set_required_features(features)
+        .set_required_features_11(features11)
+        .set_required_features_12(features12)
+        .set_required_features_13(features13)
+        .require_present(!headless);
+    if (!headless) {
+        deviceSelector.set_surface(surface);
+    }
+    vkb::PhysicalDevice vkbPhysicalDevice = deviceSelector.select().value();
+
+    if (vkbPhysicalDevice.enable_features_if_present(
+            VkPhysicalDeviceFeatures{.wideLines = VK_TRUE})) {
+        maxLineWidth = vkbPhysicalDevice.properties.limits.lineWidthRange[1];
+    }
+
+    VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+        .taskShader = VK_TRUE,
+        .meshShader = VK_TRUE,
+    };
+    if (vkbPhysicalDevice.is_extension_present(
+            VK_EXT_MESH_SHADER_EXTENSION_NAME) &&
+        vkbPhysicalDevice.enable_extension_features_if_present(
+            meshShaderFeatures)) {
+        vkbPhysicalDevice.enable_extension_if_present(
+            VK_EXT_MESH_SHADER_EXTENSION_NAME);
+        meshShaderSupported = true;
+    }
+
+    // lets vma report the budget the driver grants instead of estimating it
+    // from the heap sizes
+    const bool memoryBudgetSupported =
+        vkbPhysicalDevice.enable_extension_if_present(
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
     vkb::DeviceBuilder deviceBuilder{vkbPhysicalDevice};
     vkb::Device vkbDevice = deviceBuilder.build().value();
 
     physicalDevice = vkbPhysicalDevice.physical_device;
+    if (meshShaderSupported) {
+        vkCmdDrawMeshTasks = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(
+            vkGetDeviceProcAddr(vkbDevice.device, "vkCmdDrawMeshTasksEXT"));
+    }
+    timestampPeriod = vkbPhysicalDevice.properties.limits.timestampPeriod;
     device = vkbDevice.device;
     graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     graphicsQueueFamily =
         vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    // prefer a transfer only family, then any separate one, so uploads don't
+    // queue up behind rendering
+    auto dedicatedQueue =
+        vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    auto separateQueue = vkbDevice.get_queue(vkb::QueueType::transfer);
+    if (dedicatedQueue.has_value()) {
+        transferQueue = dedicatedQueue.value();
+        transferQueueFamily =
+            vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer)
+                .value();
+    } else if (separateQueue.has_value()) {
+        transferQueue = separateQueue.value();
+        transferQueueFamily =
+            vkbDevice.get_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        transferQueue = graphicsQueue;
+        transferQueueFamily = graphicsQueueFamily;
+    }
+
     VmaAllocatorCreateInfo allocatorInfo{
-        .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+        .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT |
+                 (memoryBudgetSupported
+                      ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT
+                      : 0u),
         .physicalDevice = physicalDevice,
         .device = device,
         .instance = instance,
@@ -121,41 +472,31 @@ void Renderer::init(RenderConfig config) {
 
     vmaCreateAllocator(&allocatorInfo, &allocator);
 
-    createSwapchain(windowExtent.width, windowExtent.height);
+    initPipelineCache(config.pipelineCacheDirectory);
+    geometryCacheDirectory = cacheDirectory(config.geometryCacheDirectory);
 
-    initImgui();
+    if (!headless) {
+        createSwapchain(windowExtent.width, windowExtent.height);
+        initImgui();
+    }
 
     initImmediateCommands();
 
-    createDrawImage();
+    initTransferCommands();
+
+    createDrawImage(mainDrawExtent);
 
     initFrameDatas();
 
     buildPipelines();
 
-    std::array<Vertex, 4> rectVertices;
-
-    rectVertices[0].position = {0.5, -0.5, 0};
-    rectVertices[1].position = {0.5, 0.5, 0};
-    rectVertices[2].position = {-0.5, -0.5, 0};
-    rectVertices[3].position = {-0.5, 0.5, 0};
-
-    rectVertices[0].color = {0, 0, 0, 1};
-    rectVertices[1].color = {0.5, 0.5, 0.5, 1};
-    rectVertices[2].color = {1, 0, 0, 1};
-    rectVertices[3].color = {0, 1, 0, 1};
+    MeshData cylinder = buildUnitCylinder(CYLINDER_SIDES);
+    MeshUpload cylinderUpload = uploadMesh(cylinder);
+    unitCylinder = waitForUpload(cylinderUpload);
+    drawUploadValue = cylinderUpload.timelineValue;
 
-    std::array<uint32_t, 6> rectIndices;
-
-    rectIndices[0] = 0;
-    rectIndices[1] = 1;
-    rectIndices[2] = 2;
-
-    rectIndices[3] = 2;
-    rectIndices[4] = 1;
-    rectIndices[5] = 3;
-
-    rectangle = uploadMesh(rectVertices, rectIndices);
+    lsystem = LSystem("X", {{'X', "F+[[X]-X]-F[-FX]+X"}, {'F', "FF"}});
+    regenerate();
 
     isInitialized = true;
 }
@@ -165,21 +506,46 @@ void Renderer::cleanup() {
         return;
     }
 
+    cancelGeneration();
+    cancelGallery();
+    jobPool.wait();
+    delete publishedGeometry.exchange(nullptr);
+    delete publishedGallery.exchange(nullptr);
+
     vkDeviceWaitIdle(device);
 
-    destroyBuffer(rectangle.indices);
-    destroyBuffer(rectangle.vertices);
+    for (FrameData &frame : frames) {
+        frame.deletionQueue.flush();
+    }
+
+    meshStream.reset();
+    destroyMesh(lsystemMesh);
+    if (pendingMesh && pendingMesh->verticesOnly) {
+        destroyVertices(pendingMesh->mesh);
+    } else if (pendingMesh) {
+        destroyMesh(pendingMesh->mesh);
+    }
+    destroyMesh(unitCylinder);
+    destroyGallery(gallery);
+    if (pendingGallery) {
+        destroyGallery(pendingGallery->gallery);
+    }
+
+    destroyTransferCommands();
 
     destroyPipelines();
+    savePipelineCache();
 
     destroyFrameDatas();
 
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
-    ImGui::DestroyContext();
-    vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
+    if (!headless) {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplSDL2_Shutdown();
+        ImGui::DestroyContext();
+        vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr);
 
-    destroySwapchain();
+        destroySwapchain();
+    }
 
     destroyDrawImage();
 
@@ -189,30 +555,51 @@ void Renderer::cleanup() {
     vmaDestroyAllocator(allocator);
     vkDestroyDevice(device, nullptr);
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!headless) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
 
     vkb::destroy_debug_utils_messenger(instance, debugMessenger);
     vkDestroyInstance(instance, nullptr);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+
+    if (!headless) {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
 }
 
 void Renderer::draw(ImDrawData *imGuiDrawData) {
+    TraceZone zone("draw");
     FrameData &currentFrame = getCurrentFrame();
 
     VK_CHECK(vkWaitForFences(device, 1, &currentFrame.renderFinishedFence, true,
                              1000000000));
-    VK_CHECK(vkResetFences(device, 1, &currentFrame.renderFinishedFence));
+
+    currentFrame.deletionQueue.flush();
+    if (readTimestamps(currentFrame)) {
+        updateRenderScale();
+    }
+    collectTransfers();
+    stageUploads();
+    swapPendingMesh();
 
     uint32_t swapchainImageIndex;
     VkResult acquireResult = vkAcquireNextImageKHR(
         device, swapchain, 1000000000, currentFrame.imageAvailableSemaphore,
         nullptr, &swapchainImageIndex);
-    if (acquireResult == VK_SUBOPTIMAL_KHR ||
-        acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
+    if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR) {
         swapchainStale = true;
         return;
     }
+    // a suboptimal image has still been acquired and its semaphore will be
+    // signaled, so it's drawn and presented before the swapchain is rebuilt
+    if (acquireResult == VK_SUBOPTIMAL_KHR) {
+        swapchainStale = true;
+    }
+
+    // only reset once a submission is guaranteed to signal the fence again,
+    // waitForFrames relies on every fence being signaled or in flight
+    VK_CHECK(vkResetFences(device, 1, &currentFrame.renderFinishedFence));
 
     VkImageSubresourceRange subResourceRange =
         createSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
@@ -227,68 +614,16 @@ void Renderer::draw(ImDrawData *imGuiDrawData) {
 
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
-    transitionImageLayout(cmd, mainDrawImage.image, VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-    VkClearValue clearValue;
-    std::copy(clearColor.begin(), clearColor.end(), clearValue.color.float32);
-
-    VkRenderingAttachmentInfo sceneAttachmentInfo{
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .imageView = mainDrawImage.imageView,
-        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .clearValue = clearValue,
-    };
-
-    VkRenderingInfo sceneRenderingInfo{
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = VkRect2D{.extent = mainDrawExtent},
-        .layerCount = 1,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &sceneAttachmentInfo,
-    };
-
-    vkCmdBeginRendering(cmd, &sceneRenderingInfo);
-
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
-
-    VkViewport viewport{.x = 0,
-                        .y = 0,
-                        .width = (float)mainDrawExtent.width,
-                        .height = (float)mainDrawExtent.height,
-                        .minDepth = 0.0f,
-                        .maxDepth = 1.0f};
-    vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-    VkRect2D scissor{.extent = mainDrawExtent};
-    vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-    glm::mat4 proj = glm::perspective(
-        45.0f, (float)mainDrawExtent.width / mainDrawExtent.height, 0.1f,
-        100.0f);
-
-    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.0f, -2.0f), glm::vec3(0.0f),
-                                 glm::vec3(0.0f, -1.0f, 0.0f));
-
-    glm::mat4 model =
-        glm::rotate(glm::mat4(1.0f), static_cast<float>(0.01 * frameNumber),
-                    glm::vec3(0.0f, 1.0f, 0.0f));
+    vkCmdResetQueryPool(cmd, currentFrame.timestampPool, 0, TIMESTAMP_COUNT);
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_NONE,
+                         currentFrame.timestampPool, 0);
 
-    GPUDrawPushConstants pushConstants{
-        .worldMatrix = proj * view * model,
-        .vertexBuffer = rectangle.vertexBufferAddress,
-    };
-
-    vkCmdPushConstants(cmd, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                       sizeof(GPUDrawPushConstants), &pushConstants);
-
-    vkCmdBindIndexBuffer(cmd, rectangle.indices.buffer, 0,
-                         VK_INDEX_TYPE_UINT32);
-
-    vkCmdDrawIndexed(cmd, 6, 1, 0, 0, 0);
+    recordCulling(cmd);
+    recordScene(cmd);
+    recordDepthPyramid(cmd);
 
-    vkCmdEndRendering(cmd);
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                         currentFrame.timestampPool, 1);
 
     transitionImageLayout(cmd, mainDrawImage.image,
                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
@@ -298,6 +633,9 @@ void Renderer::draw(ImDrawData *imGuiDrawData) {
                           VK_IMAGE_LAYOUT_UNDEFINED,
                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
+    VkClearValue clearValue;
+    std::copy(clearColor.begin(), clearColor.end(), clearValue.color.float32);
+
     VkRenderingAttachmentInfo attachmentInfo{
         .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
         .imageView = swapchainImageViews[swapchainImageIndex],
@@ -320,20 +658,38 @@ void Renderer::draw(ImDrawData *imGuiDrawData) {
 
     vkCmdEndRendering(cmd);
 
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                         currentFrame.timestampPool, 2);
+
     transitionImageLayout(cmd, swapchainImages[swapchainImageIndex],
                           VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
                           VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
     VK_CHECK(vkEndCommandBuffer(cmd));
 
-    VkPipelineStageFlags waitStages =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    // the mesh upload has already completed on the host side, waiting on it
+    // makes the transfer queue writes visible to this submission. galleries
+    // upload their draw commands too
+    VkSemaphore waitSemaphores[2] = {currentFrame.imageAvailableSemaphore,
+                                     uploadSemaphore};
+    VkPipelineStageFlags waitStages[2] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        uploadWaitStages(),
+    };
+    uint64_t waitValues[2] = {0, drawUploadValue};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = 2,
+        .pWaitSemaphoreValues = waitValues,
+    };
 
     VkSubmitInfo submitInfo{
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &currentFrame.imageAvailableSemaphore,
-        .pWaitDstStageMask = &waitStages,
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = 2,
+        .pWaitSemaphores = waitSemaphores,
+        .pWaitDstStageMask = waitStages,
         .commandBufferCount = 1,
         .pCommandBuffers = &cmd,
         .signalSemaphoreCount = 1,
@@ -341,6 +697,7 @@ void Renderer::draw(ImDrawData *imGuiDrawData) {
 
     VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo,
                            currentFrame.renderFinishedFence));
+    currentFrame.timestampsWritten = true;
 
     VkPresentInfoKHR presentInfo{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -358,31 +715,64 @@ void Renderer::draw(ImDrawData *imGuiDrawData) {
     }
 
     frameNumber++;
+    if (rotate) {
+        rotation += ROTATION_SPEED;
+    }
+    advanceGrowth();
 }
 
 void Renderer::run() {
+    using Clock = std::chrono::high_resolution_clock;
+
     SDL_Event e;
     bool shouldQuit = false;
+    int redrawFrames = REDRAW_FRAMES;
+
+    auto processEvent = [&](const SDL_Event &event) {
+        ImGui_ImplSDL2_ProcessEvent(&event);
+        if (event.type == SDL_QUIT) {
+            shouldQuit = true;
+        }
+        redrawFrames = REDRAW_FRAMES;
+    };
 
-    auto lastTime = std::chrono::high_resolution_clock::now();
+    auto lastTime = Clock::now();
+    auto nextFrameTime = lastTime;
 
     while (!shouldQuit) {
-        auto now = std::chrono::high_resolution_clock::now();
+        // ui changes always follow an event, only animation and meshes still
+        // being uploaded change the picture on their own
+        const bool growing = playGrowth && isGrowing();
+        const bool idle = redrawFrames == 0 && !rotate && !growing &&
+                          !pendingMesh && !meshStream && !generationProgress &&
+                          !galleryBuilding && !pendingGallery &&
+                          !swapchainStale;
+        if (renderOnDemand && idle) {
+            auto waitStart = Clock::now();
+            if (SDL_WaitEvent(&e)) {
+                processEvent(e);
+            }
+            // time spent waiting isn't part of any frame
+            lastTime += Clock::now() - waitStart;
+        }
+        TraceZone frameZone("frame");
+
+        auto now = Clock::now();
         double delta =
             std::chrono::duration<double, std::milli>(now - lastTime).count();
         lastTime = now;
 
         while (SDL_PollEvent(&e) != 0) {
-            ImGui_ImplSDL2_ProcessEvent(&e);
-            if (e.type == SDL_QUIT) {
-                shouldQuit = true;
-            }
+            processEvent(e);
         }
 
         if (swapchainStale) {
             rebuildSwapchain();
         }
 
+        collectGeometry();
+        collectGallery();
+
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplSDL2_NewFrame();
         ImGui::NewFrame();
@@ -392,25 +782,163 @@ void Renderer::run() {
             ImGuiDockNodeFlags_NoTabBar | ImGuiDockNodeFlags_NoWindowMenuButton;
         ImGui::DockSpaceOverViewport(dockspaceID, nullptr, dockspaceFlags);
 
+        cpuFrameTimes.push(static_cast<float>(delta));
+
         ImGui::Begin("info");
         ImGui::Text("cpu frame time: %2.0f ms (%4.0f fps)", delta,
                     1000 / delta);
+        if (ImGui::CollapsingHeader("timings",
+                                    ImGuiTreeNodeFlags_DefaultOpen)) {
+            plotTimings("cpu frame", cpuFrameTimes);
+            plotTimings("gpu frame", gpuFrameTimes);
+            plotTimings("gpu scene", gpuSceneTimes);
+            plotTimings("gpu imgui", gpuImguiTimes);
+            ImGui::Text("rewrite: %.2f ms", generationTimings.rewriteMs);
+            ImGui::Text("interpret: %.2f ms", generationTimings.interpretMs);
+            ImGui::Text("upload: %.2f ms", generationTimings.uploadMs);
+            if (ImGui::Button("export trace")) {
+                const std::filesystem::path path =
+                    std::filesystem::absolute(TRACE_FILE);
+                if (writeTrace(path)) {
+                    SPDLOG_INFO("wrote trace to {}", path.string());
+                } else {
+                    SPDLOG_WARN("failed to write trace to {}", path.string());
+                }
+            }
+        }
+        if (ImGui::CollapsingHeader("memory")) {
+            drawMemoryStatistics(allocator);
+        }
+        if (generationProgress) {
+            const GenerationStage stage = generationProgress->stage;
+            const float fraction =
+                stage == GenerationStage::Finishing
+                    ? 1.0f
+                    : generationProgress->fraction.load();
+            const char *stageName =
+                GENERATION_STAGE_NAMES[static_cast<int>(stage)];
+            const std::string label =
+                fraction < 0.0f
+                    ? std::string(stageName)
+                    : fmt::format("{} {:.0f}%", stageName, fraction * 100.0f);
+            ImGui::ProgressBar(std::max(fraction, 0.0f),
+                               ImVec2(-FLT_MIN, 0.0f), label.c_str());
+            if (ImGui::Button("cancel")) {
+                cancelGeneration();
+            }
+        }
         ImGui::ColorPicker4("clear color", clearColor.data());
+        if (ImGui::SliderInt("generations", &generations, 0, 8)) {
+            regenerate();
+        }
+        if (ImGui::Checkbox("stream derivation", &streamDerivation)) {
+            regenerate();
+        }
+        if (ImGui::Checkbox("memoize subtrees", &memoizeSubtrees)) {
+            regenerate();
+        }
+        if (ImGui::Checkbox("generate on gpu", &generateOnGPU)) {
+            regenerate();
+        }
+        ImGui::Checkbox("cache geometry on disk", &cacheGeometry);
+        if (ImGui::Checkbox("animate growth", &animateGrowth)) {
+            regenerate();
+        }
+        if (isGrowing()) {
+            ImGui::SliderFloat("growth", &growthTime, 0.0f,
+                               static_cast<float>(generations + 1));
+            ImGui::SameLine();
+            ImGui::Checkbox("play", &playGrowth);
+        }
+        if (ImGui::Combo("vertex format", reinterpret_cast<int *>(&meshFormat),
+                         "full\0packed\0instanced segments\0lines\0"
+                         "mesh shader tubes\0")) {
+            if (!supportsFormat(meshFormat)) {
+                SPDLOG_WARN("mesh shaders aren't supported, drawing instanced "
+                            "segments instead");
+                meshFormat = VertexFormat::Segments;
+            }
+            regenerate();
+        }
+        if (meshFormat == VertexFormat::Lines && maxLineWidth > 1.0f) {
+            ImGui::SliderFloat("line width", &lineWidth, 1.0f, maxLineWidth,
+                               "%.1f px");
+        }
+        if (ImGui::SliderFloat("angle", &turtleParameters.angle, 0.0f,
+                               180.0f)) {
+            reinterpret();
+        }
+        if (ImGui::SliderFloat("step length", &turtleParameters.stepLength,
+                               0.1f, 4.0f)) {
+            reinterpret();
+        }
+        if (ImGui::SliderFloat("width", &turtleParameters.width, 0.01f,
+                               1.0f)) {
+            reinterpret();
+        }
+        if (ImGui::ColorEdit4("color", &turtleParameters.color.x)) {
+            recolor();
+        }
+        if (ImGui::CollapsingHeader("gallery")) {
+            ImGui::SliderInt("variants", &galleryVariants, 1,
+                             MAX_GALLERY_VARIANTS);
+            ImGui::SliderFloat("angle spread", &galleryAngleSpread, 0.0f,
+                               90.0f);
+            if (ImGui::Button("build gallery")) {
+                requestGallery();
+            }
+            if (gallery.objectCount > 0 || galleryBuilding || pendingGallery) {
+                ImGui::SameLine();
+                if (ImGui::Button("close gallery")) {
+                    cancelGallery();
+                    uploadGallery({}, nullptr);
+                }
+            }
+            if (galleryBuilding || pendingGallery) {
+                ImGui::Text("building gallery...");
+            } else if (gallery.objectCount > 0) {
+                ImGui::Text("gallery objects: %u", gallery.objectCount);
+            }
+        }
+        ImGui::Checkbox("rotate", &rotate);
+        ImGui::Checkbox("occlusion culling", &occlusionCulling);
+        ImGui::Checkbox("dynamic resolution", &dynamicResolution);
+        if (dynamicResolution) {
+            ImGui::SliderFloat("target scene time", &targetSceneMs, 1.0f,
+                               33.0f, "%.1f ms");
+        }
+        ImGui::Text("resolution: %ux%u (%.0f%%)", mainDrawExtent.width,
+                    mainDrawExtent.height, renderScale * 100.0f);
+        ImGui::Text("symbols: %zu", symbolCount);
+        ImGui::Text("segments: %zu", segmentCount);
+        ImGui::Text("clusters: %u", lsystemMesh.clusterCount);
+        if (lsystemMesh.vertexFormat == VertexFormat::Lines) {
+            ImGui::Text(
+                "line vertices: %llu",
+                static_cast<unsigned long long>(lsystemMesh.lineVertexCount));
+        } else {
+            ImGui::Text(
+                "triangles: %llu",
+                static_cast<unsigned long long>(lsystemMesh.indexCount) / 3 *
+                    lsystemMesh.instanceCount);
+        }
         ImGui::End();
 
         ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
         ImGui::Begin("viewport");
 
-        // TODO: this sizing stuff doesn't work if viewport is larger than main
-        // draw image (aspect ratio mismatch will cause stretching issues)
         ImVec2 viewportSize = ImGui::GetContentRegionAvail();
-        mainDrawExtent.width = viewportSize.x;
-        mainDrawExtent.height = viewportSize.y;
-
-        float uvX =
-            std::min(viewportSize.x / mainDrawImage.imageExtent.width, 1.0f);
-        float uvY =
-            std::min(viewportSize.y / mainDrawImage.imageExtent.height, 1.0f);
+        fitDrawImage(VkExtent2D{
+            .width = static_cast<uint32_t>(std::max(viewportSize.x, 1.0f)),
+            .height = static_cast<uint32_t>(std::max(viewportSize.y, 1.0f)),
+        });
+
+        // the texels past mainDrawExtent are never drawn, stopping half a
+        // texel short keeps linear filtering from blending them in
+        float uvX = (static_cast<float>(mainDrawExtent.width) - 0.5f) /
+                    mainDrawImage.imageExtent.width;
+        float uvY = (static_cast<float>(mainDrawExtent.height) - 0.5f) /
+                    mainDrawImage.imageExtent.height;
 
         ImGui::Image((ImTextureID)imguiDescriptorSet, viewportSize,
                      ImVec2(0, 0), ImVec2(uvX, uvY));
@@ -421,72 +949,888 @@ void Renderer::run() {
         ImDrawData *drawData = ImGui::GetDrawData();
 
         draw(drawData);
+        redrawFrames = std::max(redrawFrames - 1, 0);
+
+        if (maxFrameRate > 0.0f) {
+            TraceZone paceZone("pace frame");
+            // a late frame moves the schedule instead of being caught up on
+            nextFrameTime = std::max(
+                nextFrameTime + std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(
+                                        1.0 / maxFrameRate)),
+                Clock::now());
+            std::this_thread::sleep_until(nextFrameTime);
+        }
     }
 }
 
-void Renderer::initImmediateCommands() {
-    VkFenceCreateInfo fenceInfo{
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    };
+glm::mat4 Renderer::sceneMatrix(const glm::mat4 &transform) const {
+    glm::mat4 proj = glm::perspective(
+        45.0f, (float)mainDrawExtent.width / mainDrawExtent.height, 0.1f,
+        100.0f);
 
-    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &immediateCmdFence));
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.0f, -2.0f), glm::vec3(0.0f),
+                                 glm::vec3(0.0f, -1.0f, 0.0f));
 
-    VkCommandPoolCreateInfo poolInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = graphicsQueueFamily,
-    };
+    glm::mat4 model =
+        glm::rotate(glm::mat4(1.0f), rotation, glm::vec3(0.0f, 1.0f, 0.0f)) *
+        transform;
 
-    VK_CHECK(
-        vkCreateCommandPool(device, &poolInfo, nullptr, &immediateCmdPool));
+    return proj * view * model;
+}
 
-    VkCommandBufferAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = immediateCmdPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
+void Renderer::recordCulling(VkCommandBuffer cmd) {
+    // the gallery is drawn in place of the mesh and isn't culled
+    if (lsystemMesh.readyClusterCount == 0 || gallery.objectCount > 0) {
+        return;
+    }
+
+    // the previous frame may still be drawing from the same commands
+    computeBarrier(cmd);
+    vkCmdFillBuffer(cmd, lsystemMesh.drawCount.buffer, 0, sizeof(uint32_t),
+                    0);
+    computeBarrier(cmd);
+
+    // the pyramid of another mesh, or of an earlier buffer of this one, says
+    // nothing about what hides these clusters
+    const VkDeviceAddress pyramidAddress =
+        occlusionCulling &&
+                depthPyramidClusters == lsystemMesh.clusterAddress
+            ? getBufferAddress(depthPyramid)
+            : 0;
+
+    GPUCullPushConstants cullConstants{
+        .worldMatrix = sceneMatrix(meshTransform),
+        .clusters = lsystemMesh.clusterAddress,
+        .clusterVertices = lsystemMesh.clusterVerticesAddress,
+        .drawCommands = getBufferAddress(lsystemMesh.drawCommands),
+        .drawCount = getBufferAddress(lsystemMesh.drawCount),
+        .depthPyramid = pyramidAddress,
+        .depthLevels =
+            pyramidAddress != 0 ? pyramidAddress + sizeof(GPUDepthPyramid)
+                                : 0,
+        .clusterCount = lsystemMesh.readyClusterCount,
+        .groupCount =
+            dispatchGroups(lsystemMesh.readyClusterCount, CULL_GROUP_SIZE),
     };
 
-    VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &immediateCmdBuffer));
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(GPUCullPushConstants), &cullConstants);
+    vkCmdDispatch(cmd, cullConstants.groupCount, 1, 1);
+    computeBarrier(cmd);
 }
 
-void Renderer::immediateSubmit(
-    std::function<void(VkCommandBuffer cmd)> &&function) {
+void Renderer::recordScene(VkCommandBuffer cmd) {
+    transitionImageLayout(cmd, mainDrawImage.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    transitionImageLayout(cmd, depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-    VK_CHECK(vkResetFences(device, 1, &immediateCmdFence));
-    VK_CHECK(vkResetCommandBuffer(immediateCmdBuffer, 0));
+    VkClearValue clearValue;
+    std::copy(clearColor.begin(), clearColor.end(), clearValue.color.float32);
 
-    VkCommandBuffer cmd = immediateCmdBuffer;
+    VkRenderingAttachmentInfo sceneAttachmentInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = mainDrawImage.imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .clearValue = clearValue,
+    };
 
-    VkCommandBufferBeginInfo beginInfo{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    // depth is kept for recordDepthPyramid
+    VkRenderingAttachmentInfo depthAttachmentInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageView = depthImage.imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = VkClearValue{.depthStencil = {.depth = 1.0f}},
     };
 
-    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+    VkRenderingInfo sceneRenderingInfo{
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea = VkRect2D{.extent = mainDrawExtent},
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &sceneAttachmentInfo,
+        .pDepthAttachment = &depthAttachmentInfo,
+    };
 
-    function(cmd);
+    vkCmdBeginRendering(cmd, &sceneRenderingInfo);
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
+    VkPipeline pipeline = meshPipeline;
+    if (gallery.objectCount > 0) {
+        pipeline = galleryPipeline;
+    } else if (lsystemMesh.vertexFormat == VertexFormat::Packed) {
+        pipeline = packedMeshPipeline;
+    } else if (lsystemMesh.vertexFormat == VertexFormat::Segments) {
+        pipeline = segmentPipeline;
+    } else if (lsystemMesh.vertexFormat == VertexFormat::Lines) {
+        pipeline = linePipeline;
+    } else if (lsystemMesh.vertexFormat == VertexFormat::Tubes) {
+        pipeline = tubePipeline;
+    }
 
-    VkSubmitInfo submitInfo{
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmd,
-    };
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    if (pipeline == linePipeline) {
+        vkCmdSetLineWidth(cmd, std::clamp(lineWidth, 1.0f, maxLineWidth));
+    }
 
-    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, immediateCmdFence));
+    VkViewport viewport{.x = 0,
+                        .y = 0,
+                        .width = (float)mainDrawExtent.width,
+                        .height = (float)mainDrawExtent.height,
+                        .minDepth = 0.0f,
+                        .maxDepth = 1.0f};
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
 
-    VK_CHECK(vkWaitForFences(device, 1, &immediateCmdFence, true, 9999999999));
-}
+    VkRect2D scissor{.extent = mainDrawExtent};
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-void Renderer::initImgui() {
-    std::vector<VkDescriptorPoolSize> poolSizes{VkDescriptorPoolSize{
-        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-        .descriptorCount = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE}};
+    if (gallery.objectCount > 0) {
+        GPUGalleryDrawPushConstants pushConstants{
+            .worldMatrix = sceneMatrix(glm::mat4(1.0f)),
+            .objects = gallery.objectAddress,
+            .growthTime = growthTime,
+        };
 
-    uint32_t totalDescriptors =
-        std::accumulate(poolSizes.begin(), poolSizes.end(), uint32_t{0},
+        vkCmdPushConstants(cmd, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                           0, sizeof(GPUGalleryDrawPushConstants),
+                           &pushConstants);
+        vkCmdBindIndexBuffer(cmd, gallery.indices.buffer, 0,
+                             VK_INDEX_TYPE_UINT32);
+        // one command per object in a single call, so recording the gallery
+        // costs the same however many objects it holds
+        vkCmdDrawIndexedIndirect(cmd, gallery.drawCommands.buffer, 0,
+                                 gallery.objectCount,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+        vkCmdEndRendering(cmd);
+        return;
+    }
+
+    const glm::mat4 worldMatrix = sceneMatrix(meshTransform);
+
+    if (lsystemMesh.indexCount > 0 &&
+        lsystemMesh.vertexFormat == VertexFormat::Tubes) {
+        const uint32_t groupCount =
+            (lsystemMesh.instanceCount + TUBE_TASK_SEGMENTS - 1) /
+            TUBE_TASK_SEGMENTS;
+        const uint32_t groupCountX = std::min(groupCount, MAX_DISPATCH_GROUPS);
+
+        GPUTubeDrawPushConstants pushConstants{
+            .worldMatrix = worldMatrix,
+            .segments = lsystemMesh.vertexBufferAddress,
+            .palette = lsystemMesh.paletteAddress,
+            .segmentCount = lsystemMesh.instanceCount,
+            .groupCountX = groupCountX,
+        };
+
+        vkCmdPushConstants(
+            cmd, tubePipelineLayout,
+            VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0,
+            sizeof(GPUTubeDrawPushConstants), &pushConstants);
+        vkCmdDrawMeshTasks(cmd, groupCountX,
+                           (groupCount + groupCountX - 1) / groupCountX, 1);
+    } else if (lsystemMesh.indexCount > 0) {
+        if (lsystemMesh.vertexFormat == VertexFormat::Packed) {
+            GPUPackedDrawPushConstants pushConstants{
+                .worldMatrix = worldMatrix,
+                .vertexBuffer = lsystemMesh.vertexBufferAddress,
+                .palette = lsystemMesh.paletteAddress,
+                .boundsMin = glm::vec4(lsystemMesh.boundsMin, 0.0f),
+                .boundsExtent = glm::vec4(
+                    lsystemMesh.boundsMax - lsystemMesh.boundsMin, 0.0f),
+                .clusterVertices = lsystemMesh.clusterVerticesAddress,
+            };
+
+            vkCmdPushConstants(cmd, meshPipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(GPUPackedDrawPushConstants),
+                               &pushConstants);
+        } else if (lsystemMesh.vertexFormat == VertexFormat::Segments) {
+            GPUSegmentDrawPushConstants pushConstants{
+                .worldMatrix = worldMatrix,
+                .vertexBuffer = unitCylinder.vertexBufferAddress,
+                .segments = lsystemMesh.vertexBufferAddress,
+                .palette = lsystemMesh.paletteAddress,
+            };
+
+            vkCmdPushConstants(cmd, meshPipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(GPUSegmentDrawPushConstants),
+                               &pushConstants);
+        } else if (lsystemMesh.vertexFormat == VertexFormat::Lines) {
+            GPULineDrawPushConstants pushConstants{
+                .worldMatrix = worldMatrix,
+                .vertexBuffer = lsystemMesh.vertexBufferAddress,
+                .palette = lsystemMesh.paletteAddress,
+            };
+
+            vkCmdPushConstants(cmd, meshPipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(GPULineDrawPushConstants),
+                               &pushConstants);
+        } else {
+            GPUDrawPushConstants pushConstants{
+                .worldMatrix = worldMatrix,
+                .vertexBuffer = lsystemMesh.vertexBufferAddress,
+                .births = lsystemMesh.birthAddress,
+                .clusterVertices = lsystemMesh.clusterVerticesAddress,
+                .growthTime = growthTime,
+            };
+
+            vkCmdPushConstants(cmd, meshPipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(GPUDrawPushConstants), &pushConstants);
+        }
+
+        const GPUMesh &indexedMesh =
+            lsystemMesh.vertexFormat == VertexFormat::Segments ? unitCylinder
+                                                               : lsystemMesh;
+        vkCmdBindIndexBuffer(cmd, indexedMesh.indices.buffer, 0,
+                             indexedMesh.indexType);
+
+        if (lsystemMesh.clusterCount > 0) {
+            vkCmdDrawIndexedIndirectCount(
+                cmd, lsystemMesh.drawCommands.buffer, 0,
+                lsystemMesh.drawCount.buffer, 0, lsystemMesh.readyClusterCount,
+                sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            vkCmdDrawIndexed(cmd, lsystemMesh.indexCount,
+                             lsystemMesh.instanceCount, 0, 0, 0);
+        }
+    }
+
+    vkCmdEndRendering(cmd);
+}
+
+void Renderer::recordDepthPyramid(VkCommandBuffer cmd) {
+    // only the culled mesh is tested against it
+    if (!occlusionCulling || lsystemMesh.readyClusterCount == 0 ||
+        gallery.objectCount > 0) {
+        depthPyramidClusters = 0;
+        return;
+    }
+
+    const std::vector<VkExtent2D> levels = depthPyramidLevels(mainDrawExtent);
+    const GPUDepthPyramid header{
+        .worldMatrix = sceneMatrix(meshTransform),
+        .width = mainDrawExtent.width,
+        .height = mainDrawExtent.height,
+        .levelCount = static_cast<uint32_t>(levels.size()),
+        .padding = 0,
+    };
+    vkCmdUpdateBuffer(cmd, depthPyramid.buffer, 0, sizeof(header), &header);
+
+    transitionImageLayout(cmd, depthImage.image,
+                          VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    // the first level is the depth buffer as it is
+    VkBufferImageCopy depthCopy{
+        .bufferOffset = sizeof(GPUDepthPyramid),
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource{
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        .imageOffset = {},
+        .imageExtent{
+            .width = mainDrawExtent.width,
+            .height = mainDrawExtent.height,
+            .depth = 1,
+        },
+    };
+    vkCmdCopyImageToBuffer(cmd, depthImage.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           depthPyramid.buffer, 1, &depthCopy);
+    computeBarrier(cmd);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      depthReducePipeline);
+    VkDeviceAddress source =
+        getBufferAddress(depthPyramid) + sizeof(GPUDepthPyramid);
+    for (size_t level = 1; level < levels.size(); level++) {
+        const VkExtent2D sourceExtent = levels[level - 1];
+        const VkExtent2D extent = levels[level];
+        const VkDeviceAddress destination =
+            source + uint64_t{sourceExtent.width} * sourceExtent.height *
+                         sizeof(float);
+
+        GPUDepthReducePushConstants reduceConstants{
+            .source = source,
+            .destination = destination,
+            .sourceWidth = sourceExtent.width,
+            .sourceHeight = sourceExtent.height,
+            .width = extent.width,
+            .height = extent.height,
+        };
+        vkCmdPushConstants(cmd, computePipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(GPUDepthReducePushConstants),
+                           &reduceConstants);
+        vkCmdDispatch(cmd,
+                      (extent.width + DEPTH_REDUCE_GROUP_SIZE - 1) /
+                          DEPTH_REDUCE_GROUP_SIZE,
+                      (extent.height + DEPTH_REDUCE_GROUP_SIZE - 1) /
+                          DEPTH_REDUCE_GROUP_SIZE,
+                      1);
+        computeBarrier(cmd);
+        source = destination;
+    }
+
+    depthPyramidClusters = lsystemMesh.clusterAddress;
+}
+
+FrameTimings Renderer::drawOffscreen(uint32_t frameCount) {
+    FrameTimings timings{};
+    if (frameCount == 0) {
+        return timings;
+    }
+
+    uint32_t gpuSamples = 0;
+    auto readGpuTime = [&](FrameData &frame) {
+        if (readTimestamps(frame)) {
+            timings.gpuMs += gpuSceneTimes.latest();
+            gpuSamples++;
+        }
+    };
+
+    Stopwatch stopwatch;
+
+    for (uint32_t i = 0; i < frameCount; i++) {
+        TraceZone zone("offscreen frame");
+        FrameData &currentFrame = getCurrentFrame();
+
+        VK_CHECK(vkWaitForFences(device, 1, &currentFrame.renderFinishedFence,
+                                 true, 1000000000));
+
+        currentFrame.deletionQueue.flush();
+        readGpuTime(currentFrame);
+        collectTransfers();
+        stageUploads();
+        swapPendingMesh();
+
+        VK_CHECK(vkResetFences(device, 1, &currentFrame.renderFinishedFence));
+
+        VkCommandBuffer cmd = currentFrame.commandBuffer;
+        VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+        VkCommandBufferBeginInfo cmdBeginInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT};
+
+        VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+
+        // same layout as draw, the imgui pass is just empty
+        vkCmdResetQueryPool(cmd, currentFrame.timestampPool, 0,
+                            TIMESTAMP_COUNT);
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_NONE,
+                             currentFrame.timestampPool, 0);
+
+        recordCulling(cmd);
+        recordScene(cmd);
+        recordDepthPyramid(cmd);
+
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                             currentFrame.timestampPool, 1);
+        vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                             currentFrame.timestampPool, 2);
+
+        VK_CHECK(vkEndCommandBuffer(cmd));
+
+        VkPipelineStageFlags waitStage = uploadWaitStages();
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = 1,
+            .pWaitSemaphoreValues = &drawUploadValue,
+        };
+
+        VkSubmitInfo submitInfo{
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &uploadSemaphore,
+            .pWaitDstStageMask = &waitStage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &cmd,
+        };
+
+        VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+                               currentFrame.renderFinishedFence));
+        currentFrame.timestampsWritten = true;
+
+        frameNumber++;
+        if (rotate) {
+            rotation += ROTATION_SPEED;
+        }
+        advanceGrowth();
+    }
+
+    waitForFrames();
+    timings.cpuMs = stopwatch.lap() / frameCount;
+
+    for (FrameData &frame : frames) {
+        readGpuTime(frame);
+    }
+    if (gpuSamples > 0) {
+        timings.gpuMs /= gpuSamples;
+    }
+
+    return timings;
+}
+
+void Renderer::setLSystem(LSystem system, TurtleParameters parameters) {
+    cancelGeneration();
+    lsystem = std::move(system);
+    turtleParameters = parameters;
+
+    std::lock_guard lock(derivationMutex);
+    derivationCache.clear();
+}
+
+GenerationTimings Renderer::generate(uint32_t generationCount,
+                                     VertexFormat format) {
+    generations = static_cast<int>(generationCount);
+    meshFormat = format;
+    // rewriting and interpretation are only timed separately when the whole
+    // derivation is built on the cpu first
+    streamDerivation = false;
+    memoizeSubtrees = false;
+    generateOnGPU = false;
+    animateGrowth = false;
+    // results read back from disk would say nothing about generation
+    cacheGeometry = false;
+
+    // generated on this thread so the timings aren't shared with the ui
+    cancelGeneration();
+    {
+        std::lock_guard lock(derivationMutex);
+        derivationCache.clear();
+    }
+
+    GenerationProgress progress;
+    applyGeometry(buildGeometry(makeGenerationRequest(false), {}, progress));
+
+    // applying only submits the upload, the copy itself is part of its cost
+    Stopwatch stopwatch;
+    flushMeshStream();
+    if (pendingMesh) {
+        waitForUpload(*pendingMesh);
+        swapPendingMesh();
+    }
+    generationTimings.uploadMs += stopwatch.lap();
+
+    return generationTimings;
+}
+
+void Renderer::generateGallery(uint32_t generationCount, uint32_t variantCount,
+                               float angleSpread) {
+    generations = static_cast<int>(generationCount);
+    galleryVariants = static_cast<int>(variantCount);
+    galleryAngleSpread = angleSpread;
+    animateGrowth = false;
+
+    // built on this thread like generate, no variants leave it empty
+    cancelGallery();
+    std::shared_ptr<GeneratedGallery> result =
+        buildGallery(makeGalleryRequest(), {});
+    uploadGallery(result->meshes, result);
+    streamGallery(SIZE_MAX);
+    waitForTimeline(drawUploadValue);
+}
+
+uint64_t Renderer::getMeshSize() const {
+    // segments are drawn with the index buffer of the unit cylinder and
+    // tubes have no indices at all
+    const bool hasIndices =
+        lsystemMesh.vertexFormat != VertexFormat::Segments &&
+        lsystemMesh.vertexFormat != VertexFormat::Tubes;
+    const uint64_t indexStride =
+        lsystemMesh.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t)
+                                                      : sizeof(uint32_t);
+    const uint64_t indexSize =
+        hasIndices ? uint64_t{lsystemMesh.indexCount} * indexStride : 0;
+    return lsystemMesh.vertexDataSize + indexSize;
+}
+
+VkPipelineStageFlags Renderer::uploadWaitStages() const {
+    // the cull pass reads the clusters and vertex offsets from a compute
+    // shader and tubes are fetched by the task and mesh shaders, every other
+    // format is read by the vertex shaders
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                                  VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (meshShaderSupported) {
+        stages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT |
+                  VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
+    }
+    return stages;
+}
+
+bool Renderer::supportsFormat(VertexFormat format) const {
+    return format != VertexFormat::Tubes || meshShaderSupported;
+}
+
+void Renderer::initImmediateCommands() {
+    VkFenceCreateInfo fenceInfo{
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &immediateCmdFence));
+
+    VkCommandPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = graphicsQueueFamily,
+    };
+
+    VK_CHECK(
+        vkCreateCommandPool(device, &poolInfo, nullptr, &immediateCmdPool));
+
+    VkCommandBufferAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = immediateCmdPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &immediateCmdBuffer));
+}
+
+void Renderer::immediateSubmit(
+    std::function<void(VkCommandBuffer cmd)> &&function) {
+    TraceZone zone("immediate submit");
+
+    VK_CHECK(vkResetFences(device, 1, &immediateCmdFence));
+    VK_CHECK(vkResetCommandBuffer(immediateCmdBuffer, 0));
+
+    VkCommandBuffer cmd = immediateCmdBuffer;
+
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    function(cmd);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+    };
+
+    VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, immediateCmdFence));
+
+    VK_CHECK(vkWaitForFences(device, 1, &immediateCmdFence, true, 9999999999));
+}
+
+void Renderer::initTransferCommands() {
+    VkCommandPoolCreateInfo poolInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = transferQueueFamily,
+    };
+
+    VK_CHECK(
+        vkCreateCommandPool(device, &poolInfo, nullptr, &transferCmdPool));
+
+    VkSemaphoreTypeCreateInfo typeInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo semaphoreInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VK_CHECK(
+        vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploadSemaphore));
+
+    stagingRing = createBuffer(STAGING_CHUNK_SIZE * STAGING_CHUNK_COUNT,
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                               VMA_MEMORY_USAGE_CPU_ONLY);
+    stagingChunkValues.assign(STAGING_CHUNK_COUNT, 0);
+}
+
+void Renderer::destroyTransferCommands() {
+    collectTransfers();
+
+    destroyBuffer(stagingRing);
+    vkDestroySemaphore(device, uploadSemaphore, nullptr);
+    vkDestroyCommandPool(device, transferCmdPool, nullptr);
+}
+
+uint64_t Renderer::submitTransfer(
+    std::function<void(VkCommandBuffer cmd)> &&function) {
+    VkCommandBufferAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = transferCmdPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+
+    VkCommandBuffer cmd;
+    VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &cmd));
+
+    VkCommandBufferBeginInfo beginInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    function(cmd);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    const uint64_t timelineValue = ++uploadTimelineValue;
+
+    VkCommandBufferSubmitInfo cmdInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = cmd,
+    };
+
+    VkSemaphoreSubmitInfo signalInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = uploadSemaphore,
+        .value = timelineValue,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+    };
+
+    VkSubmitInfo2 submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmdInfo,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signalInfo,
+    };
+
+    VK_CHECK(vkQueueSubmit2(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+    pendingTransfers.push_back(PendingTransfer{
+        .timelineValue = timelineValue,
+        .commandBuffer = cmd,
+    });
+
+    return timelineValue;
+}
+
+uint64_t Renderer::stageCopies(std::span<const StagingCopy> copies) {
+    struct Region {
+        VkBuffer buffer;
+        VkBufferCopy copy;
+    };
+
+    std::vector<Region> regions;
+    std::byte *ring =
+        static_cast<std::byte *>(stagingRing.allocation->GetMappedData());
+    uint64_t timelineValue = 0;
+
+    // the chunk's value is that of the newest transfer reading from it, so
+    // transfers only ever read what is behind the write cursor
+    auto flushChunk = [&]() {
+        timelineValue = submitTransfer([&](VkCommandBuffer cmd) {
+            for (const Region &region : regions) {
+                vkCmdCopyBuffer(cmd, stagingRing.buffer, region.buffer, 1,
+                                &region.copy);
+            }
+        });
+
+        stagingChunkValues[stagingChunk] = timelineValue;
+        regions.clear();
+    };
+
+    auto nextChunk = [&]() {
+        stagingChunk = (stagingChunk + 1) % STAGING_CHUNK_COUNT;
+
+        VkSemaphoreWaitInfo waitInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &uploadSemaphore,
+            .pValues = &stagingChunkValues[stagingChunk],
+        };
+
+        // only blocks once the whole ring is in flight, which bounds staging
+        // memory for uploads of any size
+        VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+        stagingChunkOffset = 0;
+    };
+
+    // small copies keep filling the current chunk, which starts over once
+    // everything staged in it has arrived
+    if (stagingChunkOffset > 0 &&
+        isUploadComplete(stagingChunkValues[stagingChunk])) {
+        stagingChunkOffset = 0;
+    }
+
+    for (const StagingCopy &copy : copies) {
+        size_t copied = 0;
+        while (copied < copy.data.size()) {
+            if (stagingChunkOffset == STAGING_CHUNK_SIZE) {
+                if (!regions.empty()) {
+                    flushChunk();
+                }
+                nextChunk();
+            }
+
+            const size_t size =
+                std::min(copy.data.size() - copied,
+                         STAGING_CHUNK_SIZE - stagingChunkOffset);
+            const size_t ringOffset =
+                stagingChunk * STAGING_CHUNK_SIZE + stagingChunkOffset;
+            memcpy(ring + ringOffset, copy.data.data() + copied, size);
+
+            regions.push_back(Region{
+                .buffer = copy.buffer,
+                .copy =
+                    VkBufferCopy{
+                        .srcOffset = ringOffset,
+                        .dstOffset = copy.offset + copied,
+                        .size = size,
+                    },
+            });
+
+            stagingChunkOffset += size;
+            copied += size;
+        }
+    }
+
+    if (!regions.empty()) {
+        flushChunk();
+    }
+
+    return timelineValue;
+}
+
+size_t Renderer::stagingSpace() {
+    uint64_t completedValue;
+    VK_CHECK(
+        vkGetSemaphoreCounterValue(device, uploadSemaphore, &completedValue));
+
+    // the rest of the current chunk, or all of it once it has been read, and
+    // every chunk after it that has been read too
+    size_t space = stagingChunkValues[stagingChunk] <= completedValue
+                       ? STAGING_CHUNK_SIZE
+                       : STAGING_CHUNK_SIZE - stagingChunkOffset;
+    for (size_t i = 1; i < STAGING_CHUNK_COUNT; i++) {
+        if (stagingChunkValues[(stagingChunk + i) % STAGING_CHUNK_COUNT] >
+            completedValue) {
+            break;
+        }
+        space += STAGING_CHUNK_SIZE;
+    }
+
+    return space;
+}
+
+size_t Renderer::stageQueuedCopies(QueuedCopies &queued, size_t budget) {
+    // copies larger than what is left of the budget are split, the rest of
+    // them is staged by a later call
+    std::vector<StagingCopy> copies;
+    size_t size = 0;
+    while (queued.nextCopy < queued.copies.size() && size < budget) {
+        const StagingCopy &copy = queued.copies[queued.nextCopy];
+        const size_t partSize =
+            std::min(copy.data.size() - queued.copyOffset, budget - size);
+        if (partSize > 0) {
+            copies.push_back(StagingCopy{
+                .buffer = copy.buffer,
+                .offset = copy.offset + queued.copyOffset,
+                .data = copy.data.subspan(queued.copyOffset, partSize),
+            });
+        }
+
+        size += partSize;
+        queued.copyOffset += partSize;
+        if (queued.copyOffset == copy.data.size()) {
+            queued.nextCopy++;
+            queued.copyOffset = 0;
+        }
+    }
+
+    if (!copies.empty()) {
+        queued.timelineValue = stageCopies(copies);
+    }
+
+    return size;
+}
+
+void Renderer::stageUploads() {
+    // staging never waits for the ring here, so a frame doesn't block on the
+    // transfers of the ones before it. what doesn't fit is left to the next
+    const size_t budget = std::min(STREAM_BYTES_PER_FRAME, stagingSpace());
+    streamGallery(budget - streamMesh(budget));
+}
+
+bool Renderer::isUploadComplete(uint64_t timelineValue) {
+    uint64_t completedValue;
+    VK_CHECK(
+        vkGetSemaphoreCounterValue(device, uploadSemaphore, &completedValue));
+    return completedValue >= timelineValue;
+}
+
+void Renderer::waitForTimeline(uint64_t timelineValue) {
+    VkSemaphoreWaitInfo waitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &uploadSemaphore,
+        .pValues = &timelineValue,
+    };
+
+    VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+
+    collectTransfers();
+}
+
+GPUMesh Renderer::waitForUpload(const MeshUpload &upload) {
+    waitForTimeline(upload.timelineValue);
+    return upload.mesh;
+}
+
+void Renderer::collectTransfers() {
+    if (pendingTransfers.empty()) {
+        return;
+    }
+
+    uint64_t completedValue;
+    VK_CHECK(
+        vkGetSemaphoreCounterValue(device, uploadSemaphore, &completedValue));
+
+    // transfers are submitted in timeline order, so completed ones are always
+    // at the front
+    auto firstPending = std::find_if(
+        pendingTransfers.begin(), pendingTransfers.end(),
+        [&](const PendingTransfer &transfer) {
+            return transfer.timelineValue > completedValue;
+        });
+
+    for (auto it = pendingTransfers.begin(); it != firstPending; it++) {
+        vkFreeCommandBuffers(device, transferCmdPool, 1, &it->commandBuffer);
+    }
+
+    pendingTransfers.erase(pendingTransfers.begin(), firstPending);
+}
+
+void Renderer::initImgui() {
+    std::vector<VkDescriptorPoolSize> poolSizes{VkDescriptorPoolSize{
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE}};
+
+    uint32_t totalDescriptors =
+        std::accumulate(poolSizes.begin(), poolSizes.end(), uint32_t{0},
                         [](uint32_t sum, const VkDescriptorPoolSize &p) {
                             return sum + p.descriptorCount;
                         });
@@ -521,7 +1865,7 @@ void Renderer::initImgui() {
         .DescriptorPoolSize = 0,
         .MinImageCount = 2,
         .ImageCount = static_cast<uint32_t>(swapchainImages.size()),
-        .PipelineCache = VK_NULL_HANDLE,
+        .PipelineCache = pipelineCache,
         .PipelineInfoMain{.PipelineRenderingCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
             .colorAttachmentCount = 1,
@@ -532,12 +1876,11 @@ void Renderer::initImgui() {
     ImGui_ImplVulkan_Init(&initInfo);
 }
 
-void Renderer::createDrawImage() {
-
+void Renderer::createDrawImage(VkExtent2D extent) {
     mainDrawImage.imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
     mainDrawImage.imageExtent = VkExtent3D{
-        .width = mainDrawExtent.width,
-        .height = mainDrawExtent.height,
+        .width = extent.width,
+        .height = extent.height,
         .depth = 1,
     };
 
@@ -584,9 +1927,11 @@ void Renderer::createDrawImage() {
         .magFilter = VK_FILTER_LINEAR,
         .minFilter = VK_FILTER_LINEAR,
         .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        // only the top left of the image holds the scene, repeating would
+        // wrap the far edges into it
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
         .anisotropyEnable = VK_FALSE,
         .maxAnisotropy = 1.0f,
         .compareEnable = VK_FALSE,
@@ -598,24 +1943,142 @@ void Renderer::createDrawImage() {
     VK_CHECK(
         vkCreateSampler(device, &samplerInfo, nullptr, &mainDrawImage.sampler));
 
-    immediateSubmit([&](VkCommandBuffer cmd) {
-        transitionImageLayout(cmd, mainDrawImage.image,
-                              VK_IMAGE_LAYOUT_UNDEFINED,
-                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    });
+    // no initial layout transition, every frame draws the scene from an
+    // undefined layout before imgui samples it
 
-    imguiDescriptorSet = ImGui_ImplVulkan_AddTexture(
-        mainDrawImage.sampler, mainDrawImage.imageView,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
+    depthImage.imageExtent = mainDrawImage.imageExtent;
+
+    VkImageCreateInfo depthImageInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = depthImage.imageFormat,
+        .extent = depthImage.imageExtent,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+    };
+
+    vmaCreateImage(allocator, &depthImageInfo, &allocInfo, &depthImage.image,
+                   &depthImage.allocation, nullptr);
+
+    VkImageViewCreateInfo depthViewInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = depthImage.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = depthImage.imageFormat,
+        .subresourceRange{
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    VK_CHECK(vkCreateImageView(device, &depthViewInfo, nullptr,
+                               &depthImage.imageView));
+    depthImage.sampler = VK_NULL_HANDLE;
+
+    size_t pyramidSize = sizeof(GPUDepthPyramid);
+    for (VkExtent2D level : depthPyramidLevels(extent)) {
+        pyramidSize += size_t{level.width} * level.height * sizeof(float);
+    }
+    depthPyramid = createBuffer(pyramidSize,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                VMA_MEMORY_USAGE_GPU_ONLY);
+    depthPyramidClusters = 0;
+
+    if (!headless) {
+        imguiDescriptorSet = ImGui_ImplVulkan_AddTexture(
+            mainDrawImage.sampler, mainDrawImage.imageView,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
 }
 
 void Renderer::destroyDrawImage() {
-    vkDestroySampler(device, mainDrawImage.sampler, nullptr);
-    vkDestroyImageView(device, mainDrawImage.imageView, nullptr);
-    vmaDestroyImage(allocator, mainDrawImage.image, mainDrawImage.allocation);
+    destroyImage(mainDrawImage);
+    destroyImage(depthImage);
+    destroyBuffer(depthPyramid);
+}
+
+void Renderer::destroyImage(const AllocatedImage &image) {
+    vkDestroySampler(device, image.sampler, nullptr);
+    vkDestroyImageView(device, image.imageView, nullptr);
+    vmaDestroyImage(allocator, image.image, image.allocation);
+}
+
+void Renderer::fitDrawImage(VkExtent2D viewportExtent) {
+    auto roundUp = [](uint32_t size) {
+        return (std::max(size, 1u) + DRAW_IMAGE_GRANULARITY - 1) /
+               DRAW_IMAGE_GRANULARITY * DRAW_IMAGE_GRANULARITY;
+    };
+
+    // the image only grows in steps and only shrinks once it's well past
+    // the size it needs, so dragging the viewport doesn't reallocate it on
+    // every frame
+    const VkExtent2D needed{.width = roundUp(viewportExtent.width),
+                            .height = roundUp(viewportExtent.height)};
+    const VkExtent3D current = mainDrawImage.imageExtent;
+    const bool tooSmall =
+        needed.width > current.width || needed.height > current.height;
+    const bool tooLarge = uint64_t{current.width} * current.height >
+                          DRAW_IMAGE_SHRINK_FACTOR * uint64_t{needed.width} *
+                              needed.height;
+
+    if (tooSmall || tooLarge) {
+        retire([this, drawImage = mainDrawImage, depth = depthImage,
+                pyramid = depthPyramid, descriptorSet = imguiDescriptorSet] {
+            ImGui_ImplVulkan_RemoveTexture(descriptorSet);
+            destroyImage(drawImage);
+            destroyImage(depth);
+            destroyBuffer(pyramid);
+        });
+        createDrawImage(needed);
+    }
+
+    // the scene is drawn into the top left corner and stretched over the
+    // viewport by the sampler
+    auto scaled = [&](uint32_t size) {
+        return std::clamp(static_cast<uint32_t>(size * renderScale), 1u,
+                          std::max(size, 1u));
+    };
+    mainDrawExtent = VkExtent2D{.width = scaled(viewportExtent.width),
+                                .height = scaled(viewportExtent.height)};
+}
+
+void Renderer::updateRenderScale() {
+    if (!dynamicResolution) {
+        renderScale = 1.0f;
+        return;
+    }
+
+    const float sceneMs = gpuSceneTimes.latest();
+    if (sceneMs <= 0.0f) {
+        return;
+    }
+
+    // the scene cost grows with the pixel count, the square of the scale.
+    // the measurement is a few frames old, so the scale only moves part of
+    // the way and not at all when it's close enough
+    const float ratio = targetSceneMs / sceneMs;
+    if (std::abs(ratio - 1.0f) < RENDER_SCALE_TOLERANCE) {
+        return;
+    }
+
+    const float ideal = renderScale * std::sqrt(ratio);
+    renderScale =
+        std::clamp(renderScale + (ideal - renderScale) * RENDER_SCALE_DAMPING,
+                   MIN_RENDER_SCALE, 1.0f);
 }
 
-void Renderer::createSwapchain(uint32_t width, uint32_t height) {
+void Renderer::createSwapchain(uint32_t width, uint32_t height,
+                               VkSwapchainKHR oldSwapchain) {
     swapchainFormat = VK_FORMAT_B8G8R8A8_UNORM;
 
     vkb::SwapchainBuilder builder(physicalDevice, device, surface);
@@ -625,9 +2088,11 @@ void Renderer::createSwapchain(uint32_t width, uint32_t height) {
             .set_desired_format(VkSurfaceFormatKHR{
                 .format = swapchainFormat,
                 .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR})
-            .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+            .set_desired_present_mode(presentMode)
+            .add_fallback_present_mode(VK_PRESENT_MODE_FIFO_KHR)
             .set_desired_extent(width, height)
             .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+            .set_old_swapchain(oldSwapchain)
             .build()
             .value();
 
@@ -644,23 +2109,32 @@ void Renderer::createSwapchain(uint32_t width, uint32_t height) {
 
         VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
                                    &renderFinishedSemaphores[i]));
-
-        renderFinishedSemaphores.push_back(renderFinishedSemaphores[i]);
     }
 }
 
 void Renderer::rebuildSwapchain() {
-    vkDeviceWaitIdle(device);
-
-    destroyFrameDatas();
-
-    destroySwapchain();
+    TraceZone zone("rebuild swapchain");
+    // frames in flight may still present from the old swapchain, so it's
+    // handed to the new one and retired instead of draining the device
+    VkSwapchainKHR oldSwapchain = swapchain;
+    std::vector<VkImageView> oldImageViews = std::move(swapchainImageViews);
+    std::vector<VkSemaphore> oldSemaphores =
+        std::move(renderFinishedSemaphores);
+    renderFinishedSemaphores.clear();
 
     int w, h;
     SDL_GetWindowSize(window, &w, &h);
-    createSwapchain(w, h);
+    createSwapchain(w, h, oldSwapchain);
 
-    initFrameDatas();
+    retire([this, oldSwapchain, oldImageViews, oldSemaphores] {
+        for (VkImageView imageView : oldImageViews) {
+            vkDestroyImageView(device, imageView, nullptr);
+        }
+        for (VkSemaphore semaphore : oldSemaphores) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+    });
 
     swapchainStale = false;
 }
@@ -674,6 +2148,12 @@ void Renderer::destroySwapchain() {
     vkDestroySwapchainKHR(device, swapchain, nullptr);
 }
 
+void Renderer::retire(std::function<void()> &&deletor) {
+    // before the first submission no slot is in use, any of them will do
+    frames[(frameNumber + FRAMES_IN_FLIGHT - 1) % FRAMES_IN_FLIGHT]
+        .deletionQueue.push(std::move(deletor));
+}
+
 void Renderer::initFrameDatas() {
     VkCommandPoolCreateInfo poolInfo{
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -696,7 +2176,7 @@ void Renderer::initFrameDatas() {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
             .commandPool = frames[i].commandPool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 2};
+            .commandBufferCount = 1};
 
         VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo,
                                           &frames[i].commandBuffer));
@@ -706,7 +2186,42 @@ void Renderer::initFrameDatas() {
 
         VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr,
                                &frames[i].renderFinishedFence));
+
+        VkQueryPoolCreateInfo queryPoolInfo{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = TIMESTAMP_COUNT,
+        };
+
+        VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, nullptr,
+                                   &frames[i].timestampPool));
+        frames[i].timestampsWritten = false;
+    }
+}
+
+bool Renderer::readTimestamps(FrameData &frame) {
+    if (!frame.timestampsWritten) {
+        return false;
+    }
+
+    uint64_t timestamps[TIMESTAMP_COUNT];
+    VkResult result = vkGetQueryPoolResults(
+        device, frame.timestampPool, 0, TIMESTAMP_COUNT, sizeof(timestamps),
+        timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    frame.timestampsWritten = false;
+    if (result != VK_SUCCESS) {
+        return false;
     }
+
+    auto milliseconds = [&](uint32_t from, uint32_t to) {
+        return static_cast<float>((timestamps[to] - timestamps[from]) *
+                                  static_cast<double>(timestampPeriod) * 1e-6);
+    };
+
+    gpuSceneTimes.push(milliseconds(0, 1));
+    gpuImguiTimes.push(milliseconds(1, 2));
+    gpuFrameTimes.push(milliseconds(0, 2));
+    return true;
 }
 
 void Renderer::destroyFrameDatas() {
@@ -714,6 +2229,7 @@ void Renderer::destroyFrameDatas() {
         vkDestroyCommandPool(device, frame.commandPool, nullptr);
         vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
         vkDestroyFence(device, frame.renderFinishedFence, nullptr);
+        vkDestroyQueryPool(device, frame.timestampPool, nullptr);
     }
 }
 
@@ -743,7 +2259,11 @@ void Renderer::transitionImageLayout(VkCommandBuffer cmd, VkImage image,
         .oldLayout = oldLayout,
         .newLayout = newLayout,
         .image = image,
-        .subresourceRange = createSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT),
+        .subresourceRange = createSubresourceRange(
+            oldLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL ||
+                    newLayout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL
+                ? VK_IMAGE_ASPECT_DEPTH_BIT
+                : VK_IMAGE_ASPECT_COLOR_BIT),
     };
 
     VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
@@ -794,39 +2314,120 @@ void Renderer::blitImageToImage(VkCommandBuffer cmd, VkImage src, VkImage dst,
     vkCmdBlitImage2(cmd, &blitInfo);
 }
 
-std::vector<char> Renderer::loadShader(const std::string &filePath) {
-    std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) {
-        throw std::runtime_error(
-            fmt::format("failed to open shader file: {}", filePath));
+void Renderer::initPipelineCache(const char *directory) {
+    VkPhysicalDeviceIDProperties idProperties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 properties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &idProperties,
+    };
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    std::string uuid;
+    for (uint8_t byte : idProperties.deviceUUID) {
+        uuid += fmt::format("{:02x}", byte);
+    }
+    pipelineCachePath =
+        (cacheDirectory(directory) /
+         fmt::format("pipelines_{}_{:08x}.bin", uuid,
+                     properties.properties.driverVersion))
+            .string();
+
+    std::vector<char> data;
+    std::ifstream file(pipelineCachePath, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        data.resize(file.tellg());
+        file.seekg(0);
+        file.read(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    // drivers are supposed to reject foreign data themselves, but not all
+    // of them do so gracefully
+    VkPipelineCacheHeaderVersionOne header{};
+    if (data.size() >= sizeof(header)) {
+        memcpy(&header, data.data(), sizeof(header));
+    }
+    const bool matches =
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == properties.properties.vendorID &&
+        header.deviceID == properties.properties.deviceID &&
+        memcmp(header.pipelineCacheUUID,
+               properties.properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if (!matches) {
+        data.clear();
     }
 
-    std::vector<char> buffer(file.tellg());
+    SPDLOG_DEBUG("pipeline cache {}: {} bytes", pipelineCachePath,
+                 data.size());
 
-    file.seekg(0);
-    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
-    file.close();
+    VkPipelineCacheCreateInfo cacheInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData = data.empty() ? nullptr : data.data(),
+    };
 
-    return buffer;
+    VK_CHECK(
+        vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache));
 }
 
-void Renderer::buildPipelines() {
-    std::vector<char> meshShader = loadShader("./build/shaders/mesh.spv");
+void Renderer::savePipelineCache() {
+    size_t size = 0;
+    std::vector<char> data;
+    if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) ==
+        VK_SUCCESS) {
+        data.resize(size);
+        if (vkGetPipelineCacheData(device, pipelineCache, &size,
+                                   data.data()) != VK_SUCCESS) {
+            data.clear();
+        }
+    }
+
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+    if (data.empty()) {
+        return;
+    }
+
+    // written next to the cache and moved over it, so an interrupted write
+    // never leaves a truncated cache behind
+    const std::string temporaryPath = pipelineCachePath + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), static_cast<std::streamsize>(size));
+    file.close();
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, pipelineCachePath, error);
+    if (!file || error) {
+        SPDLOG_WARN("failed to write pipeline cache {}", pipelineCachePath);
+    }
+}
 
-    VkShaderModuleCreateInfo meshModuleInfo{
+VkShaderModule
+Renderer::createShaderModule(std::span<const unsigned char> code) {
+    VkShaderModuleCreateInfo moduleInfo{
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = meshShader.size() * sizeof(char),
-        .pCode = reinterpret_cast<const uint32_t *>(meshShader.data()),
+        .codeSize = code.size(),
+        .pCode = reinterpret_cast<const uint32_t *>(code.data()),
     };
 
-    VkShaderModule meshModule;
-    VK_CHECK(
-        vkCreateShaderModule(device, &meshModuleInfo, nullptr, &meshModule));
+    VkShaderModule module;
+    VK_CHECK(vkCreateShaderModule(device, &moduleInfo, nullptr, &module));
+
+    return module;
+}
+
+void Renderer::buildPipelines() {
+    VkShaderModule meshModule = createShaderModule(shaders::mesh);
 
     VkPushConstantRange pushConstantRange{
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
         .offset = 0,
-        .size = sizeof(GPUDrawPushConstants),
+        .size = static_cast<uint32_t>(std::max(
+            {sizeof(GPUDrawPushConstants), sizeof(GPUPackedDrawPushConstants),
+             sizeof(GPUSegmentDrawPushConstants),
+             sizeof(GPULineDrawPushConstants),
+             sizeof(GPUGalleryDrawPushConstants)})),
     };
 
     VkPipelineLayoutCreateInfo meshLayoutInfo{
@@ -847,31 +2448,196 @@ void Renderer::buildPipelines() {
             .setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE)
             .setMultisampleDisabled()
             .setBlendingDisabled()
-            .setDepthTestDisabled()
+            .setDepthTest(true, VK_COMPARE_OP_LESS)
             .setColorAttachmentFormat(mainDrawImage.imageFormat)
-            .setDepthFormat(VK_FORMAT_UNDEFINED);
+            .setDepthFormat(depthImage.imageFormat);
 
-    meshPipeline = meshPipelineBuilder.build(device);
+    meshPipeline = meshPipelineBuilder.build(device, pipelineCache);
 
     if (meshPipeline == VK_NULL_HANDLE) {
         throw std::runtime_error("failed to build mesh pipeline");
     }
 
+    packedMeshPipeline =
+        meshPipelineBuilder
+            .setShaders(meshModule, meshModule, "vertPackedMain", "fragMain")
+            .build(device, pipelineCache);
+
+    if (packedMeshPipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to build packed mesh pipeline");
+    }
+
+    segmentPipeline =
+        meshPipelineBuilder
+            .setShaders(meshModule, meshModule, "vertSegmentMain", "fragMain")
+            .build(device, pipelineCache);
+
+    if (segmentPipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to build segment pipeline");
+    }
+
+    galleryPipeline =
+        meshPipelineBuilder
+            .setShaders(meshModule, meshModule, "vertGalleryMain", "fragMain")
+            .build(device, pipelineCache);
+
+    if (galleryPipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to build gallery pipeline");
+    }
+
+    linePipeline =
+        meshPipelineBuilder
+            .setShaders(meshModule, meshModule, "vertLineMain", "fragMain")
+            .setInputTopology(VK_PRIMITIVE_TOPOLOGY_LINE_STRIP, true)
+            .setDynamicLineWidth()
+            .build(device, pipelineCache);
+
+    if (linePipeline == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to build line pipeline");
+    }
+
+    if (meshShaderSupported) {
+        VkPushConstantRange tubeConstantRange{
+            .stageFlags =
+                VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT,
+            .offset = 0,
+            .size = sizeof(GPUTubeDrawPushConstants),
+        };
+
+        VkPipelineLayoutCreateInfo tubeLayoutInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &tubeConstantRange,
+        };
+
+        VK_CHECK(vkCreatePipelineLayout(device, &tubeLayoutInfo, nullptr,
+                                        &tubePipelineLayout));
+
+        VkShaderModule tubesModule = createShaderModule(shaders::tubes);
+
+        tubePipeline =
+            PipelineBuilder()
+                .setLayout(tubePipelineLayout)
+                .setMeshShaders(tubesModule, "taskTubes", "meshTubes",
+                                meshModule, "fragMain")
+                .setPolygonMode(VK_POLYGON_MODE_FILL)
+                .setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE)
+                .setMultisampleDisabled()
+                .setBlendingDisabled()
+                .setDepthTest(true, VK_COMPARE_OP_LESS)
+                .setColorAttachmentFormat(mainDrawImage.imageFormat)
+                .setDepthFormat(depthImage.imageFormat)
+                .build(device, pipelineCache);
+
+        vkDestroyShaderModule(device, tubesModule, nullptr);
+
+        if (tubePipeline == VK_NULL_HANDLE) {
+            throw std::runtime_error("failed to build tube pipeline");
+        }
+    }
+
     vkDestroyShaderModule(device, meshModule, nullptr);
+
+    buildComputePipelines();
+}
+
+void Renderer::buildComputePipelines() {
+    VkShaderModule lsystemModule = createShaderModule(shaders::lsystem);
+
+    // every pass pushes its own constants struct, the range covers the
+    // largest of them
+    VkPushConstantRange pushConstantRange{
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = static_cast<uint32_t>(std::max(
+            {sizeof(GPURewritePushConstants), sizeof(GPUScanPushConstants),
+             sizeof(GPUTurtlePushConstants), sizeof(GPUCullPushConstants),
+             sizeof(GPUDepthReducePushConstants)})),
+    };
+
+    VkPipelineLayoutCreateInfo computeLayoutInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange,
+    };
+
+    VK_CHECK(vkCreatePipelineLayout(device, &computeLayoutInfo, nullptr,
+                                    &computePipelineLayout));
+
+    auto buildComputePipeline = [&](VkShaderModule module,
+                                    const char *entryPoint) {
+        VkPipeline pipeline = ComputePipelineBuilder()
+                                  .setLayout(computePipelineLayout)
+                                  .setShader(module, entryPoint)
+                                  .build(device, pipelineCache);
+
+        if (pipeline == VK_NULL_HANDLE) {
+            throw std::runtime_error(
+                fmt::format("failed to build compute pipeline {}", entryPoint));
+        }
+
+        return pipeline;
+    };
+
+    computePipelines = LSystemComputePipelines{
+        .rewriteCount = buildComputePipeline(lsystemModule, "rewriteCount"),
+        .rewriteScatter = buildComputePipeline(lsystemModule, "rewriteScatter"),
+        .scanBlocks = buildComputePipeline(lsystemModule, "scanBlocks"),
+        .scanAddBlocks = buildComputePipeline(lsystemModule, "scanAddBlocks"),
+        .turtleSummarize =
+            buildComputePipeline(lsystemModule, "turtleSummarize"),
+        .turtleCompose = buildComputePipeline(lsystemModule, "turtleCompose"),
+        .turtleEmit = buildComputePipeline(lsystemModule, "turtleEmit"),
+        .turtleBounds = buildComputePipeline(lsystemModule, "turtleBounds"),
+    };
+
+    vkDestroyShaderModule(device, lsystemModule, nullptr);
+
+    VkShaderModule cullModule = createShaderModule(shaders::cull);
+
+    cullPipeline = buildComputePipeline(cullModule, "cullClusters");
+    depthReducePipeline = buildComputePipeline(cullModule, "reduceDepth");
+
+    vkDestroyShaderModule(device, cullModule, nullptr);
 }
 
 void Renderer::destroyPipelines() {
     vkDestroyPipeline(device, meshPipeline, nullptr);
+    vkDestroyPipeline(device, packedMeshPipeline, nullptr);
+    vkDestroyPipeline(device, segmentPipeline, nullptr);
+    vkDestroyPipeline(device, linePipeline, nullptr);
+    vkDestroyPipeline(device, galleryPipeline, nullptr);
+    vkDestroyPipeline(device, tubePipeline, nullptr);
+    vkDestroyPipelineLayout(device, tubePipelineLayout, nullptr);
     vkDestroyPipelineLayout(device, meshPipelineLayout, nullptr);
+
+    for (VkPipeline pipeline :
+         {computePipelines.rewriteCount, computePipelines.rewriteScatter,
+          computePipelines.scanBlocks, computePipelines.scanAddBlocks,
+          computePipelines.turtleSummarize, computePipelines.turtleCompose,
+          computePipelines.turtleEmit, computePipelines.turtleBounds,
+          cullPipeline, depthReducePipeline}) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    vkDestroyPipelineLayout(device, computePipelineLayout, nullptr);
 }
 
 AllocatedBuffer Renderer::createBuffer(size_t size, VkBufferUsageFlags usage,
-                                       VmaMemoryUsage memoryUsage) {
+                                       VmaMemoryUsage memoryUsage,
+                                       bool shared) {
+    const uint32_t queueFamilies[2] = {graphicsQueueFamily,
+                                       transferQueueFamily};
+    const bool concurrent =
+        shared && graphicsQueueFamily != transferQueueFamily;
 
     VkBufferCreateInfo bufferInfo{
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .size = size,
         .usage = usage,
+        .sharingMode =
+            concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = concurrent ? 2u : 0u,
+        .pQueueFamilyIndices = concurrent ? queueFamilies : nullptr,
     };
 
     VmaAllocationCreateInfo allocInfo{
@@ -879,7 +2645,7 @@ AllocatedBuffer Renderer::createBuffer(size_t size, VkBufferUsageFlags usage,
         .usage = memoryUsage,
     };
 
-    AllocatedBuffer buffer;
+    AllocatedBuffer buffer{.size = size};
 
     vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &buffer.buffer,
                     &buffer.allocation, &buffer.allocationInfo);
@@ -891,61 +2657,1837 @@ void Renderer::destroyBuffer(AllocatedBuffer buffer) {
     vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
 }
 
-GPUMesh Renderer::uploadMesh(std::span<Vertex> vertices,
-                             std::span<uint32_t> indices) {
-    const size_t verticesSize = vertices.size() * sizeof(Vertex);
-    const size_t indicesSize = indices.size() * sizeof(uint32_t);
+VkDeviceAddress Renderer::getBufferAddress(const AllocatedBuffer &buffer) {
+    VkBufferDeviceAddressInfo addressInfo{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer.buffer,
+    };
+
+    return vkGetBufferDeviceAddress(device, &addressInfo);
+}
+
+void Renderer::computeBarrier(VkCommandBuffer cmd) {
+    VkMemoryBarrier2 barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .dstAccessMask =
+            VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT,
+    };
 
-    GPUMesh mesh;
+    VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+                             .memoryBarrierCount = 1,
+                             .pMemoryBarriers = &barrier};
 
-    mesh.vertices = createBuffer(verticesSize,
-                                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                                 VMA_MEMORY_USAGE_GPU_ONLY);
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+}
 
-    mesh.indices = createBuffer(indicesSize,
-                                VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                                VMA_MEMORY_USAGE_GPU_ONLY);
+MeshUpload Renderer::uploadMesh(const MeshData &meshData,
+                                std::shared_ptr<const void> owner) {
+    std::span<const Vertex> vertices = meshData.vertices;
+    std::span<const float> births = meshData.births;
 
-    VkBufferDeviceAddressInfo addressInfo{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        .buffer = mesh.vertices.buffer,
-    };
+    MeshUpload upload = uploadMeshData(
+        {std::as_bytes(vertices), std::as_bytes(births)}, meshData.indices,
+        meshData.clusters, sizeof(Vertex), std::move(owner));
 
-    mesh.vertexBufferAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+    // full meshes have no palette, their births take its place
+    GPUMesh &mesh = upload.mesh;
+    if (!births.empty()) {
+        mesh.birthAddress = mesh.paletteAddress;
+    }
+    mesh.paletteAddress = 0;
+    mesh.paletteCount = 0;
+    mesh.boundsMin = meshData.boundsMin;
+    mesh.boundsMax = meshData.boundsMax;
 
-    AllocatedBuffer staging = createBuffer(verticesSize + indicesSize,
-                                           VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                           VMA_MEMORY_USAGE_CPU_ONLY);
+    return upload;
+}
 
-    void *data = staging.allocation->GetMappedData();
-    memcpy(data, vertices.data(), verticesSize);
-    memcpy((char *)data + verticesSize, indices.data(), indicesSize);
+MeshUpload Renderer::uploadMesh(const PackedMeshData &packedMesh,
+                                std::shared_ptr<const void> owner) {
+    std::span<const PackedVertex> vertices = packedMesh.vertices;
+    std::span<const glm::vec4> palette = packedMesh.palette;
 
-    immediateSubmit([&](VkCommandBuffer cmd) {
-        VkBufferCopy vertexCopy{
-            .srcOffset = 0,
-            .dstOffset = 0,
-            .size = verticesSize,
+    MeshUpload upload = uploadMeshData(
+        {std::as_bytes(vertices), std::as_bytes(palette)}, packedMesh.indices,
+        packedMesh.clusters, sizeof(PackedVertex), std::move(owner));
+
+    GPUMesh &mesh = upload.mesh;
+    mesh.vertexFormat = VertexFormat::Packed;
+    mesh.boundsMin = packedMesh.boundsMin;
+    mesh.boundsMax = packedMesh.boundsMax;
+
+    return upload;
+}
+
+MeshUpload Renderer::uploadSegments(const SegmentData &segmentData,
+                                    std::shared_ptr<const void> owner) {
+    std::span<const Segment> segments = segmentData.segments;
+    std::span<const glm::vec4> palette = segmentData.palette;
+
+    MeshUpload upload =
+        uploadMeshData({std::as_bytes(segments), std::as_bytes(palette)}, {},
+                       segmentData.clusters, 0, std::move(owner));
+
+    GPUMesh &mesh = upload.mesh;
+    mesh.vertexFormat = VertexFormat::Segments;
+    mesh.indexCount = unitCylinder.indexCount;
+    mesh.instanceCount = static_cast<uint32_t>(segments.size());
+    mesh.boundsMin = segmentData.boundsMin;
+    mesh.boundsMax = segmentData.boundsMax;
+
+    return upload;
+}
+
+MeshUpload Renderer::uploadTubes(const SegmentData &segmentData,
+                                 std::shared_ptr<const void> owner) {
+    std::span<const Segment> segments = segmentData.segments;
+    std::span<const glm::vec4> palette = segmentData.palette;
+
+    MeshUpload upload =
+        uploadMeshData({std::as_bytes(segments), std::as_bytes(palette)}, {},
+                       {}, 0, std::move(owner));
+
+    GPUMesh &mesh = upload.mesh;
+    mesh.vertexFormat = VertexFormat::Tubes;
+    mesh.indexCount = CYLINDER_SIDES * 6;
+    mesh.instanceCount = static_cast<uint32_t>(segments.size());
+    mesh.boundsMin = segmentData.boundsMin;
+    mesh.boundsMax = segmentData.boundsMax;
+
+    return upload;
+}
+
+MeshUpload Renderer::uploadLines(const LineData &lineData,
+                                 std::shared_ptr<const void> owner) {
+    std::span<const LineVertex> vertices = lineData.vertices;
+    std::span<const glm::vec4> palette = lineData.palette;
+
+    MeshUpload upload =
+        uploadMeshData({std::as_bytes(vertices), std::as_bytes(palette)},
+                       lineData.indices, lineData.clusters, 0,
+                       std::move(owner));
+
+    GPUMesh &mesh = upload.mesh;
+    mesh.vertexFormat = VertexFormat::Lines;
+    mesh.lineVertexCount = vertices.size();
+    mesh.boundsMin = lineData.boundsMin;
+    mesh.boundsMax = lineData.boundsMax;
+
+    return upload;
+}
+
+MeshUpload Renderer::uploadGeometry(const GeometryBlocks &blocks,
+                                    std::shared_ptr<const void> owner) {
+    size_t vertexStride = 0;
+    if (blocks.format == VertexFormat::Full) {
+        vertexStride = sizeof(Vertex);
+    } else if (blocks.format == VertexFormat::Packed) {
+        vertexStride = sizeof(PackedVertex);
+    }
+
+    MeshUpload upload =
+        uploadMeshData({blocks.vertices, blocks.palette}, blocks.indices,
+                       blocks.clusters, vertexStride, std::move(owner));
+
+    GPUMesh &mesh = upload.mesh;
+    mesh.vertexFormat = blocks.format;
+    if (blocks.format == VertexFormat::Full) {
+        if (!blocks.palette.empty()) {
+            mesh.birthAddress = mesh.paletteAddress;
+        }
+        mesh.paletteAddress = 0;
+        mesh.paletteCount = 0;
+    }
+    if (blocks.format == VertexFormat::Lines) {
+        mesh.lineVertexCount = blocks.vertices.size() / sizeof(LineVertex);
+    }
+    mesh.indexCount = blocks.indexCount;
+    mesh.instanceCount = blocks.instanceCount;
+    mesh.boundsMin = blocks.boundsMin;
+    mesh.boundsMax = blocks.boundsMax;
+
+    return upload;
+}
+
+MeshUpload Renderer::uploadMeshData(
+    std::initializer_list<std::span<const std::byte>> vertexData,
+    std::span<const uint32_t> indices, std::span<const Cluster> clusters,
+    size_t vertexStride, std::shared_ptr<const void> owner) {
+    TraceZone zone("upload mesh");
+    // streaming reads the data long after this returns, so it needs an owner
+    const bool streamed = owner != nullptr;
+    std::vector<MeshChunk> chunks;
+    if (streamed && vertexStride > 0) {
+        chunks = planChunks(indices, clusters);
+    }
+    const bool chunked = !chunks.empty();
+
+    // the vertices of chunked meshes live in one buffer per chunk, so only
+    // the parts behind them take up room here
+    size_t vertexDataSize = 0;
+    size_t clustersOffset = 0;
+    for (const std::span<const std::byte> &part : vertexData) {
+        vertexDataSize += part.size();
+        if (!chunked || &part != vertexData.begin()) {
+            clustersOffset += part.size();
+        }
+    }
+    const size_t verticesSize = clustersOffset + clusters.size_bytes();
+    const size_t clusterVerticesSize =
+        chunked ? clusters.size() * sizeof(GPUClusterVertices) : 0;
+    const size_t indicesSize =
+        indices.size() * (chunked ? sizeof(uint16_t) : sizeof(uint32_t));
+
+    GPUMesh mesh{};
+
+    mesh.vertices =
+        createBuffer(verticesSize + clusterVerticesSize, MESH_VERTEX_USAGE,
+                     VMA_MEMORY_USAGE_GPU_ONLY, true);
+
+    // meshes without indices of their own, like segments, are drawn with the
+    // index buffer of another mesh
+    if (indicesSize > 0) {
+        mesh.indices = createBuffer(indicesSize,
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                        VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                    VMA_MEMORY_USAGE_GPU_ONLY, true);
+    }
+
+    mesh.vertexBufferAddress = getBufferAddress(mesh.vertices);
+    mesh.vertexDataSize = vertexDataSize + clusters.size_bytes();
+    mesh.indexCount = static_cast<uint32_t>(indices.size());
+    mesh.indexType = chunked ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+    if (!clusters.empty()) {
+        const VkBufferUsageFlags indirectUsage =
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+        mesh.clusterAddress = mesh.vertexBufferAddress + clustersOffset;
+        mesh.clusterCount = static_cast<uint32_t>(clusters.size());
+        mesh.readyClusterCount = chunked ? 0 : mesh.clusterCount;
+        mesh.drawCommands =
+            createBuffer(clusters.size() * sizeof(VkDrawIndexedIndirectCommand),
+                         indirectUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+        mesh.drawCount =
+            createBuffer(sizeof(uint32_t),
+                         indirectUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+
+    // vertex parts are packed back to back, indices go to their own buffer.
+    // the vertices and indices of chunked meshes are left to the stream
+    std::vector<StagingCopy> copies;
+    VkDeviceSize offset = 0;
+    for (const std::span<const std::byte> &part : vertexData) {
+        if (chunked && &part == vertexData.begin()) {
+            continue;
+        }
+        // the palette or the births, whatever follows the vertices
+        if (&part == vertexData.begin() + 1) {
+            mesh.paletteAddress = mesh.vertexBufferAddress + offset;
+            mesh.paletteCount =
+                static_cast<uint32_t>(part.size() / sizeof(glm::vec4));
+        }
+        copies.push_back(StagingCopy{
+            .buffer = mesh.vertices.buffer,
+            .offset = offset,
+            .data = part,
+        });
+        offset += part.size();
+    }
+
+    if (!clusters.empty()) {
+        copies.push_back(StagingCopy{
+            .buffer = mesh.vertices.buffer,
+            .offset = clustersOffset,
+            .data = std::as_bytes(clusters),
+        });
+    }
+
+    std::vector<GPUClusterVertices> clusterVertices;
+    std::vector<VkBuffer> chunkBuffers;
+    if (chunked) {
+        // every chunk gets its own buffer, so no allocation holds more than
+        // MAX_CHUNK_VERTICES vertices however large the mesh
+        clusterVertices.resize(clusters.size());
+        for (const MeshChunk &chunk : chunks) {
+            AllocatedBuffer buffer = createBuffer(
+                chunk.vertexCount * vertexStride, MESH_VERTEX_USAGE,
+                VMA_MEMORY_USAGE_GPU_ONLY, true);
+            std::fill_n(clusterVertices.begin() + chunk.firstCluster,
+                        chunk.clusterCount,
+                        GPUClusterVertices{
+                            .vertices = getBufferAddress(buffer),
+                            .firstVertex = chunk.firstVertex,
+                        });
+            mesh.chunkVertices.push_back(buffer);
+            chunkBuffers.push_back(buffer.buffer);
+        }
+        mesh.chunks = chunks;
+        mesh.vertexStride = vertexStride;
+
+        mesh.clusterVerticesAddress = mesh.vertexBufferAddress + verticesSize;
+        copies.push_back(StagingCopy{
+            .buffer = mesh.vertices.buffer,
+            .offset = verticesSize,
+            .data = std::as_bytes(std::span(clusterVertices)),
+        });
+    } else if (indicesSize > 0) {
+        copies.push_back(StagingCopy{
+            .buffer = mesh.indices.buffer,
+            .offset = 0,
+            .data = std::as_bytes(indices),
+        });
+    }
+
+    MeshUpload upload{
+        .mesh = mesh,
+        .timelineValue = streamed ? 0 : stageCopies(copies),
+        .stream = std::nullopt,
+        .verticesOnly = false,
+    };
+
+    // moving the vectors keeps their data where the copies point
+    if (streamed) {
+        upload.stream = MeshStream{
+            .owner = std::move(owner),
+            .copies =
+                QueuedCopies{
+                    .copies = std::move(copies),
+                    .nextCopy = 0,
+                    .copyOffset = 0,
+                    .timelineValue = 0,
+                },
+            .clusterVertices = std::move(clusterVertices),
+            .vertices = *vertexData.begin(),
+            .vertexStride = vertexStride,
+            .indices = indices,
+            .vertexBuffers = std::move(chunkBuffers),
+            .indexBuffer = mesh.indices.buffer,
+            .chunks = std::move(chunks),
+            .chunkValues = {},
+            .readyChunks = 0,
+            .localIndices = {},
         };
+    }
+
+    return upload;
+}
+
+MeshUpload Renderer::updateVertices(
+    const GPUMesh &mesh,
+    std::initializer_list<std::span<const std::byte>> vertexData,
+    std::shared_ptr<const void> owner) {
+    // chunked meshes keep the first part in their chunk buffers and the
+    // cluster vertices pointing there behind the others
+    const bool chunked = !mesh.chunkVertices.empty();
+    VkDeviceSize size = 0;
+    for (const std::span<const std::byte> &part : vertexData) {
+        if (!chunked || &part != vertexData.begin()) {
+            size += part.size();
+        }
+    }
+    const VkDeviceSize clusterVerticesOffset = size;
+    if (chunked) {
+        size += mesh.clusterCount * sizeof(GPUClusterVertices);
+    }
+
+    // frames keep drawing the old vertices until the new ones are staged and
+    // swapped in, so they go to a buffer of their own
+    MeshUpload upload{
+        .mesh = mesh,
+        .timelineValue = 0,
+        .stream = std::nullopt,
+        .verticesOnly = true,
+    };
+    AllocatedBuffer vertices = createBuffer(size, MESH_VERTEX_USAGE,
+                                            VMA_MEMORY_USAGE_GPU_ONLY, true);
+    rebaseVertices(upload.mesh, vertices);
+
+    std::vector<StagingCopy> copies;
+    VkDeviceSize offset = 0;
+    for (const std::span<const std::byte> &part : vertexData) {
+        if (chunked && &part == vertexData.begin()) {
+            continue;
+        }
+        copies.push_back(StagingCopy{
+            .buffer = vertices.buffer,
+            .offset = offset,
+            .data = part,
+        });
+        offset += part.size();
+    }
+
+    // the chunks are replaced as a whole for the same reason, the topology
+    // is unchanged so they split the vertices the way they did before
+    std::vector<GPUClusterVertices> clusterVertices;
+    if (chunked) {
+        clusterVertices.resize(mesh.clusterCount);
+        upload.mesh.chunkVertices.clear();
+        for (const MeshChunk &chunk : mesh.chunks) {
+            AllocatedBuffer buffer = createBuffer(
+                chunk.vertexCount * mesh.vertexStride, MESH_VERTEX_USAGE,
+                VMA_MEMORY_USAGE_GPU_ONLY, true);
+            std::fill_n(clusterVertices.begin() + chunk.firstCluster,
+                        chunk.clusterCount,
+                        GPUClusterVertices{
+                            .vertices = getBufferAddress(buffer),
+                            .firstVertex = chunk.firstVertex,
+                        });
+            copies.push_back(StagingCopy{
+                .buffer = buffer.buffer,
+                .offset = 0,
+                .data = vertexData.begin()->subspan(
+                    chunk.firstVertex * mesh.vertexStride,
+                    chunk.vertexCount * mesh.vertexStride),
+            });
+            upload.mesh.chunkVertices.push_back(buffer);
+        }
+        copies.push_back(StagingCopy{
+            .buffer = vertices.buffer,
+            .offset = clusterVerticesOffset,
+            .data = std::as_bytes(std::span(clusterVertices)),
+        });
+    }
+
+    // no chunks to stream, only the copies
+    upload.stream = MeshStream{
+        .owner = std::move(owner),
+        .copies =
+            QueuedCopies{
+                .copies = std::move(copies),
+                .nextCopy = 0,
+                .copyOffset = 0,
+                .timelineValue = 0,
+            },
+        .clusterVertices = std::move(clusterVertices),
+        .vertices = {},
+        .vertexStride = mesh.vertexStride,
+        .indices = {},
+        .vertexBuffers = {},
+        .indexBuffer = VK_NULL_HANDLE,
+        .chunks = {},
+        .chunkValues = {},
+        .readyChunks = 0,
+        .localIndices = {},
+    };
 
-        vkCmdCopyBuffer(cmd, staging.buffer, mesh.vertices.buffer, 1,
-                        &vertexCopy);
+    return upload;
+}
+
+void Renderer::rebaseVertices(GPUMesh &mesh, AllocatedBuffer vertices) {
+    const VkDeviceAddress base = getBufferAddress(vertices);
+    auto rebase = [&](VkDeviceAddress &address) {
+        if (address != 0) {
+            address = base + (address - mesh.vertexBufferAddress);
+        }
+    };
+    rebase(mesh.paletteAddress);
+    rebase(mesh.birthAddress);
+    rebase(mesh.clusterAddress);
+    rebase(mesh.clusterVerticesAddress);
+    mesh.vertexBufferAddress = base;
+    mesh.vertices = vertices;
+}
+
+void Renderer::replaceVertices(GPUMesh &mesh, AllocatedBuffer vertices,
+                               uint64_t readValue) {
+    retire([this, previous = mesh.vertices, readValue] {
+        waitForTimeline(readValue);
+        destroyBuffer(previous);
+    });
+    rebaseVertices(mesh, vertices);
+}
+
+void Renderer::destroyMesh(GPUMesh mesh) {
+    if (mesh.indexCount == 0) {
+        return;
+    }
+
+    destroyBuffer(mesh.indices);
+    destroyVertices(mesh);
+
+    if (mesh.clusterCount > 0) {
+        destroyBuffer(mesh.drawCommands);
+        destroyBuffer(mesh.drawCount);
+    }
+}
+
+void Renderer::destroyVertices(const GPUMesh &mesh) {
+    destroyBuffer(mesh.vertices);
+    for (const AllocatedBuffer &buffer : mesh.chunkVertices) {
+        destroyBuffer(buffer);
+    }
+}
+
+void Renderer::uploadGallery(std::span<const MeshData> meshes,
+                             std::shared_ptr<const void> owner) {
+    TraceZone zone("upload gallery");
+    // a gallery that hasn't been staged yet was never drawn
+    cancelGalleryUpload();
+    if (meshes.empty()) {
+        // older frames may still be drawing the current gallery
+        retire([this, gallery = gallery] { destroyGallery(gallery); });
+        gallery = GPUGallery{};
+        return;
+    }
 
-        VkBufferCopy indexCopy{
-            .srcOffset = verticesSize,
-            .dstOffset = 0,
-            .size = indicesSize,
+    // a grid about as wide as it is high, scaled into the unit square the
+    // camera looks at
+    const uint32_t objectCount = static_cast<uint32_t>(meshes.size());
+    const uint32_t columns = static_cast<uint32_t>(
+        std::ceil(std::sqrt(static_cast<float>(objectCount))));
+    const uint32_t rows = (objectCount + columns - 1) / columns;
+    const float cellSize = 1.0f / static_cast<float>(std::max(columns, rows));
+    const glm::vec3 gridOrigin(-0.5f * cellSize * static_cast<float>(columns),
+                               -0.5f * cellSize * static_cast<float>(rows),
+                               0.0f);
+
+    // the copies point into the upload's vectors, which stay where they are
+    // however the upload is moved
+    GalleryUpload &upload = pendingGallery.emplace(GalleryUpload{
+        .gallery = {},
+        .owner = std::move(owner),
+        .objects = std::vector<GPUGalleryObject>(objectCount),
+        .commands = std::vector<VkDrawIndexedIndirectCommand>(objectCount),
+        .copies = {},
+    });
+    GPUGallery &newGallery = upload.gallery;
+    std::vector<GPUGalleryObject> &objects = upload.objects;
+    std::vector<VkDrawIndexedIndirectCommand> &commands = upload.commands;
+    std::vector<VkDeviceSize> meshOffsets(objectCount);
+    VkDeviceSize vertexSize = 0;
+    uint32_t indexCount = 0;
+    for (uint32_t i = 0; i < objectCount; i++) {
+        const MeshData &mesh = meshes[i];
+        meshOffsets[i] = vertexSize;
+        vertexSize += std::span(mesh.vertices).size_bytes() +
+                      std::span(mesh.births).size_bytes();
+        vertexSize = (vertexSize + GALLERY_MESH_ALIGNMENT - 1) &
+                     ~(GALLERY_MESH_ALIGNMENT - 1);
+
+        commands[i] = VkDrawIndexedIndirectCommand{
+            .indexCount = static_cast<uint32_t>(mesh.indices.size()),
+            .instanceCount = 1,
+            .firstIndex = indexCount,
+            .vertexOffset = 0,
+            .firstInstance = i,
         };
+        indexCount += static_cast<uint32_t>(mesh.indices.size());
+
+        // each mesh is fitted into its cell like fitMeshTransform fits the
+        // single mesh into the unit cube
+        const glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+        const float scale = GALLERY_CELL_FILL * cellSize /
+                            std::max({extent.x, extent.y, extent.z, 1e-6f});
+        const glm::vec3 center = 0.5f * (mesh.boundsMin + mesh.boundsMax);
+        const glm::vec3 cellCenter =
+            gridOrigin +
+            cellSize * glm::vec3(static_cast<float>(i % columns) + 0.5f,
+                                 static_cast<float>(i / columns) + 0.5f, 0.0f);
+        objects[i].transform =
+            glm::translate(glm::mat4(1.0f), cellCenter) *
+            glm::scale(glm::mat4(1.0f), glm::vec3(scale)) *
+            glm::translate(glm::mat4(1.0f), -center);
+    }
 
-        vkCmdCopyBuffer(cmd, staging.buffer, mesh.indices.buffer, 1,
-                        &indexCopy);
+    const VkBufferUsageFlags storageUsage =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    newGallery.vertices =
+        createBuffer(vertexSize + std::span(objects).size_bytes(),
+                     storageUsage, VMA_MEMORY_USAGE_GPU_ONLY, true);
+    newGallery.indices = createBuffer(
+        std::max<size_t>(indexCount, 1) * sizeof(uint32_t),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, true);
+    newGallery.drawCommands = createBuffer(
+        std::span(commands).size_bytes(),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, true);
+
+    const VkDeviceAddress vertexAddress = getBufferAddress(newGallery.vertices);
+    newGallery.objectAddress = vertexAddress + vertexSize;
+    newGallery.objectCount = objectCount;
+    newGallery.births =
+        std::any_of(meshes.begin(), meshes.end(), [](const MeshData &mesh) {
+            return !mesh.births.empty();
+        });
+
+    std::vector<StagingCopy> &copies = upload.copies.copies;
+    for (uint32_t i = 0; i < objectCount; i++) {
+        const MeshData &mesh = meshes[i];
+        const std::span<const std::byte> vertices =
+            std::as_bytes(std::span(mesh.vertices));
+        objects[i].vertexBuffer = vertexAddress + meshOffsets[i];
+        objects[i].births = mesh.births.empty()
+                                ? 0
+                                : objects[i].vertexBuffer + vertices.size();
+
+        copies.push_back(StagingCopy{
+            .buffer = newGallery.vertices.buffer,
+            .offset = meshOffsets[i],
+            .data = vertices,
+        });
+        copies.push_back(StagingCopy{
+            .buffer = newGallery.vertices.buffer,
+            .offset = meshOffsets[i] + vertices.size(),
+            .data = std::as_bytes(std::span(mesh.births)),
+        });
+        copies.push_back(StagingCopy{
+            .buffer = newGallery.indices.buffer,
+            .offset = commands[i].firstIndex * sizeof(uint32_t),
+            .data = std::as_bytes(std::span(mesh.indices)),
+        });
+    }
+    copies.push_back(StagingCopy{
+        .buffer = newGallery.vertices.buffer,
+        .offset = vertexSize,
+        .data = std::as_bytes(std::span(objects)),
     });
+    copies.push_back(StagingCopy{
+        .buffer = newGallery.drawCommands.buffer,
+        .offset = 0,
+        .data = std::as_bytes(std::span(commands)),
+    });
+}
+
+size_t Renderer::streamGallery(size_t budget) {
+    if (!pendingGallery) {
+        return 0;
+    }
+    TraceZone zone("stream gallery");
+
+    const size_t size = stageQueuedCopies(pendingGallery->copies, budget);
+    if (!isStaged(pendingGallery->copies)) {
+        return size;
+    }
 
-    destroyBuffer(staging);
+    // older frames may still be drawing the current gallery, frames recorded
+    // from here on draw the new one and wait for its copies
+    retire([this, gallery = gallery] { destroyGallery(gallery); });
+    gallery = pendingGallery->gallery;
+    drawUploadValue =
+        std::max(drawUploadValue, pendingGallery->copies.timelineValue);
+    pendingGallery.reset();
 
-    return mesh;
+    return size;
+}
+
+void Renderer::cancelGalleryUpload() {
+    if (!pendingGallery) {
+        return;
+    }
+
+    waitForTimeline(pendingGallery->copies.timelineValue);
+    destroyGallery(pendingGallery->gallery);
+    pendingGallery.reset();
+}
+
+void Renderer::destroyGallery(GPUGallery gallery) {
+    if (gallery.objectCount == 0) {
+        return;
+    }
+
+    destroyBuffer(gallery.vertices);
+    destroyBuffer(gallery.indices);
+    destroyBuffer(gallery.drawCommands);
+}
+
+void Renderer::queueMeshSwap(MeshUpload upload) {
+    // the chunks still streaming belong to a mesh that is being replaced
+    cancelMeshStream();
+
+    // a mesh that was never swapped in isn't referenced by any frame, it only
+    // has to wait for its own copy
+    if (pendingMesh && pendingMesh->verticesOnly) {
+        destroyVertices(waitForUpload(*pendingMesh));
+    } else if (pendingMesh) {
+        destroyMesh(waitForUpload(*pendingMesh));
+    }
+
+    meshStream = std::move(upload.stream);
+    upload.stream.reset();
+    pendingMesh = std::move(upload);
+}
+
+size_t Renderer::streamMesh(size_t budget) {
+    if (!meshStream) {
+        return 0;
+    }
+    TraceZone zone("stream mesh");
+
+    MeshStream &stream = *meshStream;
+    const size_t size = stageChunks(budget);
+    if (!isStaged(stream.copies)) {
+        return size;
+    }
+
+    // the copies are staged before any chunk, so until they are the stream
+    // belongs to pendingMesh, which can be swapped in once they arrive
+    if (pendingMesh) {
+        pendingMesh->timelineValue =
+            std::max(pendingMesh->timelineValue, stream.copies.timelineValue);
+    }
+    if (stream.chunks.empty()) {
+        meshStream.reset();
+        return size;
+    }
+
+    uint64_t completedValue;
+    VK_CHECK(
+        vkGetSemaphoreCounterValue(device, uploadSemaphore, &completedValue));
+    size_t readyChunks = stream.readyChunks;
+    while (readyChunks < stream.chunkValues.size() &&
+           stream.chunkValues[readyChunks] <= completedValue) {
+        readyChunks++;
+    }
+    if (readyChunks == stream.readyChunks) {
+        return size;
+    }
+    stream.readyChunks = readyChunks;
+
+    const MeshChunk &lastChunk = stream.chunks[readyChunks - 1];
+    const uint32_t readyClusterCount =
+        lastChunk.firstCluster + lastChunk.clusterCount;
+    const uint64_t readyValue = stream.chunkValues[readyChunks - 1];
+
+    // frames draw the new clusters from the next one on and wait for their
+    // copies through drawUploadValue, a pending mesh passes the value on when
+    // it is swapped in
+    if (pendingMesh) {
+        pendingMesh->mesh.readyClusterCount = readyClusterCount;
+        pendingMesh->timelineValue =
+            std::max(pendingMesh->timelineValue, readyValue);
+    } else {
+        lsystemMesh.readyClusterCount = readyClusterCount;
+        drawUploadValue = std::max(drawUploadValue, readyValue);
+    }
+
+    if (readyChunks == stream.chunks.size()) {
+        meshStream.reset();
+    }
+
+    return size;
+}
+
+void Renderer::flushMeshStream() {
+    if (!meshStream) {
+        return;
+    }
+
+    stageChunks(SIZE_MAX);
+    waitForTimeline(lastStagedValue(*meshStream));
+    streamMesh(0);
+}
+
+void Renderer::cancelMeshStream() {
+    if (!meshStream) {
+        return;
+    }
+
+    waitForTimeline(lastStagedValue(*meshStream));
+    meshStream.reset();
+}
+
+size_t Renderer::stageChunks(size_t budget) {
+    MeshStream &stream = *meshStream;
+
+    // the copies hold the clusters the chunks are drawn by, so they go first
+    size_t size = stageQueuedCopies(stream.copies, budget);
+    if (!isStaged(stream.copies)) {
+        return size;
+    }
+
+    // chunks are staged whole, one that doesn't fit waits for a frame with
+    // more room. with at most MAX_CHUNK_VERTICES vertices a chunk is far
+    // smaller than STREAM_BYTES_PER_FRAME, so it fits once the ring drains
+    const size_t firstChunk = stream.chunkValues.size();
+    size_t endChunk = firstChunk;
+    size_t indexCount = 0;
+    while (endChunk < stream.chunks.size()) {
+        const MeshChunk &chunk = stream.chunks[endChunk];
+        const size_t chunkSize = chunk.vertexCount * stream.vertexStride +
+                                 chunk.indexCount * sizeof(uint16_t);
+        if (size + chunkSize > budget) {
+            break;
+        }
+        size += chunkSize;
+        indexCount += chunk.indexCount;
+        endChunk++;
+    }
+    if (endChunk == firstChunk) {
+        return size;
+    }
+
+    // sized up front, the copies point into it until they are staged
+    stream.localIndices.resize(indexCount);
+    std::vector<StagingCopy> copies;
+    size_t localOffset = 0;
+    for (size_t i = firstChunk; i < endChunk; i++) {
+        const MeshChunk &chunk = stream.chunks[i];
+        std::span<uint16_t> localIndices =
+            std::span(stream.localIndices)
+                .subspan(localOffset, chunk.indexCount);
+        std::span<const uint32_t> indices =
+            stream.indices.subspan(chunk.firstIndex, chunk.indexCount);
+        for (size_t j = 0; j < indices.size(); j++) {
+            localIndices[j] =
+                static_cast<uint16_t>(indices[j] - chunk.firstVertex);
+        }
+        localOffset += chunk.indexCount;
+
+        copies.push_back(StagingCopy{
+            .buffer = stream.indexBuffer,
+            .offset = chunk.firstIndex * sizeof(uint16_t),
+            .data = std::as_bytes(localIndices),
+        });
+        copies.push_back(StagingCopy{
+            .buffer = stream.vertexBuffers[i],
+            .offset = 0,
+            .data = stream.vertices.subspan(
+                chunk.firstVertex * stream.vertexStride,
+                chunk.vertexCount * stream.vertexStride),
+        });
+    }
+
+    const uint64_t timelineValue = stageCopies(copies);
+    stream.chunkValues.resize(endChunk, timelineValue);
+
+    return size;
+}
+
+void Renderer::swapPendingMesh() {
+    // streamed meshes keep the previous one on screen until their copies are
+    // staged and their first chunk has arrived
+    if (!pendingMesh || (meshStream && !isStaged(meshStream->copies)) ||
+        !isUploadComplete(pendingMesh->timelineValue) ||
+        pendingMesh->mesh.readyClusterCount <
+            std::min(pendingMesh->mesh.clusterCount, 1u)) {
+        return;
+    }
+
+    // older frames may still be drawing the current mesh, frames recorded
+    // from here on draw the new one. a vertices only upload shares all but
+    // its vertices with it
+    if (pendingMesh->verticesOnly) {
+        retire([this, mesh = lsystemMesh] { destroyVertices(mesh); });
+    } else {
+        retire([this, mesh = lsystemMesh] { destroyMesh(mesh); });
+    }
+    lsystemMesh = pendingMesh->mesh;
+    drawUploadValue = std::max(drawUploadValue, pendingMesh->timelineValue);
+    pendingMesh.reset();
+
+    fitMeshTransform();
+}
+
+void Renderer::waitForFrames() {
+    VkFence fences[FRAMES_IN_FLIGHT];
+    for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        fences[i] = frames[i].renderFinishedFence;
+    }
+    VK_CHECK(vkWaitForFences(device, FRAMES_IN_FLIGHT, fences, true,
+                             1000000000));
+}
+
+void Renderer::fitMeshTransform() {
+    if (lsystemMesh.indexCount == 0) {
+        return;
+    }
+
+    // fit the mesh into the unit cube the camera is set up to look at
+    glm::vec3 extent = lsystemMesh.boundsMax - lsystemMesh.boundsMin;
+    float scale = 1.0f / std::max({extent.x, extent.y, extent.z, 1e-6f});
+    glm::vec3 center = 0.5f * (lsystemMesh.boundsMin + lsystemMesh.boundsMax);
+    meshTransform = glm::scale(glm::mat4(1.0f), glm::vec3(scale)) *
+                    glm::translate(glm::mat4(1.0f), -center);
+}
+
+void Renderer::advanceGrowth() {
+    if (!playGrowth || !isGrowing()) {
+        return;
+    }
+
+    // starts over from the axiom once the last generation has grown
+    growthTime += GROWTH_SPEED;
+    if (growthTime > static_cast<float>(generations + 1)) {
+        growthTime = 0.0f;
+    }
+}
+
+void Renderer::regenerate() {
+    // the gpu turtle doesn't know when segments were born
+    if (generateOnGPU && !(animateGrowth && meshFormat == VertexFormat::Full)) {
+        cancelGeneration();
+
+        Stopwatch stopwatch;
+        std::optional<GPUMesh> gpuMesh = generateMeshOnGPU();
+        if (gpuMesh) {
+            // rewriting, interpretation and allocation share one submission
+            generationTimings =
+                GenerationTimings{.interpretMs = stopwatch.lap()};
+            // the gpu path has finished by the time it returns, timeline
+            // value 0 is always complete
+            queueMeshSwap(MeshUpload{.mesh = *gpuMesh,
+                                     .timelineValue = 0,
+                                     .stream = std::nullopt,
+                                     .verticesOnly = false});
+            return;
+        }
+
+        SPDLOG_WARN("grammar not supported by the gpu path, generating on "
+                    "the cpu instead");
+    }
+
+    requestGeneration(false);
+}
+
+void Renderer::reinterpret() {
+    // the gpu path derives and interprets in the same submission
+    if (generateOnGPU) {
+        regenerate();
+        return;
+    }
+
+    requestGeneration(true);
+}
+
+void Renderer::recolor() {
+    // only full meshes store the turtle color per vertex, the others keep it
+    // once in the first palette entry. the colors ' picks after it are
+    // derived from it, and packed palettes hold whatever the vertices did,
+    // so a longer palette is built anew
+    const bool hasPalette = lsystemMesh.vertexFormat != VertexFormat::Full &&
+                            lsystemMesh.paletteCount == 1;
+    if (generationProgress || pendingMesh || meshStream || !hasPalette ||
+        lsystemMesh.vertexFormat != meshFormat) {
+        reinterpret();
+        return;
+    }
+
+    // frames in flight keep drawing the old colors, so everything but the
+    // first palette entry is copied into a new buffer and the color is
+    // written into the gap
+    const AllocatedBuffer previous = lsystemMesh.vertices;
+    AllocatedBuffer vertices = createBuffer(previous.size, MESH_VERTEX_USAGE,
+                                            VMA_MEMORY_USAGE_GPU_ONLY, true);
+    const VkDeviceSize colorOffset =
+        lsystemMesh.paletteAddress - lsystemMesh.vertexBufferAddress;
+    const VkDeviceSize colorEnd = colorOffset + sizeof(glm::vec4);
+
+    // chunked meshes start with the palette, the others end with it
+    std::vector<VkBufferCopy> regions;
+    if (colorOffset > 0) {
+        regions.push_back(VkBufferCopy{.size = colorOffset});
+    }
+    if (colorEnd < previous.size) {
+        regions.push_back(VkBufferCopy{
+            .srcOffset = colorEnd,
+            .dstOffset = colorEnd,
+            .size = previous.size - colorEnd,
+        });
+    }
+    // the color is recorded into the command buffer, it is too small to be
+    // worth room in the staging ring
+    const uint64_t copyValue = submitTransfer([&](VkCommandBuffer cmd) {
+        vkCmdCopyBuffer(cmd, previous.buffer, vertices.buffer,
+                        static_cast<uint32_t>(regions.size()), regions.data());
+        vkCmdUpdateBuffer(cmd, vertices.buffer, colorOffset,
+                          sizeof(glm::vec4), &turtleParameters.color);
+    });
+
+    replaceVertices(lsystemMesh, vertices, copyValue);
+    drawUploadValue = std::max(drawUploadValue, copyValue);
+}
+
+void Renderer::requestGeneration(bool updateInPlace) {
+    cancelGeneration();
+
+    auto progress = std::make_shared<GenerationProgress>();
+    generationProgress = progress;
+
+    jobPool.submit([this, request = makeGenerationRequest(updateInPlace),
+                    stop = generationStop.get_token(), progress] {
+        std::unique_ptr<GeneratedGeometry> geometry;
+        try {
+            geometry = buildGeometry(request, stop, *progress);
+        } catch (...) {
+            logJobFailure("generation", std::current_exception());
+            geometry = std::make_unique<GeneratedGeometry>(GeneratedGeometry{
+                .request = request.id,
+                .updateInPlace = request.updateInPlace,
+                .format = request.format,
+                .symbolCount = 0,
+                .segmentCount = 0,
+                .timings = {},
+                .data = {},
+                .cachePath = {},
+                .cacheKey = request.cacheKey,
+                .failed = true,
+            });
+        }
+        if (geometry) {
+            publishGeometry(std::move(geometry));
+        }
+    });
+}
+
+void Renderer::cancelGeneration() {
+    generationStop.request_stop();
+    generationStop = std::stop_source();
+    generationProgress.reset();
+    // a job that finishes anyway publishes a result nobody picks up
+    generationRequest++;
+}
+
+Renderer::GenerationRequest
+Renderer::makeGenerationRequest(bool updateInPlace) const {
+    GenerationRequest request{
+        .id = generationRequest,
+        .lsystem = lsystem,
+        .turtleParameters = turtleParameters,
+        .generations = static_cast<uint32_t>(generations),
+        .streamDerivation = streamDerivation,
+        .memoizeSubtrees = memoizeSubtrees,
+        .animateGrowth = animateGrowth && meshFormat == VertexFormat::Full,
+        .format = supportsFormat(meshFormat) ? meshFormat
+                                             : VertexFormat::Segments,
+        .updateInPlace = updateInPlace,
+        .cachePath = {},
+        .cacheKey = 0,
+    };
+
+    if (cacheGeometry) {
+        request.cacheKey =
+            geometryCacheKey(lsystem, turtleParameters, request.generations,
+                             request.format, request.animateGrowth);
+        request.cachePath =
+            geometryCacheDirectory /
+            fmt::format("geometry_{:016x}.bin", request.cacheKey);
+    }
+
+    return request;
+}
+
+std::unique_ptr<Renderer::GeneratedGeometry>
+Renderer::buildGeometry(const GenerationRequest &request, std::stop_token stop,
+                        GenerationProgress &progress) {
+    // thrown out of the streaming walk, which has no other way to stop early
+    struct GenerationCancelled {};
+
+    TraceZone zone("build geometry");
+    Stopwatch stopwatch;
+    const LSystem &system = request.lsystem;
+    const uint32_t generations = request.generations;
+
+    auto geometry = std::make_unique<GeneratedGeometry>(GeneratedGeometry{
+        .request = request.id,
+        .updateInPlace = request.updateInPlace,
+        .format = request.format,
+        .symbolCount = 0,
+        .segmentCount = 0,
+        .timings = {},
+        .data = {},
+        .cachePath = {},
+        .cacheKey = request.cacheKey,
+        .failed = false,
+    });
+
+    // mapping the file is all there is to do here, the pages are only read
+    // once the upload copies them into the staging ring
+    if (!request.cachePath.empty()) {
+        if (std::optional<CachedGeometry> cached =
+                openGeometryCache(request.cachePath, request.cacheKey)) {
+            SPDLOG_DEBUG("loaded geometry from {}",
+                         request.cachePath.string());
+            // packed requests may have been stored unpacked
+            geometry->format = cached->blocks.format;
+            geometry->symbolCount = cached->blocks.symbolCount;
+            geometry->segmentCount = cached->blocks.segmentCount;
+            geometry->data = std::move(*cached);
+            geometry->timings.interpretMs = stopwatch.lap();
+            return geometry;
+        }
+    }
+
+    // only an estimate for stochastic systems until the derivation is done.
+    // with parametric rules it can be off by orders of magnitude either way,
+    // so there it is only a capped hint for the reservation and the walk or
+    // the derivation counts the symbols
+    std::vector<uint64_t> histogram = system.symbolHistogram(generations);
+    const bool estimated = !system.hasParametricRules();
+    if (estimated) {
+        geometry->symbolCount =
+            std::accumulate(histogram.begin(), histogram.end(), uint64_t{0});
+    }
+
+    // called every PROGRESS_INTERVAL symbols, false once the job was stopped.
+    // the fraction is left unknown while nothing estimated the total
+    auto interpreted = [&](uint64_t count) {
+        progress.fraction.store(
+            geometry->symbolCount == 0
+                ? -1.0f
+                : std::min(static_cast<float>(count) / geometry->symbolCount,
+                           1.0f),
+            std::memory_order_relaxed);
+        return !stop.stop_requested();
+    };
+
+    TurtleOutput output = TurtleOutput::Mesh;
+    if (request.format == VertexFormat::Segments ||
+        request.format == VertexFormat::Tubes) {
+        output = TurtleOutput::Segments;
+    } else if (request.format == VertexFormat::Lines) {
+        output = TurtleOutput::Lines;
+    }
+    Turtle turtle(request.turtleParameters, system.getSymbols(), output);
+    // exact unless the system is stochastic, in which case a built
+    // derivation replaces the estimate, or parametric, in which case the
+    // outputs grow past MAX_ESTIMATED_SEGMENTS as they are written
+    turtle.reserve(histogram,
+                   estimated ? UINT64_MAX : MAX_ESTIMATED_SEGMENTS);
+
+    // memoization and streaming keep no derivation around, so there is
+    // nothing to reuse and the production tree is walked again. only the
+    // walk knows module births, so growing meshes always take it
+    const bool streamed = request.streamDerivation || request.animateGrowth;
+    progress.stage = request.memoizeSubtrees || streamed
+                         ? GenerationStage::Interpreting
+                         : GenerationStage::Rewriting;
+    if (request.memoizeSubtrees && !request.animateGrowth &&
+        turtle.interpretMemoized(system, generations)) {
+        // every subtree is interpreted once, which is too quick to report on.
+        // only deterministic systems without parametric rules are memoized,
+        // for them the histogram already counted the symbols exactly
+    } else if (streamed) {
+        TraceZone expandZone("expand and interpret");
+        uint64_t count = 0;
+        auto reportProgress = [&] {
+            if (++count % PROGRESS_INTERVAL == 0 && !interpreted(count)) {
+                throw GenerationCancelled{};
+            }
+        };
+        try {
+            if (request.animateGrowth) {
+                system.expand(generations, [&](SymbolId symbol,
+                                               const float *parameters,
+                                               float birth) {
+                    turtle.step(symbol, parameters, birth);
+                    reportProgress();
+                });
+            } else {
+                system.expand(generations,
+                              [&](SymbolId symbol, const float *parameters) {
+                                  turtle.step(symbol, parameters);
+                                  reportProgress();
+                              });
+            }
+        } catch (const GenerationCancelled &) {
+            return nullptr;
+        }
+        geometry->symbolCount = count;
+    } else {
+        progress.stage = GenerationStage::Rewriting;
+        std::lock_guard lock(derivationMutex);
+
+        // one generation at a time, so the cache keeps what was finished
+        // when the job is stopped halfway
+        ModuleString modules = system.getAxiom();
+        for (uint32_t i = 1; i <= generations; i++) {
+            if (stop.stop_requested()) {
+                return nullptr;
+            }
+            TraceZone rewriteZone("rewrite");
+            modules = system.derive(i, derivationCache);
+            progress.fraction.store(static_cast<float>(i) / generations,
+                                    std::memory_order_relaxed);
+        }
+        geometry->timings.rewriteMs = stopwatch.lap();
+        geometry->symbolCount = modules.size();
+
+        progress.stage = GenerationStage::Interpreting;
+        const std::span<const SymbolId> symbols = modules.symbols;
+        const float *parameters = modules.parameters.data();
+        for (size_t first = 0; first < symbols.size();
+             first += INTERPRET_SLICE) {
+            TraceZone interpretZone("interpret");
+            const size_t count =
+                std::min<size_t>(INTERPRET_SLICE, symbols.size() - first);
+            parameters =
+                turtle.interpret(symbols.subspan(first, count), parameters);
+            if (!interpreted(first + count)) {
+                return nullptr;
+            }
+        }
+    }
+
+    if (stop.stop_requested()) {
+        return nullptr;
+    }
+
+    progress.stage = GenerationStage::Finishing;
+    TraceZone finishZone("finish");
+    geometry->segmentCount = turtle.getSegmentCount();
+    if (request.format == VertexFormat::Segments ||
+        request.format == VertexFormat::Tubes) {
+        geometry->data = turtle.finishSegments();
+    } else if (request.format == VertexFormat::Lines) {
+        geometry->data = turtle.finishLines();
+    } else if (request.format == VertexFormat::Packed) {
+        MeshData mesh = turtle.finish();
+        if (std::optional<PackedMeshData> packed = packMesh(mesh)) {
+            geometry->data = std::move(*packed);
+        } else {
+            // the job has no way to fail, so the mesh is drawn unpacked
+            SPDLOG_WARN("too many distinct colors for a packed mesh, drawing "
+                        "full vertices instead");
+            geometry->format = VertexFormat::Full;
+            geometry->data = std::move(mesh);
+        }
+    } else {
+        geometry->data = turtle.finish();
+    }
+    geometry->timings.interpretMs = stopwatch.lap();
+
+    // in place updates follow sliders and would flood the cache
+    const double generationMs =
+        geometry->timings.rewriteMs + geometry->timings.interpretMs;
+    if (!request.updateInPlace && generationMs >= GEOMETRY_CACHE_MIN_MS) {
+        geometry->cachePath = request.cachePath;
+    }
+
+    return geometry;
+}
+
+void Renderer::publishGeometry(std::unique_ptr<GeneratedGeometry> geometry) {
+    // a job stopped right before publishing can still race the one that
+    // replaced it, whichever result comes from the newer request is kept.
+    // whatever the exchange hands back is owned by this thread alone
+    while (geometry) {
+        const uint64_t request = geometry->request;
+        std::unique_ptr<GeneratedGeometry> previous(
+            publishedGeometry.exchange(geometry.release()));
+        if (!previous || previous->request < request) {
+            return;
+        }
+        geometry = std::move(previous);
+    }
+}
+
+void Renderer::collectGeometry() {
+    std::shared_ptr<GeneratedGeometry> geometry(
+        publishedGeometry.exchange(nullptr));
+    if (!geometry || geometry->request != generationRequest) {
+        return;
+    }
+
+    generationProgress.reset();
+    if (geometry->failed) {
+        return;
+    }
+    applyGeometry(geometry);
+
+    // the data is only read from here on, so the job shares it with a mesh
+    // stream that may still be uploading it
+    if (!geometry->cachePath.empty()) {
+        jobPool.submit([this, geometry] {
+            TraceZone zone("write geometry cache");
+            if (!writeGeometryCache(geometry->cachePath, geometry->cacheKey,
+                                    describeGeometry(*geometry))) {
+                SPDLOG_WARN("failed to write geometry cache {}",
+                            geometry->cachePath.string());
+            }
+        });
+    }
+}
+
+void Renderer::applyGeometry(
+    const std::shared_ptr<GeneratedGeometry> &result) {
+    TraceZone zone("apply geometry");
+    GeneratedGeometry &geometry = *result;
+    Stopwatch stopwatch;
+    generationTimings = geometry.timings;
+    symbolCount = geometry.symbolCount;
+    segmentCount = geometry.segmentCount;
+
+    // the topology only depends on the derivation, so when it matches the
+    // drawn mesh only the vertex data has to be rewritten
+    auto update = [&](std::initializer_list<std::span<const std::byte>>
+                          vertexData,
+                      uint32_t indexCount, uint32_t instanceCount,
+                      glm::vec3 boundsMin, glm::vec3 boundsMax) {
+        size_t vertexDataSize = 0;
+        for (std::span<const std::byte> part : vertexData) {
+            vertexDataSize += part.size();
+        }
+
+        if (!geometry.updateInPlace || pendingMesh || meshStream ||
+            lsystemMesh.vertexFormat != geometry.format ||
+            lsystemMesh.indexCount != indexCount ||
+            lsystemMesh.instanceCount != instanceCount ||
+            lsystemMesh.vertexDataSize != vertexDataSize) {
+            return false;
+        }
+
+        MeshUpload upload = updateVertices(lsystemMesh, vertexData, result);
+        upload.mesh.boundsMin = boundsMin;
+        upload.mesh.boundsMax = boundsMax;
+        queueMeshSwap(std::move(upload));
+        generationTimings.uploadMs = stopwatch.lap();
+        return true;
+    };
+
+    MeshUpload upload{
+        .mesh = {},
+        .timelineValue = 0,
+        .stream = std::nullopt,
+        .verticesOnly = false,
+    };
+
+    auto *segmentData = std::get_if<SegmentData>(&geometry.data);
+    if (segmentData && geometry.format == VertexFormat::Tubes) {
+        std::span<const Segment> segments = segmentData->segments;
+        std::span<const glm::vec4> palette = segmentData->palette;
+        if (update({std::as_bytes(segments), std::as_bytes(palette)},
+                   CYLINDER_SIDES * 6, static_cast<uint32_t>(segments.size()),
+                   segmentData->boundsMin, segmentData->boundsMax)) {
+            return;
+        }
+        if (!segments.empty()) {
+            upload = uploadTubes(*segmentData, result);
+        }
+    } else if (segmentData) {
+        // every cluster draws the whole unit cylinder once per segment
+        for (Cluster &cluster : segmentData->clusters) {
+            cluster.indexCount = unitCylinder.indexCount;
+        }
+        std::span<const Segment> segments = segmentData->segments;
+        std::span<const glm::vec4> palette = segmentData->palette;
+        std::span<const Cluster> clusters = segmentData->clusters;
+        if (update({std::as_bytes(segments), std::as_bytes(palette),
+                    std::as_bytes(clusters)},
+                   unitCylinder.indexCount,
+                   static_cast<uint32_t>(segments.size()),
+                   segmentData->boundsMin, segmentData->boundsMax)) {
+            return;
+        }
+        if (!segments.empty()) {
+            upload = uploadSegments(*segmentData, result);
+        }
+    } else if (auto *lineData = std::get_if<LineData>(&geometry.data)) {
+        std::span<const LineVertex> vertices = lineData->vertices;
+        std::span<const glm::vec4> palette = lineData->palette;
+        std::span<const Cluster> clusters = lineData->clusters;
+        if (update({std::as_bytes(vertices), std::as_bytes(palette),
+                    std::as_bytes(clusters)},
+                   static_cast<uint32_t>(lineData->indices.size()), 1,
+                   lineData->boundsMin, lineData->boundsMax)) {
+            return;
+        }
+        if (!lineData->indices.empty()) {
+            upload = uploadLines(*lineData, result);
+        }
+    } else if (auto *packedMesh = std::get_if<PackedMeshData>(&geometry.data)) {
+        std::span<const PackedVertex> vertices = packedMesh->vertices;
+        std::span<const glm::vec4> palette = packedMesh->palette;
+        std::span<const Cluster> clusters = packedMesh->clusters;
+        if (update({std::as_bytes(vertices), std::as_bytes(palette),
+                    std::as_bytes(clusters)},
+                   static_cast<uint32_t>(packedMesh->indices.size()), 1,
+                   packedMesh->boundsMin, packedMesh->boundsMax)) {
+            return;
+        }
+        if (!packedMesh->indices.empty()) {
+            upload = uploadMesh(*packedMesh, result);
+        }
+    } else if (auto *cached = std::get_if<CachedGeometry>(&geometry.data)) {
+        const GeometryBlocks &blocks = cached->blocks;
+        if (update({blocks.vertices, blocks.palette,
+                    std::as_bytes(blocks.clusters)},
+                   blocks.indexCount, blocks.instanceCount, blocks.boundsMin,
+                   blocks.boundsMax)) {
+            return;
+        }
+        if (!blocks.vertices.empty()) {
+            upload = uploadGeometry(blocks, result);
+        }
+    } else {
+        MeshData &meshData = std::get<MeshData>(geometry.data);
+        std::span<const Vertex> vertices = meshData.vertices;
+        std::span<const float> births = meshData.births;
+        std::span<const Cluster> clusters = meshData.clusters;
+        if (update({std::as_bytes(vertices), std::as_bytes(births),
+                    std::as_bytes(clusters)},
+                   static_cast<uint32_t>(meshData.indices.size()), 1,
+                   meshData.boundsMin, meshData.boundsMax)) {
+            return;
+        }
+        if (!meshData.indices.empty()) {
+            upload = uploadMesh(meshData, result);
+        }
+    }
+
+    queueMeshSwap(std::move(upload));
+    generationTimings.uploadMs = stopwatch.lap();
+}
+
+GeometryBlocks
+Renderer::describeGeometry(const GeneratedGeometry &geometry) const {
+    GeometryBlocks blocks{
+        .format = geometry.format,
+        .symbolCount = geometry.symbolCount,
+        .segmentCount = geometry.segmentCount,
+        .indexCount = 0,
+        .instanceCount = 1,
+        .boundsMin = {},
+        .boundsMax = {},
+        .vertices = {},
+        .palette = {},
+        .clusters = {},
+        .indices = {},
+    };
+
+    // the counts mirror the ones the matching upload function draws with
+    if (auto *cached = std::get_if<CachedGeometry>(&geometry.data)) {
+        blocks = cached->blocks;
+    } else if (auto *segmentData = std::get_if<SegmentData>(&geometry.data)) {
+        blocks.vertices = std::as_bytes(std::span(segmentData->segments));
+        blocks.palette = std::as_bytes(std::span(segmentData->palette));
+        blocks.instanceCount =
+            static_cast<uint32_t>(segmentData->segments.size());
+        if (geometry.format == VertexFormat::Tubes) {
+            blocks.indexCount = CYLINDER_SIDES * 6;
+        } else {
+            blocks.indexCount = unitCylinder.indexCount;
+            blocks.clusters = segmentData->clusters;
+        }
+        blocks.boundsMin = segmentData->boundsMin;
+        blocks.boundsMax = segmentData->boundsMax;
+    } else if (auto *lineData = std::get_if<LineData>(&geometry.data)) {
+        blocks.vertices = std::as_bytes(std::span(lineData->vertices));
+        blocks.palette = std::as_bytes(std::span(lineData->palette));
+        blocks.clusters = lineData->clusters;
+        blocks.indices = lineData->indices;
+        blocks.indexCount = static_cast<uint32_t>(lineData->indices.size());
+        blocks.boundsMin = lineData->boundsMin;
+        blocks.boundsMax = lineData->boundsMax;
+    } else if (auto *packedMesh = std::get_if<PackedMeshData>(&geometry.data)) {
+        blocks.vertices = std::as_bytes(std::span(packedMesh->vertices));
+        blocks.palette = std::as_bytes(std::span(packedMesh->palette));
+        blocks.clusters = packedMesh->clusters;
+        blocks.indices = packedMesh->indices;
+        blocks.indexCount = static_cast<uint32_t>(packedMesh->indices.size());
+        blocks.boundsMin = packedMesh->boundsMin;
+        blocks.boundsMax = packedMesh->boundsMax;
+    } else {
+        const MeshData &meshData = std::get<MeshData>(geometry.data);
+        blocks.vertices = std::as_bytes(std::span(meshData.vertices));
+        blocks.palette = std::as_bytes(std::span(meshData.births));
+        blocks.clusters = meshData.clusters;
+        blocks.indices = meshData.indices;
+        blocks.indexCount = static_cast<uint32_t>(meshData.indices.size());
+        blocks.boundsMin = meshData.boundsMin;
+        blocks.boundsMax = meshData.boundsMax;
+    }
+
+    return blocks;
+}
+
+bool Renderer::isGrowing() const {
+    return gallery.objectCount > 0 ? gallery.births
+                                   : lsystemMesh.birthAddress != 0;
+}
+
+void Renderer::requestGallery() {
+    cancelGallery();
+    galleryBuilding = true;
+
+    jobPool.submit([this, request = makeGalleryRequest(),
+                    stop = galleryStop.get_token()] {
+        std::unique_ptr<GeneratedGallery> result;
+        try {
+            result = buildGallery(request, stop);
+        } catch (...) {
+            logJobFailure("gallery", std::current_exception());
+            result = std::make_unique<GeneratedGallery>(GeneratedGallery{
+                .request = request.id, .meshes = {}, .failed = true});
+        }
+        if (result) {
+            publishGallery(std::move(result));
+        }
+    });
+}
+
+void Renderer::cancelGallery() {
+    galleryStop.request_stop();
+    galleryStop = std::stop_source();
+    galleryBuilding = false;
+    galleryRequest++;
+}
+
+Renderer::GalleryRequest Renderer::makeGalleryRequest() const {
+    return GalleryRequest{
+        .id = galleryRequest,
+        .lsystem = lsystem,
+        .turtleParameters = turtleParameters,
+        .generations = static_cast<uint32_t>(generations),
+        .variantCount = static_cast<uint32_t>(galleryVariants),
+        .angleSpread = galleryAngleSpread,
+        .animateGrowth = animateGrowth,
+    };
+}
+
+std::unique_ptr<Renderer::GeneratedGallery>
+Renderer::buildGallery(const GalleryRequest &request, std::stop_token stop) {
+    TraceZone zone("build gallery");
+    const LSystem &system = request.lsystem;
+
+    auto result = std::make_unique<GeneratedGallery>(
+        GeneratedGallery{.request = request.id, .meshes = {}, .failed = false});
+    result->meshes.reserve(request.variantCount);
+
+    // the variants only differ in their angle, so they share one derivation.
+    // growing ones need the births only the walk knows and take it each
+    DerivationArena arena;
+    ModuleString modules{};
+    if (!request.animateGrowth && request.variantCount > 0) {
+        modules = system.derive(request.generations, arena);
+    }
+
+    for (uint32_t i = 0; i < request.variantCount; i++) {
+        if (stop.stop_requested()) {
+            return nullptr;
+        }
+
+        TraceZone variantZone("interpret variant");
+        TurtleParameters parameters = request.turtleParameters;
+        if (request.variantCount > 1) {
+            const float offset =
+                2.0f * static_cast<float>(i) / (request.variantCount - 1) -
+                1.0f;
+            parameters.angle += offset * request.angleSpread;
+        }
+
+        Turtle turtle(parameters, system.getSymbols());
+        if (request.animateGrowth) {
+            system.expand(request.generations,
+                          [&](SymbolId symbol, const float *moduleParameters,
+                              float birth) {
+                              turtle.step(symbol, moduleParameters, birth);
+                          });
+        } else {
+            turtle.reserve(modules);
+            turtle.interpret(modules.symbols, modules.parameters.data());
+        }
+        result->meshes.push_back(turtle.finish());
+    }
+
+    return result;
+}
+
+void Renderer::publishGallery(std::unique_ptr<GeneratedGallery> result) {
+    // kept from the newer request like in publishGeometry
+    while (result) {
+        const uint64_t request = result->request;
+        std::unique_ptr<GeneratedGallery> previous(
+            publishedGallery.exchange(result.release()));
+        if (!previous || previous->request < request) {
+            return;
+        }
+        result = std::move(previous);
+    }
+}
+
+void Renderer::collectGallery() {
+    // shared with the upload, which stages the meshes over the next frames
+    std::shared_ptr<GeneratedGallery> result(
+        publishedGallery.exchange(nullptr));
+    if (!result || result->request != galleryRequest) {
+        return;
+    }
+
+    galleryBuilding = false;
+    if (!result->failed) {
+        uploadGallery(result->meshes, result);
+    }
+}
+
+std::optional<GPUMesh> Renderer::generateMeshOnGPU() {
+    // the gpu passes only move symbol ids around, parameters stay on the cpu.
+    // stochastic and conditional generations have no length known up front
+    // to size them by
+    if (lsystem.isParametric() || lsystem.isStochastic() ||
+        lsystem.hasParametricRules()) {
+        return std::nullopt;
+    }
+
+    const SymbolTable &symbols = lsystem.getSymbols();
+
+    // every generation length is known up front, so the whole derivation can
+    // be recorded into one submission without reading anything back
+    std::vector<uint64_t> lengths(generations + 1);
+    std::vector<uint64_t> histogram;
+    for (int i = 0; i <= generations; i++) {
+        histogram = lsystem.symbolHistogram(i);
+        lengths[i] = std::accumulate(histogram.begin(), histogram.end(),
+                                     uint64_t{0});
+    }
+
+    uint64_t segmentCount = 0;
+    uint64_t pushCount = 0;
+    uint64_t popCount = 0;
+    std::vector<uint32_t> commands(symbols.size());
+    for (size_t id = 0; id < symbols.size(); id++) {
+        TurtleCommand command = turtleCommandFor(symbols.getName(id));
+        commands[id] = static_cast<uint32_t>(command);
+        if (command == TurtleCommand::Forward) {
+            segmentCount += histogram[id];
+        } else if (command == TurtleCommand::Push) {
+            pushCount += histogram[id];
+        } else if (command == TurtleCommand::Pop) {
+            popCount += histogram[id];
+        }
+    }
+
+    const uint64_t maxLength =
+        *std::max_element(lengths.begin(), lengths.end());
+    if (maxLength > UINT32_MAX || segmentCount * TUBE_INDICES > UINT32_MAX) {
+        return std::nullopt;
+    }
+
+    symbolCount = lengths.back();
+    this->segmentCount = segmentCount;
+    if (segmentCount == 0) {
+        return GPUMesh{};
+    }
+
+    std::vector<uint32_t> productions;
+    std::vector<uint32_t> successors;
+    lsystem.exportProductions(productions, successors);
+
+    ModuleString axiom = lsystem.getAxiom();
+    std::vector<uint32_t> axiomSymbols(axiom.symbols.begin(),
+                                       axiom.symbols.end());
+
+    const VkBufferUsageFlags storageUsage =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    auto createTable = [&](std::span<const uint32_t> values) {
+        AllocatedBuffer buffer =
+            createBuffer(values.size_bytes(),
+                         storageUsage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                         VMA_MEMORY_USAGE_CPU_TO_GPU);
+        memcpy(buffer.allocationInfo.pMappedData, values.data(),
+               values.size_bytes());
+        vmaFlushAllocation(allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+        return buffer;
+    };
+
+    AllocatedBuffer productionTable = createTable(productions);
+    AllocatedBuffer successorTable = createTable(successors);
+    AllocatedBuffer commandTable = createTable(commands);
+    AllocatedBuffer axiomBuffer = createTable(axiomSymbols);
+
+    AllocatedBuffer symbolBuffers[2];
+    for (AllocatedBuffer &buffer : symbolBuffers) {
+        buffer = createBuffer(maxLength * sizeof(uint32_t),
+                              storageUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+
+    const uint64_t maxInputLength =
+        generations > 0 ? *std::max_element(lengths.begin(), lengths.end() - 1)
+                        : 0;
+    AllocatedBuffer offsets = createBuffer(
+        std::max<uint64_t>(maxInputLength, 1) * sizeof(uint32_t), storageUsage,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+
+    std::vector<AllocatedBuffer> blockSums;
+    for (uint64_t count = maxInputLength; count > 1 || blockSums.empty();) {
+        count = (count + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+        blockSums.push_back(createBuffer(std::max<uint64_t>(count, 1) *
+                                             sizeof(uint32_t),
+                                         storageUsage,
+                                         VMA_MEMORY_USAGE_GPU_ONLY));
+    }
+
+    const uint32_t finalLength = static_cast<uint32_t>(lengths.back());
+    const uint32_t chunkCount =
+        (finalLength + TURTLE_CHUNK_SIZE - 1) / TURTLE_CHUNK_SIZE;
+
+    AllocatedBuffer chunks =
+        createBuffer(chunkCount * TURTLE_CHUNK_STRIDE, storageUsage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    AllocatedBuffer openFrames = createBuffer(
+        chunkCount * TURTLE_MAX_LOCAL_DEPTH * TURTLE_TRANSFORM_STRIDE,
+        storageUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+    AllocatedBuffer popFrames =
+        createBuffer((popCount + 1) * TURTLE_TRANSFORM_STRIDE, storageUsage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    AllocatedBuffer stack =
+        createBuffer((pushCount + 1) * TURTLE_TRANSFORM_STRIDE, storageUsage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    AllocatedBuffer bounds = createBuffer(
+        2 * sizeof(glm::vec4), storageUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+    GPUMesh mesh{};
+    mesh.vertices = createBuffer(segmentCount * TUBE_VERTICES * sizeof(Vertex),
+                                 storageUsage, VMA_MEMORY_USAGE_GPU_ONLY);
+    mesh.indices = createBuffer(segmentCount * TUBE_INDICES * sizeof(uint32_t),
+                                storageUsage | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                VMA_MEMORY_USAGE_GPU_ONLY);
+    mesh.vertexBufferAddress = getBufferAddress(mesh.vertices);
+    mesh.indexCount = static_cast<uint32_t>(segmentCount * TUBE_INDICES);
+
+    immediateSubmit([&](VkCommandBuffer cmd) {
+        VkBufferCopy axiomCopy{.size = axiomSymbols.size() * sizeof(uint32_t)};
+        vkCmdCopyBuffer(cmd, axiomBuffer.buffer, symbolBuffers[0].buffer, 1,
+                        &axiomCopy);
+        vkCmdFillBuffer(cmd, bounds.buffer, 0, VK_WHOLE_SIZE, 0);
+        computeBarrier(cmd);
+
+        for (int i = 0; i < generations; i++) {
+            const uint32_t count = static_cast<uint32_t>(lengths[i]);
+
+            GPURewritePushConstants rewriteConstants{
+                .inputSymbols = getBufferAddress(symbolBuffers[i % 2]),
+                .outputSymbols = getBufferAddress(symbolBuffers[(i + 1) % 2]),
+                .offsets = getBufferAddress(offsets),
+                .productions = getBufferAddress(productionTable),
+                .successors = getBufferAddress(successorTable),
+                .count = count,
+                .groupCount = dispatchGroups(count, COMPUTE_GROUP_SIZE),
+            };
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              computePipelines.rewriteCount);
+            vkCmdPushConstants(cmd, computePipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(GPURewritePushConstants),
+                               &rewriteConstants);
+            vkCmdDispatch(cmd, rewriteConstants.groupCount, 1, 1);
+            computeBarrier(cmd);
+
+            recordScan(cmd, rewriteConstants.offsets, count, blockSums);
+
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              computePipelines.rewriteScatter);
+            vkCmdPushConstants(cmd, computePipelineLayout,
+                               VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(GPURewritePushConstants),
+                               &rewriteConstants);
+            vkCmdDispatch(cmd, rewriteConstants.groupCount, 1, 1);
+            computeBarrier(cmd);
+        }
+
+        GPUTurtlePushConstants turtleConstants{
+            .symbols = getBufferAddress(symbolBuffers[generations % 2]),
+            .commands = getBufferAddress(commandTable),
+            .chunks = getBufferAddress(chunks),
+            .openFrames = getBufferAddress(openFrames),
+            .popFrames = getBufferAddress(popFrames),
+            .stack = getBufferAddress(stack),
+            .vertexBuffer = mesh.vertexBufferAddress,
+            .indexBuffer = getBufferAddress(mesh.indices),
+            .bounds = getBufferAddress(bounds),
+            .symbolCount = finalLength,
+            .chunkCount = chunkCount,
+            .groupCount = dispatchGroups(chunkCount, TURTLE_GROUP_SIZE),
+            .stepLength = turtleParameters.stepLength,
+            .width = turtleParameters.width,
+            .angle = glm::radians(turtleParameters.angle),
+            .color = turtleParameters.color,
+        };
+
+        vkCmdPushConstants(cmd, computePipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(GPUTurtlePushConstants), &turtleConstants);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          computePipelines.turtleSummarize);
+        vkCmdDispatch(cmd, turtleConstants.groupCount, 1, 1);
+        computeBarrier(cmd);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          computePipelines.turtleCompose);
+        vkCmdDispatch(cmd, 1, 1, 1);
+        computeBarrier(cmd);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          computePipelines.turtleEmit);
+        vkCmdDispatch(cmd, turtleConstants.groupCount, 1, 1);
+        computeBarrier(cmd);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          computePipelines.turtleBounds);
+        vkCmdDispatch(cmd, 1, 1, 1);
+        computeBarrier(cmd);
+    });
+
+    vmaInvalidateAllocation(allocator, bounds.allocation, 0, VK_WHOLE_SIZE);
+    const glm::vec4 *meshBounds =
+        static_cast<const glm::vec4 *>(bounds.allocationInfo.pMappedData);
+    const bool overflowed = meshBounds[0].w != 0.0f;
+    mesh.boundsMin = glm::vec3(meshBounds[0]);
+    mesh.boundsMax = glm::vec3(meshBounds[1]);
+
+    for (const AllocatedBuffer &buffer :
+         {productionTable, successorTable, commandTable, axiomBuffer,
+          symbolBuffers[0], symbolBuffers[1], offsets, chunks, openFrames,
+          popFrames, stack, bounds}) {
+        destroyBuffer(buffer);
+    }
+    for (const AllocatedBuffer &buffer : blockSums) {
+        destroyBuffer(buffer);
+    }
+
+    if (overflowed) {
+        destroyMesh(mesh);
+        return std::nullopt;
+    }
+
+    return mesh;
+}
+
+void Renderer::recordScan(VkCommandBuffer cmd, VkDeviceAddress values,
+                          uint32_t count,
+                          std::span<AllocatedBuffer> blockSums) {
+    const uint32_t blockCount =
+        (count + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE;
+
+    GPUScanPushConstants scanConstants{
+        .values = values,
+        .blockSums = getBufferAddress(blockSums[0]),
+        .count = count,
+        .groupCount = std::clamp(blockCount, 1u, MAX_DISPATCH_GROUPS),
+    };
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      computePipelines.scanBlocks);
+    vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(GPUScanPushConstants), &scanConstants);
+    vkCmdDispatch(cmd, scanConstants.groupCount, 1, 1);
+    computeBarrier(cmd);
+
+    if (blockCount <= 1) {
+        return;
+    }
+
+    recordScan(cmd, scanConstants.blockSums, blockCount, blockSums.subspan(1));
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      computePipelines.scanAddBlocks);
+    vkCmdPushConstants(cmd, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(GPUScanPushConstants), &scanConstants);
+    vkCmdDispatch(cmd, scanConstants.groupCount, 1, 1);
+    computeBarrier(cmd);
 }
 } // namespace lsv
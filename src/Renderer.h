@@ -1,7 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
+#include <stop_token>
+#include <string>
+#include <variant>
 #include <vector>
 
 #include <vulkan/vulkan.h>
@@ -9,6 +19,12 @@
 #include <imgui.h>
 
 #include "RendererTypes.h"
+#include "LSystem.h"
+#include "Turtle.h"
+#include "PackedMesh.h"
+#include "Timings.h"
+#include "JobPool.h"
+#include "GeometryCache.h"
 
 namespace lsv {
 constexpr unsigned int FRAMES_IN_FLIGHT = 2;
@@ -21,8 +37,28 @@ public:
     void draw(ImDrawData *imGuiDrawData);
     void run();
 
+    // headless entry points used by the benchmark in place of run(),
+    // generate only returns once the mesh is uploaded and swapped in
+    void setLSystem(LSystem system, TurtleParameters parameters);
+    GenerationTimings generate(uint32_t generationCount, VertexFormat format);
+    FrameTimings drawOffscreen(uint32_t frameCount);
+    size_t getSymbolCount() const { return symbolCount; }
+    size_t getSegmentCount() const { return segmentCount; }
+    bool supportsFormat(VertexFormat format) const;
+    // bytes of vertex, palette and index data uploaded for the drawn mesh
+    uint64_t getMeshSize() const;
+    // draws variants of the grammar side by side in place of the mesh, their
+    // angles spread over the turtle angle +- angleSpread. only returns once
+    // the gallery is uploaded, no variants close it
+    void generateGallery(uint32_t generationCount, uint32_t variantCount,
+                         float angleSpread);
+
 private:
     const char *applicationName;
+    bool headless{false};
+    VkPresentModeKHR presentMode;
+    float maxFrameRate;
+    bool renderOnDemand;
     VkExtent2D windowExtent;
     int frameNumber{0};
     bool isInitialized{false};
@@ -40,12 +76,35 @@ private:
     VkPhysicalDevice physicalDevice;
     VkQueue graphicsQueue;
     uint32_t graphicsQueueFamily;
+    VkQueue transferQueue;
+    uint32_t transferQueueFamily;
     VkDevice device;
 
     VkFence immediateCmdFence;
     VkCommandPool immediateCmdPool;
     VkCommandBuffer immediateCmdBuffer;
 
+    struct PendingTransfer {
+        uint64_t timelineValue;
+        VkCommandBuffer commandBuffer;
+    };
+
+    // uploads signal uploadSemaphore with increasing values, transfers are
+    // recycled once the semaphore has passed their value
+    VkCommandPool transferCmdPool;
+    VkSemaphore uploadSemaphore;
+    uint64_t uploadTimelineValue{0};
+    std::vector<PendingTransfer> pendingTransfers;
+
+    // persistently mapped ring of fixed size chunks every upload is streamed
+    // through, a chunk is reused once the transfer that read it has completed.
+    // uploads are written at the cursor in the current chunk and only move on
+    // to the next one when it is full
+    AllocatedBuffer stagingRing;
+    std::vector<uint64_t> stagingChunkValues;
+    size_t stagingChunk{0};
+    size_t stagingChunkOffset{0};
+
     VkSwapchainKHR swapchain;
     VkExtent2D swapchainExtent;
     VkFormat swapchainFormat;
@@ -61,28 +120,233 @@ private:
 
     std::array<float, 4> clearColor{1.0f, 0.0f, 1.0f, 1.0f};
 
+    // nanoseconds per timestamp tick
+    float timestampPeriod;
+    TimingHistory cpuFrameTimes;
+    TimingHistory gpuSceneTimes;
+    TimingHistory gpuImguiTimes;
+    TimingHistory gpuFrameTimes;
+    GenerationTimings generationTimings;
+
+    // loaded at startup and written back on cleanup, the file name is keyed
+    // by device and driver so a driver update starts from an empty cache
+    VkPipelineCache pipelineCache;
+    std::string pipelineCachePath;
+
     VkPipelineLayout meshPipelineLayout;
     VkPipeline meshPipeline;
+    VkPipeline packedMeshPipeline;
+    VkPipeline segmentPipeline;
+    VkPipeline linePipeline;
+    VkPipeline galleryPipeline;
+    // tubes need VK_EXT_mesh_shader, the pipeline is only built with it
+    bool meshShaderSupported{false};
+    PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasks{nullptr};
+    VkPipelineLayout tubePipelineLayout{VK_NULL_HANDLE};
+    VkPipeline tubePipeline{VK_NULL_HANDLE};
+    // in pixels, wide lines are optional and otherwise limited to 1
+    float lineWidth{1.0f};
+    float maxLineWidth{1.0f};
+    VkPipeline cullPipeline;
+    VkPipeline depthReducePipeline;
+
+    VkPipelineLayout computePipelineLayout;
+    LSystemComputePipelines computePipelines;
+
+    LSystem lsystem;
+    DerivationCache derivationCache;
+    TurtleParameters turtleParameters;
+    int generations{5};
+    bool streamDerivation{true};
+    bool memoizeSubtrees{false};
+    bool generateOnGPU{false};
+    // full meshes are built with the birth of every segment and grown by
+    // vertMain up to growthTime, in generations, without touching the mesh
+    bool animateGrowth{false};
+    bool playGrowth{true};
+    float growthTime{0.0f};
+    // slow generations are written here and mapped back in when the same
+    // grammar, parameters and format are requested again
+    std::filesystem::path geometryCacheDirectory;
+    bool cacheGeometry{true};
+    VertexFormat meshFormat{VertexFormat::Full};
+    size_t symbolCount{0};
+    size_t segmentCount{0};
+
+    enum class GenerationStage : uint8_t {
+        Rewriting,
+        Interpreting,
+        Finishing,
+    };
+
+    // everything a generation job reads, copied so the ui can keep editing
+    // while it runs
+    struct GenerationRequest {
+        uint64_t id;
+        LSystem lsystem;
+        TurtleParameters turtleParameters;
+        uint32_t generations;
+        bool streamDerivation;
+        bool memoizeSubtrees;
+        // only honored for full meshes, which are then streamed
+        bool animateGrowth;
+        VertexFormat format;
+        bool updateInPlace;
+        // empty when geometry caching is off
+        std::filesystem::path cachePath;
+        uint64_t cacheKey;
+    };
+
+    // written by the job and polled by the ui, fraction is of the current
+    // stage
+    struct GenerationProgress {
+        std::atomic<GenerationStage> stage{GenerationStage::Rewriting};
+        // negative while the stage doesn't know how much is left
+        std::atomic<float> fraction{0.0f};
+    };
 
-    GPUMesh rectangle;
+    struct GeneratedGeometry {
+        uint64_t request;
+        bool updateInPlace;
+        VertexFormat format;
+        size_t symbolCount;
+        size_t segmentCount;
+        GenerationTimings timings;
+        std::variant<MeshData, PackedMeshData, SegmentData, LineData,
+                     CachedGeometry>
+            data;
+        // written there once uploaded, empty when the geometry was quick to
+        // build or came from the cache itself
+        std::filesystem::path cachePath;
+        uint64_t cacheKey;
+        // set instead of any data when the job threw, so the ui stops
+        // waiting for it
+        bool failed;
+    };
+
+    // full meshes of a grammar interpreted with different angles
+    struct GalleryRequest {
+        uint64_t id;
+        LSystem lsystem;
+        TurtleParameters turtleParameters;
+        uint32_t generations;
+        uint32_t variantCount;
+        float angleSpread;
+        bool animateGrowth;
+    };
+
+    struct GeneratedGallery {
+        uint64_t request;
+        std::vector<MeshData> meshes;
+        // like GeneratedGeometry::failed
+        bool failed;
+    };
+
+    // built on jobPool and published like generations
+    uint64_t galleryRequest{0};
+    std::stop_source galleryStop;
+    bool galleryBuilding{false};
+    std::atomic<GeneratedGallery *> publishedGallery{nullptr};
+    // replaces gallery once staged
+    std::optional<GalleryUpload> pendingGallery;
+
+    // id of the newest request, results of any other one are stale
+    uint64_t generationRequest{0};
+    std::stop_source generationStop;
+    // null when no generation is in flight
+    std::shared_ptr<GenerationProgress> generationProgress;
+    // the newest finished result not yet picked up by the render thread
+    std::atomic<GeneratedGeometry *> publishedGeometry{nullptr};
+    // generation jobs derive into derivationCache and keep the derivation
+    // locked while interpreting it
+    std::mutex derivationMutex;
+
+    GPUMesh lsystemMesh{};
+    // the mesh replacing lsystemMesh on the first frame after its upload,
+    // or after its first chunk for streamed meshes
+    std::optional<MeshUpload> pendingMesh;
+    // the chunks of pendingMesh, or of lsystemMesh once it was swapped in,
+    // that haven't arrived yet
+    std::optional<MeshStream> meshStream;
+    // newest upload any drawn buffer came from, frames wait on it
+    uint64_t drawUploadValue{0};
+    GPUMesh unitCylinder{};
+    // drawn in place of lsystemMesh while it holds any objects
+    GPUGallery gallery{};
+    int galleryVariants{16};
+    // degrees the angles of the variants spread either way of the turtle's
+    float galleryAngleSpread{30.0f};
+    glm::mat4 meshTransform{1.0f};
+    // turntable angle in radians, advanced once per drawn frame
+    float rotation{0.0f};
+    bool rotate{true};
 
+    // sized to the viewport with some slack, the scene only covers
+    // mainDrawExtent of it
     AllocatedImage mainDrawImage;
+    AllocatedImage depthImage;
+    // a GPUDepthPyramid sized for depthImage, rebuilt by every frame that
+    // culls the mesh and tested against by the next one
+    AllocatedBuffer depthPyramid;
+    // the clusters the pyramid was built for, 0 when it holds nothing usable
+    VkDeviceAddress depthPyramidClusters{0};
+    bool occlusionCulling{true};
     VkExtent2D mainDrawExtent;
     VkDescriptorSet imguiDescriptorSet;
+    // fraction of the viewport resolution the scene is drawn at, steered
+    // towards targetSceneMs of gpu scene time when dynamicResolution is on
+    float renderScale{1.0f};
+    bool dynamicResolution{false};
+    float targetSceneMs{8.0f};
 
     void initImmediateCommands();
     void immediateSubmit(std::function<void(VkCommandBuffer cmd)> &&function);
 
+    void initTransferCommands();
+    void destroyTransferCommands();
+    uint64_t
+    submitTransfer(std::function<void(VkCommandBuffer cmd)> &&function);
+    uint64_t stageCopies(std::span<const StagingCopy> copies);
+    // bytes stageCopies takes without waiting for a transfer
+    size_t stagingSpace();
+    // stages as much of queued as fits into budget and returns how much that
+    // was
+    size_t stageQueuedCopies(QueuedCopies &queued, size_t budget);
+    // stages the uploads in flight, as much as the ring takes without waiting
+    // and at most STREAM_BYTES_PER_FRAME. called once per frame
+    void stageUploads();
+    bool isUploadComplete(uint64_t timelineValue);
+    // every stage that reads uploaded buffers, a submission waits on the
+    // upload semaphore there
+    VkPipelineStageFlags uploadWaitStages() const;
+    void waitForTimeline(uint64_t timelineValue);
+    GPUMesh waitForUpload(const MeshUpload &upload);
+    void collectTransfers();
+
     void initImgui();
 
-    void createDrawImage();
+    void createDrawImage(VkExtent2D extent);
     void destroyDrawImage();
+    void destroyImage(const AllocatedImage &image);
+    // reallocates the draw image when it no longer fits the viewport and
+    // sets mainDrawExtent from the viewport and renderScale
+    void fitDrawImage(VkExtent2D viewportExtent);
+    void updateRenderScale();
+    // moves growthTime on by a frame while a growing mesh is played
+    void advanceGrowth();
 
-    void createSwapchain(uint32_t width, uint32_t height);
+    void createSwapchain(uint32_t width, uint32_t height,
+                         VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
     void rebuildSwapchain();
     void destroySwapchain();
 
+    // destroys through the deletion queue of the last submitted frame, which
+    // covers every submission that could still use the resource
+    void retire(std::function<void()> &&deletor);
+
     void initFrameDatas();
+    // false when the frame has no unread timestamps
+    bool readTimestamps(FrameData &frame);
     void destroyFrameDatas();
 
     VkImageSubresourceRange
@@ -90,17 +354,143 @@ private:
     void transitionImageLayout(VkCommandBuffer cmd, VkImage image,
                                VkImageLayout oldLayout,
                                VkImageLayout newLayout);
+    // the camera and turntable applied to the model transform
+    glm::mat4 sceneMatrix(const glm::mat4 &transform) const;
+    // fills the indirect draws of the clusters that are in view and weren't
+    // hidden in depthPyramid, recorded before the scene pass
+    void recordCulling(VkCommandBuffer cmd);
+    // clears mainDrawImage and draws the lsystem mesh into it, leaving it in
+    // the color attachment layout
+    void recordScene(VkCommandBuffer cmd);
+    // reduces the depth recordScene left into depthPyramid for the next
+    // frame to cull with, leaving depthImage in the transfer source layout
+    void recordDepthPyramid(VkCommandBuffer cmd);
     void blitImageToImage(VkCommandBuffer cmd, VkImage src, VkImage dst,
                           VkExtent2D srcSize, VkExtent2D dstSize);
 
-    std::vector<char> loadShader(const std::string &filePath);
+    void initPipelineCache(const char *directory);
+    void savePipelineCache();
+    VkShaderModule createShaderModule(std::span<const unsigned char> code);
     void buildPipelines();
+    void buildComputePipelines();
     void destroyPipelines();
 
+    // shared buffers are accessible from the graphics and the transfer queue
+    // without ownership transfers
     AllocatedBuffer createBuffer(size_t size, VkBufferUsageFlags usageFlags,
-                                 VmaMemoryUsage memoryUsage);
+                                 VmaMemoryUsage memoryUsage,
+                                 bool shared = false);
     void destroyBuffer(AllocatedBuffer buffer);
+    VkDeviceAddress getBufferAddress(const AllocatedBuffer &buffer);
+    void computeBarrier(VkCommandBuffer cmd);
+
+    // uploads go through the transfer queue and return right after
+    // submitting. given an owner that keeps the data alive, they are left
+    // to a stream that stages them a frame's budget at a time, and meshes are
+    // chunked with 16 bit indices when their clusters allow it
+    MeshUpload uploadMesh(const MeshData &meshData,
+                          std::shared_ptr<const void> owner = nullptr);
+    MeshUpload uploadMesh(const PackedMeshData &packedMesh,
+                          std::shared_ptr<const void> owner = nullptr);
+    MeshUpload uploadSegments(const SegmentData &segmentData,
+                              std::shared_ptr<const void> owner = nullptr);
+    MeshUpload uploadLines(const LineData &lineData,
+                           std::shared_ptr<const void> owner = nullptr);
+    // tubes only need the segments and palette, the task shader culls
+    // segments itself so no clusters are uploaded
+    MeshUpload uploadTubes(const SegmentData &segmentData,
+                           std::shared_ptr<const void> owner = nullptr);
+    // uploads straight from the blocks, which may point into a mapped file
+    MeshUpload uploadGeometry(const GeometryBlocks &blocks,
+                              std::shared_ptr<const void> owner = nullptr);
+    // clusters are appended to the vertex data. streamed meshes take their
+    // chunks from the first vertex part, which holds vertexStride sized
+    // vertices
+    MeshUpload
+    uploadMeshData(std::initializer_list<std::span<const std::byte>> vertexData,
+                   std::span<const uint32_t> indices,
+                   std::span<const Cluster> clusters, size_t vertexStride = 0,
+                   std::shared_ptr<const void> owner = nullptr);
+    void destroyMesh(GPUMesh mesh);
+    // only the buffers a vertices only upload has of its own
+    void destroyVertices(const GPUMesh &mesh);
+    // replaces the drawn gallery with the meshes packed into one pool once
+    // they are staged, which owner keeps them alive for. an empty span
+    // closes it right away
+    void uploadGallery(std::span<const MeshData> meshes,
+                       std::shared_ptr<const void> owner);
+    void destroyGallery(GPUGallery gallery);
+    // stages the next copies of pendingGallery and swaps it in once they are
+    // all staged, returns how much was staged
+    size_t streamGallery(size_t budget);
+    // waits for the copies of pendingGallery already staged and drops it
+    void cancelGalleryUpload();
+    // a vertices only upload of mesh with the same topology, laid out as
+    // uploadMeshData laid it out, chunks included
+    MeshUpload
+    updateVertices(const GPUMesh &mesh,
+                   std::initializer_list<std::span<const std::byte>> vertexData,
+                   std::shared_ptr<const void> owner);
+    // points the mesh at vertices, laid out like its current buffer
+    void rebaseVertices(GPUMesh &mesh, AllocatedBuffer vertices);
+    // rebases the mesh and retires its previous buffer once the frames
+    // drawing it and the transfer up to readValue are done with it
+    void replaceVertices(GPUMesh &mesh, AllocatedBuffer vertices,
+                         uint64_t readValue = 0);
+    void queueMeshSwap(MeshUpload upload);
+    // stages the next parts of meshStream and lets the chunks that arrived be
+    // drawn, returns how much was staged
+    size_t streamMesh(size_t budget);
+    // stages everything left and waits for all of it
+    void flushMeshStream();
+    // waits for the parts already staged and drops the rest
+    void cancelMeshStream();
+    size_t stageChunks(size_t budget);
+    void swapPendingMesh();
+    void waitForFrames();
+    void fitMeshTransform();
+
+    // regenerate derives and interprets, reinterpret reuses the cached
+    // derivation when only turtle parameters changed and recolor only
+    // rewrites the palette when the mesh has one
+    void regenerate();
+    void reinterpret();
+    void recolor();
+
+    // derivation, interpretation and packing run on jobPool, a new request
+    // cancels the one in flight
+    void requestGeneration(bool updateInPlace);
+    void cancelGeneration();
+    GenerationRequest makeGenerationRequest(bool updateInPlace) const;
+    // null when stopped, safe to call from any thread
+    std::unique_ptr<GeneratedGeometry>
+    buildGeometry(const GenerationRequest &request, std::stop_token stop,
+                  GenerationProgress &progress);
+    void publishGeometry(std::unique_ptr<GeneratedGeometry> geometry);
+    // swaps in the published result if it belongs to the newest request
+    void collectGeometry();
+    void applyGeometry(const std::shared_ptr<GeneratedGeometry> &geometry);
+    // views into the result in the layout of the geometry cache
+    GeometryBlocks describeGeometry(const GeneratedGeometry &geometry) const;
+    // true when the drawn gallery or mesh was built to grow
+    bool isGrowing() const;
+
+    void requestGallery();
+    void cancelGallery();
+    GalleryRequest makeGalleryRequest() const;
+    // null when stopped, safe to call from any thread
+    std::unique_ptr<GeneratedGallery>
+    buildGallery(const GalleryRequest &request, std::stop_token stop);
+    void publishGallery(std::unique_ptr<GeneratedGallery> result);
+    void collectGallery();
+
+    std::optional<GPUMesh> generateMeshOnGPU();
+    void recordScan(VkCommandBuffer cmd, VkDeviceAddress values,
+                    uint32_t count, std::span<AllocatedBuffer> blockSums);
 
-    GPUMesh uploadMesh(std::span<Vertex> vertices, std::span<uint32_t> indices);
+    // shared with parallelChunks, whose chunks the generation jobs split
+    // their work into. cleanup waits for the jobs before anything they touch
+    // is destroyed
+    JobPool &jobPool{JobPool::shared()};
 };
 } // namespace lsv
\ No newline at end of file
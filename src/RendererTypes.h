@@ -1,6 +1,14 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
 
@@ -9,6 +17,37 @@ struct RenderConfig {
     uint32_t width = 1280;
     uint32_t height = 720;
     const char *applicationName = "";
+    // no window, surface, swapchain or imgui, frames are only drawn into
+    // mainDrawImage through drawOffscreen
+    bool headless = false;
+    // where the pipeline cache is kept between runs, the per user data
+    // directory from SDL_GetPrefPath when null
+    const char *pipelineCacheDirectory = nullptr;
+    // same for generated meshes that took long enough to be worth keeping
+    const char *geometryCacheDirectory = nullptr;
+    // falls back to FIFO when the surface doesn't support it
+    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    // frames per second, 0 leaves the pace to the present mode
+    float maxFrameRate = 0.0f;
+    // block on events and only draw when something may have changed
+    bool renderOnDemand = false;
+};
+
+// runs the queued deletors newest first, resources are queued once nothing
+// recorded afterwards uses them and flushed once the gpu is done with them
+struct DeletionQueue {
+    std::vector<std::function<void()>> deletors;
+
+    void push(std::function<void()> &&deletor) {
+        deletors.push_back(std::move(deletor));
+    }
+
+    void flush() {
+        for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
+            (*it)();
+        }
+        deletors.clear();
+    }
 };
 
 struct FrameData {
@@ -17,6 +56,14 @@ struct FrameData {
 
     VkSemaphore imageAvailableSemaphore;
     VkFence renderFinishedFence;
+
+    // read back once renderFinishedFence has signaled, so never stalls
+    VkQueryPool timestampPool;
+    // set on submit and cleared once the timestamps were read
+    bool timestampsWritten;
+
+    // flushed once renderFinishedFence has signaled
+    DeletionQueue deletionQueue;
 };
 
 struct Vertex {
@@ -27,6 +74,73 @@ struct Vertex {
     glm::vec4 color;
 };
 
+// 16 byte alternative to Vertex, positions are quantized to the mesh bounds,
+// normals are octahedral encoded and colors index into a per mesh palette
+struct PackedVertex {
+    glm::u16vec3 position;
+    uint16_t paletteIndex;
+    glm::i16vec2 normal;
+    glm::u16vec2 uv;
+};
+
+static_assert(sizeof(PackedVertex) == 16);
+
+// one instance of the shared unit cylinder, the 32 byte alternative to the
+// TUBE_VERTICES vertices and TUBE_INDICES indices of an expanded tube
+struct Segment {
+    glm::vec3 start;
+    float radius;
+    glm::vec3 end;
+    uint32_t colorIndex;
+};
+
+static_assert(sizeof(Segment) == 32);
+
+// a point of a line strip, strips are separated by PRIMITIVE_RESTART_INDEX
+// and segments continuing the one before only add a single vertex
+struct LineVertex {
+    glm::vec3 position;
+    uint32_t colorIndex;
+};
+
+static_assert(sizeof(LineVertex) == 16);
+
+constexpr uint32_t PRIMITIVE_RESTART_INDEX = 0xffffffff;
+
+// a run of consecutive segments drawn by one indirect command, culled as a
+// whole against its bounding sphere
+struct Cluster {
+    glm::vec3 center;
+    float radius;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+static_assert(sizeof(Cluster) == 32);
+
+// a run of clusters whose vertices fit 16 bit indices relative to
+// firstVertex, uploaded on its own and drawn as soon as it arrives
+struct MeshChunk {
+    uint32_t firstCluster;
+    uint32_t clusterCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+};
+
+enum class VertexFormat {
+    Full,
+    Packed,
+    Segments,
+    Lines,
+    // segments expanded into cylinders by a task and mesh shader, only
+    // available with VK_EXT_mesh_shader
+    Tubes,
+};
+
 struct AllocatedImage {
     VkImage image;
     VkImageView imageView;
@@ -40,17 +154,288 @@ struct AllocatedBuffer {
     VkBuffer buffer;
     VmaAllocation allocation;
     VmaAllocationInfo allocationInfo;
+    // as asked for, the allocation may be larger
+    VkDeviceSize size;
 };
 
 struct GPUMesh {
+    // chunked meshes keep only what follows their vertices here, the
+    // vertices themselves are in chunkVertices
     AllocatedBuffer vertices;
     AllocatedBuffer indices;
     VkDeviceAddress vertexBufferAddress;
+    VkDeviceSize vertexDataSize;
+    VertexFormat vertexFormat;
+    // packed, segment and line meshes store their palette behind the
+    // vertices
+    VkDeviceAddress paletteAddress;
+    uint32_t paletteCount;
+    // full meshes built to grow store the birth of every segment there
+    // instead, 0 when they don't
+    VkDeviceAddress birthAddress;
+    // segment meshes hold no indices of their own and draw indexCount indices
+    // of the unit cylinder once per segment, tube meshes generate as many per
+    // segment in the mesh shader
+    uint32_t indexCount;
+    uint32_t instanceCount = 1;
+    // only line meshes count their vertices, the info panel shows them in
+    // place of triangles
+    uint64_t lineVertexCount;
+    // chunked meshes store 16 bit indices relative to the base vertex of
+    // their chunk
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // clusters are stored behind the palette, the cull pass writes the draws
+    // of the visible ones to drawCommands and their number to drawCount.
+    // meshes without clusters are drawn directly
+    VkDeviceAddress clusterAddress;
+    uint32_t clusterCount;
+    // clusters whose chunk has arrived, lower than clusterCount while the
+    // mesh is still being streamed in
+    uint32_t readyClusterCount;
+    // one GPUClusterVertices per cluster behind the clusters, 0 when the mesh
+    // isn't chunked
+    VkDeviceAddress clusterVerticesAddress;
+    AllocatedBuffer drawCommands;
+    AllocatedBuffer drawCount;
+    // the vertices of every chunk in a buffer of their own, so no single
+    // allocation has to hold all of them. chunk i is in chunkVertices[i]
+    std::vector<AllocatedBuffer> chunkVertices;
+    std::vector<MeshChunk> chunks;
+    size_t vertexStride;
+};
+
+// where the vertices of a cluster of a chunked mesh are, its draw passes the
+// index of the cluster as firstInstance to find them. the indices of the
+// cluster count from firstVertex of the whole mesh, births are kept for the
+// whole mesh and indexed from there
+struct GPUClusterVertices {
+    VkDeviceAddress vertices;
+    uint32_t firstVertex;
+    uint32_t padding;
+};
+
+static_assert(sizeof(GPUClusterVertices) == 16);
+
+// meshes drawn side by side by a single indirect draw. their vertices, each
+// followed by its births, are packed into one buffer and their indices into
+// another, the objects behind the last mesh place each of them and the draw
+// command of object i reads it through its firstInstance
+struct GPUGallery {
+    AllocatedBuffer vertices;
+    AllocatedBuffer indices;
+    AllocatedBuffer drawCommands;
+    VkDeviceAddress objectAddress;
+    uint32_t objectCount;
+    // set when any mesh was built to grow, the objects of the others have no
+    // births and are drawn fully grown
+    bool births;
+};
+
+struct StagingCopy {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    std::span<const std::byte> data;
+};
+
+// copies staged a frame's budget at a time, whoever queues them keeps the
+// data alive until they are
+struct QueuedCopies {
+    std::vector<StagingCopy> copies;
+    // the copy staging continues with and how much of it is staged already
+    size_t nextCopy{0};
+    size_t copyOffset{0};
+    // upload timeline value of the newest transfer reading them
+    uint64_t timelineValue{0};
+};
+
+// the parts of a mesh that are still to be staged, a few chunks per frame so
+// the first chunks are drawn long before a large mesh has arrived. meshes
+// that aren't chunked only have copies
+struct MeshStream {
+    // keeps the data the spans point into alive
+    std::shared_ptr<const void> owner;
+    // everything but the chunks, staged before them
+    QueuedCopies copies;
+    // the cluster vertices of chunked meshes, copies points into them
+    std::vector<GPUClusterVertices> clusterVertices;
+    std::span<const std::byte> vertices;
+    size_t vertexStride;
+    std::span<const uint32_t> indices;
+    // one per chunk
+    std::vector<VkBuffer> vertexBuffers;
+    VkBuffer indexBuffer;
+    std::vector<MeshChunk> chunks;
+    // upload timeline value of every staged chunk
+    std::vector<uint64_t> chunkValues;
+    size_t readyChunks{0};
+    // indices of the chunks staged together, rebased to 16 bits
+    std::vector<uint16_t> localIndices;
+};
+
+// a mesh whose copy may still be in flight on the transfer queue, it can be
+// drawn once the upload semaphore reaches timelineValue. streamed meshes
+// leave their copies to the stream and are only drawn once those are staged
+struct MeshUpload {
+    GPUMesh mesh;
+    uint64_t timelineValue;
+    std::optional<MeshStream> stream;
+    // set when only the vertex buffers are new and everything else is shared
+    // with the mesh it replaces
+    bool verticesOnly;
 };
 
 struct GPUDrawPushConstants {
     glm::mat4 worldMatrix;
     VkDeviceAddress vertexBuffer;
+    // segments born before growthTime - 1 are fully grown, the ones born
+    // after it aren't drawn. null to draw the whole mesh
+    VkDeviceAddress births;
+    // GPUMesh::clusterVerticesAddress, vertexBuffer is ignored when set
+    VkDeviceAddress clusterVertices;
+    float growthTime;
+};
+
+// one mesh of a gallery, the vertex indices of its draw start at 0
+struct GPUGalleryObject {
+    glm::mat4 transform;
+    VkDeviceAddress vertexBuffer;
+    // null when the mesh doesn't grow
+    VkDeviceAddress births;
+};
+
+static_assert(sizeof(GPUGalleryObject) == 80);
+
+// a gallery drawn in place of the current one once all its copies are staged
+struct GalleryUpload {
+    GPUGallery gallery;
+    // keeps the meshes alive
+    std::shared_ptr<const void> owner;
+    std::vector<GPUGalleryObject> objects;
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    // copies points into the vectors above and the meshes
+    QueuedCopies copies;
+};
+
+struct GPUGalleryDrawPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress objects;
+    float growthTime;
+};
+
+struct GPUPackedDrawPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress palette;
+    glm::vec4 boundsMin;
+    glm::vec4 boundsExtent;
+    // the same as for GPUDrawPushConstants
+    VkDeviceAddress clusterVertices;
+};
+
+struct GPUSegmentDrawPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress segments;
+    VkDeviceAddress palette;
+};
+
+struct GPULineDrawPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress palette;
+};
+
+struct GPUTubeDrawPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress segments;
+    VkDeviceAddress palette;
+    uint32_t segmentCount;
+    uint32_t groupCountX;
+};
+
+struct GPUCullPushConstants {
+    glm::mat4 worldMatrix;
+    VkDeviceAddress clusters;
+    VkDeviceAddress clusterVertices;
+    VkDeviceAddress drawCommands;
+    VkDeviceAddress drawCount;
+    // 0 when the previous frame left no depth to test against
+    VkDeviceAddress depthPyramid;
+    VkDeviceAddress depthLevels;
+    uint32_t clusterCount;
+    uint32_t groupCount;
+};
+
+// the depth the last frame drew the culled mesh with, followed by its levels.
+// the first is the depth buffer itself, every one after it halves the one
+// before and keeps the farthest depth of the texels it covers. the next cull
+// pass projects the clusters with the matrix of that frame to look them up
+struct GPUDepthPyramid {
+    glm::mat4 worldMatrix;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t padding;
+};
+
+static_assert(sizeof(GPUDepthPyramid) == 80);
+
+struct GPUDepthReducePushConstants {
+    VkDeviceAddress source;
+    VkDeviceAddress destination;
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct GPURewritePushConstants {
+    VkDeviceAddress inputSymbols;
+    VkDeviceAddress outputSymbols;
+    VkDeviceAddress offsets;
+    VkDeviceAddress productions;
+    VkDeviceAddress successors;
+    uint32_t count;
+    uint32_t groupCount;
+};
+
+struct GPUScanPushConstants {
+    VkDeviceAddress values;
+    VkDeviceAddress blockSums;
+    uint32_t count;
+    uint32_t groupCount;
+};
+
+struct GPUTurtlePushConstants {
+    VkDeviceAddress symbols;
+    VkDeviceAddress commands;
+    VkDeviceAddress chunks;
+    VkDeviceAddress openFrames;
+    VkDeviceAddress popFrames;
+    VkDeviceAddress stack;
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress indexBuffer;
+    VkDeviceAddress bounds;
+    uint32_t symbolCount;
+    uint32_t chunkCount;
+    uint32_t groupCount;
+    float stepLength;
+    float width;
+    float angle;
+    glm::vec4 color;
+};
+
+struct LSystemComputePipelines {
+    VkPipeline rewriteCount;
+    VkPipeline rewriteScatter;
+    VkPipeline scanBlocks;
+    VkPipeline scanAddBlocks;
+    VkPipeline turtleSummarize;
+    VkPipeline turtleCompose;
+    VkPipeline turtleEmit;
+    VkPipeline turtleBounds;
 };
 
 } // namespace lsv
\ No newline at end of file
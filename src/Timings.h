@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+namespace lsv {
+// the most recent samples in a fixed window, laid out the way
+// ImGui::PlotLines expects a ring buffer
+struct TimingHistory {
+    static constexpr int SIZE = 120;
+
+    std::array<float, SIZE> samples{};
+    int offset{0};
+
+    void push(float sample) {
+        samples[offset] = sample;
+        offset = (offset + 1) % SIZE;
+    }
+
+    float latest() const { return samples[(offset + SIZE - 1) % SIZE]; }
+};
+
+// cpu side cost of the last regeneration, streaming derivations rewrite
+// while interpreting so their rewrite time is folded into interpretation
+struct GenerationTimings {
+    double rewriteMs{0.0};
+    double interpretMs{0.0};
+    double uploadMs{0.0};
+};
+
+// per frame averages over a batch of offscreen frames
+struct FrameTimings {
+    double cpuMs{0.0};
+    double gpuMs{0.0};
+};
+
+class Stopwatch {
+public:
+    Stopwatch() : last(std::chrono::steady_clock::now()) {}
+
+    // milliseconds since construction or the previous lap
+    double lap() {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed =
+            std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last;
+};
+} // namespace lsv
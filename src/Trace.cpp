@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <spdlog/fmt/ranges.h>
+#include <spdlog/spdlog.h>
+
+#include "Trace.h"
+
+namespace lsv {
+namespace {
+// zones kept per thread, some seconds of frames at a few dozen zones each
+constexpr size_t TRACE_RING_SIZE = 1 << 14;
+
+struct TraceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// relaxed atomics so the ring may be read while it is written, which costs
+// nothing over plain stores
+struct TraceSlot {
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> duration;
+};
+
+// only written by the thread owning it, zone i of the thread lives in
+// slots[i % TRACE_RING_SIZE] and written counts every zone ever recorded
+struct TraceRing {
+    std::array<TraceSlot, TRACE_RING_SIZE> slots{};
+    std::atomic<uint64_t> written{0};
+    uint32_t thread{0};
+};
+
+// rings are never freed, so the zones of threads that have exited can still
+// be exported. their rings go to the next thread recording a zone
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    std::vector<TraceRing *> freeRings;
+};
+
+TraceRegistry &registry() {
+    static TraceRegistry traces;
+    return traces;
+}
+
+// nanoseconds since the first zone of the process
+uint64_t traceClock() {
+    static const auto origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+}
+
+struct ThreadRing {
+    TraceRing *ring;
+
+    ThreadRing() {
+        TraceRegistry &traces = registry();
+        std::lock_guard lock(traces.mutex);
+        if (!traces.freeRings.empty()) {
+            ring = traces.freeRings.back();
+            traces.freeRings.pop_back();
+            return;
+        }
+        traces.rings.push_back(std::make_unique<TraceRing>());
+        ring = traces.rings.back().get();
+        ring->thread = static_cast<uint32_t>(traces.rings.size());
+    }
+
+    ~ThreadRing() {
+        TraceRegistry &traces = registry();
+        std::lock_guard lock(traces.mutex);
+        traces.freeRings.push_back(ring);
+    }
+};
+
+thread_local ThreadRing threadRing;
+} // namespace
+
+TraceZone::TraceZone(const char *name) : name(name), start(traceClock()) {}
+
+TraceZone::~TraceZone() {
+    const uint64_t duration = traceClock() - start;
+    TraceRing &ring = *threadRing.ring;
+    const uint64_t index = ring.written.load(std::memory_order_relaxed);
+    TraceSlot &slot = ring.slots[index % TRACE_RING_SIZE];
+    // a reader that sees any of the stores below also sees the count of the
+    // zones before, and so knows the slot is being reused
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+bool writeTrace(const std::filesystem::path &path) {
+    std::vector<std::string> events;
+    {
+        TraceRegistry &traces = registry();
+        std::lock_guard lock(traces.mutex);
+        std::vector<TraceEvent> zones;
+        for (const std::unique_ptr<TraceRing> &ring : traces.rings) {
+            const uint64_t written =
+                ring->written.load(std::memory_order_acquire);
+            const uint64_t first =
+                written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+            zones.clear();
+            for (uint64_t i = first; i < written; i++) {
+                const TraceSlot &slot = ring->slots[i % TRACE_RING_SIZE];
+                zones.push_back(TraceEvent{
+                    .name = slot.name.load(std::memory_order_relaxed),
+                    .start = slot.start.load(std::memory_order_relaxed),
+                    .duration = slot.duration.load(std::memory_order_relaxed),
+                });
+            }
+
+            // the thread keeps recording while its ring is copied, slots it
+            // may have started to reuse meanwhile are dropped
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t rewritten =
+                ring->written.load(std::memory_order_relaxed);
+            const uint64_t valid = rewritten + 1 > TRACE_RING_SIZE
+                                       ? rewritten + 1 - TRACE_RING_SIZE
+                                       : 0;
+
+            for (uint64_t i = std::max(first, valid); i < written; i++) {
+                const TraceEvent &zone = zones[i - first];
+                events.push_back(fmt::format(
+                    "{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":0,\"tid\":{},"
+                    "\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                    zone.name, ring->thread, zone.start * 1e-3,
+                    zone.duration * 1e-3));
+            }
+        }
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    file << fmt::format(
+        "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n{}\n]}}\n",
+        fmt::join(events, ",\n"));
+    file.close();
+    return static_cast<bool>(file);
+}
+} // namespace lsv
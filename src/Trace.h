@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace lsv {
+// records how long the enclosing scope took into a ring owned by the calling
+// thread. recording never locks or allocates once the thread has its ring,
+// and a full ring overwrites its oldest zones. the name has to outlive the
+// trace, which string literals do
+class TraceZone {
+public:
+    explicit TraceZone(const char *name);
+    ~TraceZone();
+
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+// writes the zones still held by the rings of all threads as chrome trace
+// event json, which chrome://tracing and perfetto open. returns false when
+// the file couldn't be written
+bool writeTrace(const std::filesystem::path &path);
+} // namespace lsv
@@ -0,0 +1,1372 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "Parallel.h"
+#include "Trace.h"
+#include "Turtle.h"
+
+namespace lsv {
+namespace {
+// the turtle grows along +y in its local frame, with +z as its up vector so
+// that 2D grammars end up in the xy plane facing the camera
+constexpr glm::vec3 HEADING{0.0f, 1.0f, 0.0f};
+constexpr glm::vec3 LEFT{-1.0f, 0.0f, 0.0f};
+constexpr glm::vec3 UP{0.0f, 0.0f, 1.0f};
+
+// subtrees up to this size are copied into their parents, larger ones are
+// referenced so the cached geometry stays proportional to unique subtrees
+constexpr uint64_t MAX_FLATTENED_SEGMENTS = 4096;
+
+// segments per cluster, small enough to cull a single branch while keeping
+// the number of indirect draws low
+constexpr size_t CLUSTER_SEGMENTS = 64;
+
+// ! without a parameter narrows the width by this, so branches get thinner
+// the deeper they sit. these three are mirrored in lsystem.slang
+constexpr float WIDTH_FACTOR = 0.7f;
+
+// every ' turns the hue of the turtle color this far
+constexpr float COLOR_HUE_STEP = glm::pi<float>() / 6.0f;
+// '(c) beyond this picks this, and ' stays there
+constexpr uint32_t MAX_COLOR_INDEX = 255;
+
+// the second column of the rotation matrix of a unit quaternion, which is
+// orientation * HEADING with all the terms that vanish for it left out
+glm::vec3 headingOf(glm::quat orientation) {
+    const glm::quat &q = orientation;
+    return glm::vec3(2.0f * (q.x * q.y - q.w * q.z),
+                     1.0f - 2.0f * (q.x * q.x + q.z * q.z),
+                     2.0f * (q.y * q.z + q.w * q.x));
+}
+
+// the turn a rotation command makes by angle, the identity for the others
+glm::quat rotationFor(TurtleCommand command, float angle) {
+    switch (command) {
+    case TurtleCommand::YawLeft:
+        return glm::angleAxis(angle, UP);
+    case TurtleCommand::YawRight:
+        return glm::angleAxis(-angle, UP);
+    case TurtleCommand::PitchDown:
+        return glm::angleAxis(angle, LEFT);
+    case TurtleCommand::PitchUp:
+        return glm::angleAxis(-angle, LEFT);
+    case TurtleCommand::RollLeft:
+        return glm::angleAxis(angle, HEADING);
+    case TurtleCommand::RollRight:
+        return glm::angleAxis(-angle, HEADING);
+    case TurtleCommand::TurnAround:
+        return glm::angleAxis(glm::pi<float>(), UP);
+    default:
+        return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    }
+}
+
+// '(c) rounds down, negative and nan parameters pick the first color
+uint32_t colorIndexFor(float parameter) {
+    return parameter >= 1.0f
+               ? static_cast<uint32_t>(
+                     std::min(parameter, static_cast<float>(MAX_COLOR_INDEX)))
+               : 0;
+}
+
+// rotates the color around the grey diagonal of the rgb cube, which turns
+// its hue and keeps its brightness
+glm::vec4 turnHue(glm::vec4 color, float angle) {
+    const glm::vec3 axis(0.57735027f);
+    const glm::vec3 rgb(color);
+    const float cosine = std::cos(angle);
+    const glm::vec3 turned =
+        rgb * cosine + glm::cross(axis, rgb) * std::sin(angle) +
+        axis * (glm::dot(axis, rgb) * (1.0f - cosine));
+    return glm::vec4(glm::clamp(turned, 0.0f, 1.0f), color.a);
+}
+
+// a sphere around the box of the points, not minimal but cheap and tight
+// enough for the elongated runs of segments a cluster usually holds
+template <typename F>
+glm::vec4 boundingSphere(size_t count, F &&pointAt, float padding) {
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < count; i++) {
+        boundsMin = glm::min(boundsMin, pointAt(i));
+        boundsMax = glm::max(boundsMax, pointAt(i));
+    }
+
+    const glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+    float radius = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        radius = std::max(radius, glm::length(pointAt(i) - center));
+    }
+
+    return glm::vec4(center, radius + padding);
+}
+
+// appends parts of the given sizes to target, with write(part, out) filling
+// in each part concurrently. returns where every part starts
+template <typename T, typename F>
+std::vector<size_t> appendParts(std::vector<T> &target,
+                                std::span<const size_t> sizes, F &&write) {
+    std::vector<size_t> offsets(sizes.size() + 1, target.size());
+    for (size_t part = 0; part < sizes.size(); part++) {
+        offsets[part + 1] = offsets[part] + sizes[part];
+    }
+    target.resize(offsets.back());
+    parallelChunks(sizes.size(), [&](size_t part) {
+        write(part, target.data() + offsets[part]);
+    });
+    return offsets;
+}
+
+// the directions of the sides of a tube as cosine and sine, at the angles
+// of buildUnitCylinder
+const std::array<glm::vec2, TUBE_SIDES> TUBE_RING = [] {
+    std::array<glm::vec2, TUBE_SIDES> ring;
+    for (uint32_t side = 0; side < TUBE_SIDES; side++) {
+        const float angle = glm::two_pi<float>() * side / TUBE_SIDES;
+        ring[side] = glm::vec2(std::cos(angle), std::sin(angle));
+    }
+    return ring;
+}();
+
+// the indices of a tube relative to its first vertex, wound like
+// buildUnitCylinder
+constexpr std::array<uint32_t, TUBE_INDICES> TUBE_QUADS = [] {
+    std::array<uint32_t, TUBE_INDICES> quads{};
+    for (uint32_t side = 0; side < TUBE_SIDES; side++) {
+        const uint32_t next = (side + 1) % TUBE_SIDES;
+        const uint32_t quad[6] = {side, next, side + TUBE_SIDES,
+                                  side + TUBE_SIDES, next, next + TUBE_SIDES};
+        std::copy(quad, quad + 6, quads.begin() + 6 * side);
+    }
+    return quads;
+}();
+
+// the box around every segment of a batch
+template <size_t N> struct BatchBounds {
+    std::array<float, N> lowX, lowY, lowZ;
+    std::array<float, N> highX, highY, highZ;
+};
+
+// folding the upper half of the boxes onto the lower one keeps every step a
+// loop over independent segments, a plain reduction would compare one
+// segment at a time
+template <size_t N>
+void foldBounds(BatchBounds<N> &bounds, size_t count, glm::vec3 &boundsMin,
+                glm::vec3 &boundsMax) {
+    for (size_t half = N / 2; half > 0; half /= 2) {
+        const size_t end = count > half ? std::min(half, count - half) : 0;
+        for (size_t i = 0; i < end; i++) {
+            bounds.lowX[i] = std::min(bounds.lowX[i], bounds.lowX[i + half]);
+            bounds.lowY[i] = std::min(bounds.lowY[i], bounds.lowY[i + half]);
+            bounds.lowZ[i] = std::min(bounds.lowZ[i], bounds.lowZ[i + half]);
+            bounds.highX[i] =
+                std::max(bounds.highX[i], bounds.highX[i + half]);
+            bounds.highY[i] =
+                std::max(bounds.highY[i], bounds.highY[i + half]);
+            bounds.highZ[i] =
+                std::max(bounds.highZ[i], bounds.highZ[i + half]);
+        }
+    }
+    boundsMin = glm::min(
+        boundsMin, glm::vec3(bounds.lowX[0], bounds.lowY[0], bounds.lowZ[0]));
+    boundsMax = glm::max(boundsMax, glm::vec3(bounds.highX[0], bounds.highY[0],
+                                              bounds.highZ[0]));
+}
+} // namespace
+
+TurtleCommand turtleCommandFor(char symbol) {
+    switch (symbol) {
+    case 'F':
+    case 'G':
+        return TurtleCommand::Forward;
+    case 'f':
+        return TurtleCommand::Move;
+    case '+':
+        return TurtleCommand::YawLeft;
+    case '-':
+        return TurtleCommand::YawRight;
+    case '&':
+        return TurtleCommand::PitchDown;
+    case '^':
+        return TurtleCommand::PitchUp;
+    case '\\':
+        return TurtleCommand::RollLeft;
+    case '/':
+        return TurtleCommand::RollRight;
+    case '|':
+        return TurtleCommand::TurnAround;
+    case '[':
+        return TurtleCommand::Push;
+    case ']':
+        return TurtleCommand::Pop;
+    case '!':
+        return TurtleCommand::DecrementWidth;
+    case '\'':
+        return TurtleCommand::IncrementColor;
+    default:
+        return TurtleCommand::None;
+    }
+}
+
+MeshData buildUnitCylinder(uint32_t sides) {
+    MeshData cylinder;
+    cylinder.boundsMin = glm::vec3(-1.0f, 0.0f, -1.0f);
+    cylinder.boundsMax = glm::vec3(1.0f, 1.0f, 1.0f);
+
+    for (uint32_t ring = 0; ring < 2; ring++) {
+        for (uint32_t side = 0; side < sides; side++) {
+            const float angle = glm::two_pi<float>() * side / sides;
+            const glm::vec3 normal(std::cos(angle), 0.0f, std::sin(angle));
+            cylinder.vertices.push_back(Vertex{
+                .position = normal + glm::vec3(0.0f, ring, 0.0f),
+                .uvX = static_cast<float>(side) / sides,
+                .normal = normal,
+                .uvY = static_cast<float>(ring),
+                .color = glm::vec4(1.0f),
+            });
+        }
+    }
+
+    for (uint32_t side = 0; side < sides; side++) {
+        const uint32_t next = (side + 1) % sides;
+        const uint32_t quad[6] = {side,         next, side + sides,
+                                  side + sides, next, next + sides};
+        cylinder.indices.insert(cylinder.indices.end(), quad, quad + 6);
+    }
+
+    return cylinder;
+}
+
+Turtle::Turtle(TurtleParameters parameters, const SymbolTable &symbols,
+               TurtleOutput output)
+    : parameters(parameters), output(output), commands(symbols.size()),
+      arities(symbols.size()), rotations(symbols.size()),
+      state{.position = glm::vec3(0.0f),
+            .orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+            .width = parameters.width,
+            .colorIndex = 0} {
+    for (size_t id = 0; id < symbols.size(); id++) {
+        commands[id] = turtleCommandFor(symbols.getName(id));
+        arities[id] = symbols.getArity(id);
+        rotations[id] =
+            rotationFor(commands[id], glm::radians(parameters.angle));
+    }
+
+    initializeOutputs();
+}
+
+Turtle::Turtle(const Turtle &configuration, State start,
+               std::span<const State> incoming, size_t maxDepth)
+    : parameters(configuration.parameters), output(configuration.output),
+      commands(configuration.commands), arities(configuration.arities),
+      rotations(configuration.rotations), state(start),
+      stack(incoming.begin(), incoming.end()), depth(incoming.size()),
+      batchDepth(depth) {
+    stack.resize(depth + maxDepth);
+    stackSegments.resize(stack.size(), SegmentBatch::OWN_START);
+    initializeOutputs();
+}
+
+void Turtle::initializeOutputs() {
+    mesh.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    mesh.boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    segments.boundsMin = mesh.boundsMin;
+    segments.boundsMax = mesh.boundsMax;
+    lines.boundsMin = mesh.boundsMin;
+    lines.boundsMax = mesh.boundsMax;
+    palette.push_back(parameters.color);
+}
+
+void Turtle::reserve(const ModuleString &modules) {
+    // one pass for both, the counts of a stochastic derivation are only
+    // known once it is built
+    std::vector<uint64_t> histogram(commands.size(), 0);
+    size_t currentDepth = 0;
+    size_t maxDepth = 0;
+    for (SymbolId symbol : modules.symbols) {
+        histogram[symbol]++;
+        if (commands[symbol] == TurtleCommand::Push) {
+            maxDepth = std::max(maxDepth, ++currentDepth);
+        } else if (commands[symbol] == TurtleCommand::Pop &&
+                   currentDepth > 0) {
+            currentDepth--;
+        }
+    }
+
+    reserve(histogram);
+    stack.resize(std::max(stack.size(), maxDepth));
+    stackSegments.resize(stack.size(), SegmentBatch::OWN_START);
+}
+
+void Turtle::reserve(std::span<const uint64_t> histogram,
+                     uint64_t maxSegments) {
+    uint64_t forwardCount = 0;
+    for (size_t id = 0; id < commands.size(); id++) {
+        if (commands[id] == TurtleCommand::Forward) {
+            forwardCount += histogram[id];
+        }
+    }
+    reserveSegments(std::min(forwardCount, maxSegments));
+}
+
+void Turtle::reserveSegments(uint64_t forwardCount) {
+    // lines break their strips at most once per segment, the untouched part
+    // of the reservation is never paged in
+    switch (output) {
+    case TurtleOutput::Lines:
+        lines.vertices.reserve(2 * forwardCount);
+        lines.indices.reserve(3 * forwardCount);
+        break;
+    case TurtleOutput::Segments:
+        segments.segments.reserve(forwardCount);
+        break;
+    case TurtleOutput::Mesh:
+        mesh.vertices.reserve(TUBE_VERTICES * forwardCount);
+        mesh.indices.reserve(TUBE_INDICES * forwardCount);
+        break;
+    }
+}
+
+// only turns, widths and colors are applied right away, positions are left
+// to flushSegments which works them out for a whole batch of segments
+void Turtle::step(SymbolId symbol, const float *moduleParameters) {
+    switch (commands[symbol]) {
+    case TurtleCommand::Forward:
+        stateSegment = appendSegment(state, stateSegment,
+                                     arities[symbol] > 0
+                                         ? moduleParameters[0]
+                                         : parameters.stepLength);
+        if (pending.count == SegmentBatch::SIZE) {
+            flushSegments();
+        }
+        break;
+    case TurtleCommand::Move:
+        // rare enough to move from a current position instead of batching
+        // segments that aren't drawn
+        flushSegments();
+        move(state, symbol, moduleParameters);
+        break;
+    case TurtleCommand::Push:
+        if (depth == stack.size()) {
+            stack.resize(std::max<size_t>(2 * depth, 16));
+            stackSegments.resize(stack.size());
+        }
+        stackSegments[depth] = stateSegment;
+        stack[depth++] = state;
+        break;
+    case TurtleCommand::Pop:
+        if (depth > 0) {
+            state = stack[--depth];
+            stateSegment = stackSegments[depth];
+            batchDepth = std::min(batchDepth, depth);
+        }
+        break;
+    default:
+        move(state, symbol, moduleParameters);
+        break;
+    }
+}
+
+void Turtle::step(SymbolId symbol, const float *moduleParameters,
+                  float birth) {
+    if (output == TurtleOutput::Mesh &&
+        commands[symbol] == TurtleCommand::Forward) {
+        mesh.births.push_back(birth);
+    }
+    step(symbol, moduleParameters);
+}
+
+void Turtle::move(State &turtleState, SymbolId symbol,
+                  const float *moduleParameters) const {
+    const bool hasParameter = arities[symbol] > 0;
+
+    switch (commands[symbol]) {
+    case TurtleCommand::Forward:
+    case TurtleCommand::Move:
+        turtleState.position +=
+            headingOf(turtleState.orientation) *
+            (hasParameter ? moduleParameters[0] : parameters.stepLength);
+        break;
+    case TurtleCommand::Push:
+    case TurtleCommand::Pop:
+    case TurtleCommand::None:
+        break;
+    case TurtleCommand::TurnAround:
+        turtleState.orientation *= rotations[symbol];
+        break;
+    case TurtleCommand::DecrementWidth:
+        turtleState.width = hasParameter ? moduleParameters[0]
+                                         : turtleState.width * WIDTH_FACTOR;
+        break;
+    case TurtleCommand::IncrementColor:
+        turtleState.colorIndex =
+            hasParameter ? colorIndexFor(moduleParameters[0])
+                         : std::min(turtleState.colorIndex + 1, MAX_COLOR_INDEX);
+        break;
+    default:
+        turtleState.orientation *=
+            hasParameter ? rotationFor(commands[symbol],
+                                       glm::radians(moduleParameters[0]))
+                         : rotations[symbol];
+        break;
+    }
+}
+
+void Turtle::interpret(const ModuleString &modules) {
+    interpret(modules.symbols, modules.parameters.data());
+}
+
+const float *Turtle::interpret(std::span<const SymbolId> symbols,
+                               const float *moduleParameters) {
+    return interpret(symbols, moduleParameters,
+                     std::clamp(symbols.size() / MIN_CHUNK_SIZE, size_t{1},
+                                workerCount()));
+}
+
+const float *Turtle::interpret(std::span<const SymbolId> symbols,
+                               const float *moduleParameters,
+                               size_t chunkCount) {
+    if (chunkCount <= 1) {
+        return interpretSequentially(symbols, moduleParameters);
+    }
+    return interpretInChunks(symbols, moduleParameters, chunkCount);
+}
+
+// step for a whole run of modules. the state lives in locals for the length
+// of the loop, held in members it would be reloaded after every store to the
+// batch, which the compiler can't tell apart from it. the rare commands that
+// need more than the loop does go through step on the members
+const float *
+Turtle::interpretSequentially(std::span<const SymbolId> symbols,
+                              const float *moduleParameters) {
+    State current = state;
+    int32_t currentSegment = stateSegment;
+    size_t currentDepth = depth;
+    size_t currentBatchDepth = batchDepth;
+
+    auto store = [&] {
+        state = current;
+        stateSegment = currentSegment;
+        depth = currentDepth;
+        batchDepth = currentBatchDepth;
+    };
+    auto load = [&] {
+        current = state;
+        currentSegment = stateSegment;
+        currentDepth = depth;
+        currentBatchDepth = batchDepth;
+    };
+
+    for (SymbolId symbol : symbols) {
+        switch (commands[symbol]) {
+        case TurtleCommand::None:
+            break;
+        case TurtleCommand::Forward:
+            currentSegment = appendSegment(current, currentSegment,
+                                           arities[symbol] > 0
+                                               ? moduleParameters[0]
+                                               : parameters.stepLength);
+            if (pending.count == SegmentBatch::SIZE) {
+                store();
+                flushSegments();
+                load();
+            }
+            break;
+        case TurtleCommand::Push:
+            if (currentDepth == stack.size()) {
+                stack.resize(std::max<size_t>(2 * currentDepth, 16));
+                stackSegments.resize(stack.size());
+            }
+            stackSegments[currentDepth] = currentSegment;
+            stack[currentDepth++] = current;
+            break;
+        case TurtleCommand::Pop:
+            if (currentDepth > 0) {
+                current = stack[--currentDepth];
+                currentSegment = stackSegments[currentDepth];
+                currentBatchDepth = std::min(currentBatchDepth, currentDepth);
+            }
+            break;
+        case TurtleCommand::Move:
+        case TurtleCommand::DecrementWidth:
+        case TurtleCommand::IncrementColor:
+            store();
+            step(symbol, moduleParameters);
+            load();
+            break;
+        default:
+            current.orientation *=
+                arities[symbol] > 0
+                    ? rotationFor(commands[symbol],
+                                  glm::radians(moduleParameters[0]))
+                    : rotations[symbol];
+            break;
+        }
+        moduleParameters += arities[symbol];
+    }
+
+    store();
+    return moduleParameters;
+}
+
+// moves and turns compose like transforms and brackets only ever reach back
+// into the stack the chunk started on, so every chunk can find out what it
+// does on its own. a scan over those effects then gives every chunk the
+// state and stack it starts with, after which all chunks draw at once
+const float *Turtle::interpretInChunks(std::span<const SymbolId> symbols,
+                                       const float *moduleParameters,
+                                       size_t chunkCount) {
+    // the segments drawn before the chunks come first, and the chunks start
+    // from current positions
+    flushSegments();
+
+    const size_t chunkSize = (symbols.size() + chunkCount - 1) / chunkCount;
+    auto chunkSymbols = [&](size_t chunk) {
+        const size_t begin = std::min(chunk * chunkSize, symbols.size());
+        return symbols.subspan(begin,
+                               std::min(chunkSize, symbols.size() - begin));
+    };
+
+    // only parametric modules move the parameters of later chunks
+    std::vector<size_t> parameterOffsets(chunkCount + 1, 0);
+    if (std::any_of(arities.begin(), arities.end(),
+                    [](uint8_t arity) { return arity > 0; })) {
+        parallelChunks(chunkCount, [&](size_t chunk) {
+            size_t count = 0;
+            for (SymbolId symbol : chunkSymbols(chunk)) {
+                count += arities[symbol];
+            }
+            parameterOffsets[chunk + 1] = count;
+        });
+        for (size_t chunk = 1; chunk <= chunkCount; chunk++) {
+            parameterOffsets[chunk] += parameterOffsets[chunk - 1];
+        }
+    }
+
+    std::vector<ChunkEffect> effects(chunkCount);
+    parallelChunks(chunkCount, [&](size_t chunk) {
+        effects[chunk] = summarize(chunkSymbols(chunk),
+                                   moduleParameters + parameterOffsets[chunk]);
+    });
+
+    std::vector<State> openStack(stack.begin(), stack.begin() + depth);
+    State current = state;
+    std::vector<Turtle> chunks;
+    chunks.reserve(chunkCount);
+    for (const ChunkEffect &effect : effects) {
+        // a pop on an empty stack is ignored, which leaves the chunk on a
+        // base its effect doesn't know about
+        if (effect.popCount > openStack.size() || effect.setsAbsolute) {
+            return interpretSequentially(symbols, moduleParameters);
+        }
+
+        const size_t kept = openStack.size() - effect.popCount;
+        chunks.push_back(Turtle(*this, current,
+                                std::span(openStack).subspan(kept),
+                                effect.maxDepth));
+        chunks.back().reserveSegments(effect.segmentCount);
+
+        const State base = effect.popCount > 0 ? openStack[kept] : current;
+        openStack.resize(kept);
+        for (const State &frame : effect.openFrames) {
+            openStack.push_back(place(base, frame));
+        }
+        current = place(base, effect.transform);
+    }
+
+    parallelChunks(chunkCount, [&](size_t chunk) {
+        TraceZone zone("interpret chunk");
+        chunks[chunk].interpretSequentially(
+            chunkSymbols(chunk), moduleParameters + parameterOffsets[chunk]);
+        chunks[chunk].flushSegments();
+    });
+    appendChunks(chunks);
+
+    state = current;
+    stack.assign(openStack.begin(), openStack.end());
+    stackSegments.assign(stack.size(), SegmentBatch::OWN_START);
+    depth = openStack.size();
+    batchDepth = depth;
+    return moduleParameters + parameterOffsets.back();
+}
+
+Turtle::State Turtle::place(const State &frame, const State &local) {
+    return State{
+        .position = frame.position + frame.orientation * local.position,
+        .orientation = frame.orientation * local.orientation,
+        .width = frame.width * local.width,
+        .colorIndex =
+            std::min(frame.colorIndex + local.colorIndex, MAX_COLOR_INDEX),
+    };
+}
+
+Turtle::State Turtle::identity() {
+    return State{
+        .position = glm::vec3(0.0f),
+        .orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+        .width = 1.0f,
+        .colorIndex = 0,
+    };
+}
+
+Turtle::ChunkEffect Turtle::summarize(std::span<const SymbolId> symbols,
+                                      const float *moduleParameters) const {
+    ChunkEffect effect{
+        .popCount = 0,
+        .transform = identity(),
+        .openFrames = {},
+        .maxDepth = 0,
+        .segmentCount = 0,
+        .setsAbsolute = false,
+    };
+    State &local = effect.transform;
+    std::vector<State> &frames = effect.openFrames;
+
+    for (SymbolId symbol : symbols) {
+        switch (commands[symbol]) {
+        case TurtleCommand::Push:
+            frames.push_back(local);
+            effect.maxDepth = std::max(effect.maxDepth, frames.size());
+            break;
+        case TurtleCommand::Pop:
+            // the frame comes from before the chunk and becomes the new base
+            if (frames.empty()) {
+                effect.popCount++;
+                local = identity();
+            } else {
+                local = frames.back();
+                frames.pop_back();
+            }
+            break;
+        case TurtleCommand::Forward:
+            effect.segmentCount++;
+            move(local, symbol, moduleParameters);
+            break;
+        case TurtleCommand::DecrementWidth:
+        case TurtleCommand::IncrementColor:
+            effect.setsAbsolute = effect.setsAbsolute || arities[symbol] > 0;
+            move(local, symbol, moduleParameters);
+            break;
+        default:
+            move(local, symbol, moduleParameters);
+            break;
+        }
+        moduleParameters += arities[symbol];
+    }
+
+    return effect;
+}
+
+void Turtle::appendChunks(std::span<Turtle> chunks) {
+    std::vector<size_t> vertexCounts;
+    std::vector<size_t> indexCounts;
+    for (const Turtle &chunk : chunks) {
+        segmentCount += chunk.segmentCount;
+        // every palette starts the same way, so the longest holds all others
+        if (chunk.palette.size() > palette.size()) {
+            palette = chunk.palette;
+        }
+    }
+
+    switch (output) {
+    case TurtleOutput::Mesh: {
+        for (const Turtle &chunk : chunks) {
+            vertexCounts.push_back(chunk.mesh.vertices.size());
+            indexCounts.push_back(chunk.mesh.indices.size());
+            mesh.boundsMin = glm::min(mesh.boundsMin, chunk.mesh.boundsMin);
+            mesh.boundsMax = glm::max(mesh.boundsMax, chunk.mesh.boundsMax);
+        }
+
+        const std::vector<size_t> vertexOffsets = appendParts(
+            mesh.vertices, vertexCounts, [&](size_t part, Vertex *out) {
+                const std::vector<Vertex> &vertices =
+                    chunks[part].mesh.vertices;
+                std::copy(vertices.begin(), vertices.end(), out);
+            });
+        appendParts(mesh.indices, indexCounts,
+                    [&](size_t part, uint32_t *out) {
+                        const std::vector<uint32_t> &indices =
+                            chunks[part].mesh.indices;
+                        const auto base =
+                            static_cast<uint32_t>(vertexOffsets[part]);
+                        std::transform(
+                            indices.begin(), indices.end(), out,
+                            [&](uint32_t index) { return base + index; });
+                    });
+        break;
+    }
+    case TurtleOutput::Segments: {
+        for (const Turtle &chunk : chunks) {
+            vertexCounts.push_back(chunk.segments.segments.size());
+            segments.boundsMin =
+                glm::min(segments.boundsMin, chunk.segments.boundsMin);
+            segments.boundsMax =
+                glm::max(segments.boundsMax, chunk.segments.boundsMax);
+        }
+
+        appendParts(segments.segments, vertexCounts,
+                    [&](size_t part, Segment *out) {
+                        const std::vector<Segment> &drawn =
+                            chunks[part].segments.segments;
+                        std::copy(drawn.begin(), drawn.end(), out);
+                    });
+        break;
+    }
+    case TurtleOutput::Lines: {
+        // every chunk starts a strip of its own, so all but the first one
+        // drawn open with a restart
+        std::vector<uint8_t> restarts;
+        bool drawn = !lines.indices.empty();
+        for (const Turtle &chunk : chunks) {
+            const bool empty = chunk.lines.indices.empty();
+            restarts.push_back(drawn && !empty);
+            drawn = drawn || !empty;
+            vertexCounts.push_back(chunk.lines.vertices.size());
+            indexCounts.push_back(chunk.lines.indices.size() +
+                                  restarts.back());
+            lines.boundsMin = glm::min(lines.boundsMin, chunk.lines.boundsMin);
+            lines.boundsMax = glm::max(lines.boundsMax, chunk.lines.boundsMax);
+        }
+
+        const std::vector<size_t> vertexOffsets = appendParts(
+            lines.vertices, vertexCounts, [&](size_t part, LineVertex *out) {
+                const std::vector<LineVertex> &vertices =
+                    chunks[part].lines.vertices;
+                std::copy(vertices.begin(), vertices.end(), out);
+            });
+        appendParts(
+            lines.indices, indexCounts, [&](size_t part, uint32_t *out) {
+                if (restarts[part]) {
+                    *out++ = PRIMITIVE_RESTART_INDEX;
+                }
+                const std::vector<uint32_t> &indices =
+                    chunks[part].lines.indices;
+                const auto base = static_cast<uint32_t>(vertexOffsets[part]);
+                std::transform(indices.begin(), indices.end(), out,
+                               [&](uint32_t index) {
+                                   return index == PRIMITIVE_RESTART_INDEX
+                                              ? index
+                                              : base + index;
+                               });
+            });
+        break;
+    }
+    }
+}
+
+bool Turtle::interpretMemoized(const LSystem &lsystem, uint32_t generations) {
+    TraceZone zone("interpret memoized");
+    // stochastic and parametric subtrees differ from one occurrence to the
+    // next
+    if (lsystem.isStochastic() || lsystem.hasParametricRules()) {
+        return false;
+    }
+
+    const SymbolTable &symbols = lsystem.getSymbols();
+    for (size_t id = 0; id < symbols.size(); id++) {
+        // a width or color set outright doesn't depend on where the subtree
+        // is placed
+        if ((commands[id] == TurtleCommand::DecrementWidth ||
+             commands[id] == TurtleCommand::IncrementColor) &&
+            arities[id] > 0) {
+            return false;
+        }
+
+        std::optional<ModuleString> successor =
+            lsystem.getSuccessor(static_cast<SymbolId>(id));
+        if (!successor) {
+            continue;
+        }
+
+        // a rewritten bracket would no longer act as one in its subtree
+        if (commands[id] == TurtleCommand::Push ||
+            commands[id] == TurtleCommand::Pop) {
+            return false;
+        }
+
+        int depth = 0;
+        for (SymbolId symbol : successor->symbols) {
+            if (commands[symbol] == TurtleCommand::Push) {
+                depth++;
+            } else if (commands[symbol] == TurtleCommand::Pop && --depth < 0) {
+                return false;
+            }
+        }
+        if (depth != 0) {
+            return false;
+        }
+    }
+
+    std::vector<SubtreeNode> nodes;
+    std::vector<int32_t> nodeIndices(symbols.size() * (generations + 1), -1);
+
+    // the axiom runs on the real turtle state, so it may open brackets that
+    // close later or never
+    ModuleString axiom = lsystem.getAxiom();
+    const float *moduleParameters = axiom.parameters.data();
+    for (SymbolId symbol : axiom.symbols) {
+        if (generations == 0 || !lsystem.getSuccessor(symbol)) {
+            step(symbol, moduleParameters);
+        } else {
+            uint32_t node = buildSubtree(lsystem, symbol, generations, nodes,
+                                         nodeIndices);
+            // the subtree is placed at the position the axiom got to
+            flushSegments();
+            emitSubtree(nodes, node, state);
+            state = place(state, nodes[node].transform);
+        }
+        moduleParameters += arities[symbol];
+    }
+
+    return true;
+}
+
+uint32_t Turtle::buildSubtree(const LSystem &lsystem, SymbolId symbol,
+                              uint32_t depth, std::vector<SubtreeNode> &nodes,
+                              std::vector<int32_t> &nodeIndices) const {
+    int32_t &index = nodeIndices[depth * commands.size() + symbol];
+    if (index >= 0) {
+        return static_cast<uint32_t>(index);
+    }
+
+    SubtreeNode node{
+        .transform = identity(),
+        .segmentCount = 0,
+    };
+    State &local = node.transform;
+    std::vector<State> localStack;
+
+    ModuleString successor = *lsystem.getSuccessor(symbol);
+    const float *moduleParameters = successor.parameters.data();
+    for (SymbolId child : successor.symbols) {
+        const TurtleCommand command = commands[child];
+
+        if (depth > 1 && lsystem.getSuccessor(child)) {
+            uint32_t childIndex = buildSubtree(lsystem, child, depth - 1, nodes,
+                                               nodeIndices);
+            // looked up after building, which may grow nodes
+            const SubtreeNode &childNode = nodes[childIndex];
+
+            if (childNode.segmentCount <= MAX_FLATTENED_SEGMENTS) {
+                // small children never hold calls, all of their descendants
+                // are even smaller
+                for (const LocalSegment &segment : childNode.segments) {
+                    node.segments.push_back(LocalSegment{
+                        .start = local.position +
+                                 local.orientation * segment.start,
+                        .end = local.position + local.orientation * segment.end,
+                        .orientation = local.orientation * segment.orientation,
+                        .width = local.width * segment.width,
+                        .colorIndex = std::min(
+                            local.colorIndex + segment.colorIndex,
+                            MAX_COLOR_INDEX),
+                    });
+                }
+            } else {
+                node.calls.push_back(SubtreeCall{
+                    .node = childIndex,
+                    .segmentOffset =
+                        static_cast<uint32_t>(node.segments.size()),
+                    .frame = local,
+                });
+            }
+
+            node.segmentCount += childNode.segmentCount;
+            local = place(local, childNode.transform);
+        } else if (command == TurtleCommand::Push) {
+            localStack.push_back(local);
+        } else if (command == TurtleCommand::Pop) {
+            local = localStack.back();
+            localStack.pop_back();
+        } else {
+            const State start = local;
+            move(local, child, moduleParameters);
+            if (command == TurtleCommand::Forward) {
+                node.segments.push_back(LocalSegment{
+                    .start = start.position,
+                    .end = local.position,
+                    .orientation = start.orientation,
+                    .width = start.width,
+                    .colorIndex = start.colorIndex,
+                });
+                node.segmentCount++;
+            }
+        }
+
+        moduleParameters += arities[child];
+    }
+
+    nodes.push_back(std::move(node));
+    index = static_cast<int32_t>(nodes.size() - 1);
+    return static_cast<uint32_t>(index);
+}
+
+void Turtle::emitSubtree(const std::vector<SubtreeNode> &nodes, uint32_t node,
+                         State frame) {
+    const SubtreeNode &subtree = nodes[node];
+
+    // segments and calls are interleaved so the output order matches the
+    // sequential turtle
+    size_t segment = 0;
+    auto emitSegmentsUntil = [&](size_t end) {
+        for (; segment < end; segment++) {
+            const LocalSegment &local = subtree.segments[segment];
+            emitSegment(place(frame, State{
+                                         .position = local.start,
+                                         .orientation = local.orientation,
+                                         .width = local.width,
+                                         .colorIndex = local.colorIndex,
+                                     }),
+                        frame.position + frame.orientation * local.end);
+        }
+    };
+
+    for (const SubtreeCall &call : subtree.calls) {
+        emitSegmentsUntil(call.segmentOffset);
+        emitSubtree(nodes, call.node, place(frame, call.frame));
+    }
+    emitSegmentsUntil(subtree.segments.size());
+}
+
+MeshData Turtle::finish() {
+    flushSegments();
+    if (mesh.vertices.empty()) {
+        mesh.boundsMin = glm::vec3(0.0f);
+        mesh.boundsMax = glm::vec3(0.0f);
+    }
+
+    const size_t segmentCount = mesh.vertices.size() / TUBE_VERTICES;
+    for (size_t first = 0; first < segmentCount; first += CLUSTER_SEGMENTS) {
+        const size_t count = std::min(CLUSTER_SEGMENTS, segmentCount - first);
+        const glm::vec4 sphere = boundingSphere(
+            count * TUBE_VERTICES,
+            [&](size_t i) {
+                return mesh.vertices[first * TUBE_VERTICES + i].position;
+            },
+            0.0f);
+
+        mesh.clusters.push_back(Cluster{
+            .center = glm::vec3(sphere),
+            .radius = sphere.w,
+            .firstIndex = static_cast<uint32_t>(first * TUBE_INDICES),
+            .indexCount = static_cast<uint32_t>(count * TUBE_INDICES),
+            .firstInstance = 0,
+            .instanceCount = 1,
+        });
+    }
+
+    return std::move(mesh);
+}
+
+SegmentData Turtle::finishSegments() {
+    flushSegments();
+    if (segments.segments.empty()) {
+        segments.boundsMin = glm::vec3(0.0f);
+        segments.boundsMax = glm::vec3(0.0f);
+    }
+
+    const std::vector<Segment> &all = segments.segments;
+    for (size_t first = 0; first < all.size(); first += CLUSTER_SEGMENTS) {
+        const size_t count = std::min(CLUSTER_SEGMENTS, all.size() - first);
+        float radius = 0.0f;
+        for (size_t i = first; i < first + count; i++) {
+            radius = std::max(radius, all[i].radius);
+        }
+        const glm::vec4 sphere = boundingSphere(
+            count * 2,
+            [&](size_t i) {
+                const Segment &segment = all[first + i / 2];
+                return i % 2 == 0 ? segment.start : segment.end;
+            },
+            radius);
+
+        segments.clusters.push_back(Cluster{
+            .center = glm::vec3(sphere),
+            .radius = sphere.w,
+            .firstIndex = 0,
+            .indexCount = 0,
+            .firstInstance = static_cast<uint32_t>(first),
+            .instanceCount = static_cast<uint32_t>(count),
+        });
+    }
+
+    segments.palette = std::move(palette);
+    return std::move(segments);
+}
+
+LineData Turtle::finishLines() {
+    flushSegments();
+    if (lines.vertices.empty()) {
+        lines.boundsMin = glm::vec3(0.0f);
+        lines.boundsMax = glm::vec3(0.0f);
+    }
+
+    // a restart index at the start of a cluster just begins it with a break
+    const std::vector<uint32_t> &indices = lines.indices;
+    std::vector<glm::vec3> points;
+    for (size_t first = 0; first + 1 < indices.size();
+         first += CLUSTER_SEGMENTS) {
+        const size_t count =
+            std::min(CLUSTER_SEGMENTS + 1, indices.size() - first);
+
+        points.clear();
+        for (size_t i = first; i < first + count; i++) {
+            if (indices[i] != PRIMITIVE_RESTART_INDEX) {
+                points.push_back(lines.vertices[indices[i]].position);
+            }
+        }
+        const glm::vec4 sphere = boundingSphere(
+            points.size(), [&](size_t i) { return points[i]; }, 0.0f);
+
+        lines.clusters.push_back(Cluster{
+            .center = glm::vec3(sphere),
+            .radius = sphere.w,
+            .firstIndex = static_cast<uint32_t>(first),
+            .indexCount = static_cast<uint32_t>(count),
+            .firstInstance = 0,
+            .instanceCount = 1,
+        });
+    }
+
+    lines.palette = std::move(palette);
+    return std::move(lines);
+}
+
+int32_t Turtle::appendSegment(const State &start, int32_t from,
+                              float length) {
+    segmentCount++;
+    SegmentBatch &batch = pending;
+    const size_t i = batch.count++;
+    batch.from[i] = from;
+    if (from == SegmentBatch::OWN_START) {
+        batch.startX[i] = start.position.x;
+        batch.startY[i] = start.position.y;
+        batch.startZ[i] = start.position.z;
+    }
+    batch.w[i] = start.orientation.w;
+    batch.x[i] = start.orientation.x;
+    batch.y[i] = start.orientation.y;
+    batch.z[i] = start.orientation.z;
+    batch.lengths[i] = length;
+    batch.halfWidths[i] = 0.5f * start.width;
+    batch.colorIndices[i] = start.colorIndex;
+    return static_cast<int32_t>(i);
+}
+
+void Turtle::emitSegment(const State &start, glm::vec3 end) {
+    segmentCount++;
+    SegmentBatch &batch = pending;
+    const size_t i = batch.count++;
+    batch.from[i] = SegmentBatch::OWN_ENDS;
+    batch.startX[i] = start.position.x;
+    batch.startY[i] = start.position.y;
+    batch.startZ[i] = start.position.z;
+    batch.endX[i] = end.x;
+    batch.endY[i] = end.y;
+    batch.endZ[i] = end.z;
+    batch.w[i] = start.orientation.w;
+    batch.x[i] = start.orientation.x;
+    batch.y[i] = start.orientation.y;
+    batch.z[i] = start.orientation.z;
+    batch.lengths[i] = 0.0f;
+    batch.halfWidths[i] = 0.5f * start.width;
+    batch.colorIndices[i] = start.colorIndex;
+    if (batch.count == SegmentBatch::SIZE) {
+        flushSegments();
+    }
+}
+
+void Turtle::flushSegments() {
+    SegmentBatch &batch = pending;
+    const size_t count = batch.count;
+    if (count == 0) {
+        return;
+    }
+
+    // the moves of all segments at once, the same heading * length as move
+    std::array<float, SegmentBatch::SIZE> moveX, moveY, moveZ;
+    for (size_t i = 0; i < count; i++) {
+        const float w = batch.w[i];
+        const float x = batch.x[i];
+        const float y = batch.y[i];
+        const float z = batch.z[i];
+        const float length = batch.lengths[i];
+        moveX[i] = 2.0f * (x * y - w * z) * length;
+        moveY[i] = (1.0f - 2.0f * (x * x + z * z)) * length;
+        moveZ[i] = 2.0f * (y * z + w * x) * length;
+    }
+
+    // every start is an earlier end, so this runs one segment after the
+    // other, but it only adds. most segments continue the one before, whose
+    // end is kept at hand instead of being read back
+    glm::vec3 previous(0.0f);
+    for (size_t i = 0; i < count; i++) {
+        const int32_t from = batch.from[i];
+        glm::vec3 start;
+        if (from == SegmentBatch::OWN_ENDS) {
+            previous = glm::vec3(batch.endX[i], batch.endY[i], batch.endZ[i]);
+            continue;
+        } else if (from == SegmentBatch::OWN_START) {
+            start = glm::vec3(batch.startX[i], batch.startY[i],
+                              batch.startZ[i]);
+        } else if (from == static_cast<int32_t>(i) - 1) {
+            start = previous;
+        } else {
+            start = glm::vec3(batch.endX[from], batch.endY[from],
+                              batch.endZ[from]);
+        }
+
+        previous = start + glm::vec3(moveX[i], moveY[i], moveZ[i]);
+        batch.startX[i] = start.x;
+        batch.startY[i] = start.y;
+        batch.startZ[i] = start.z;
+        batch.endX[i] = previous.x;
+        batch.endY[i] = previous.y;
+        batch.endZ[i] = previous.z;
+    }
+
+    auto endOf = [&](int32_t segment) {
+        return glm::vec3(batch.endX[segment], batch.endY[segment],
+                         batch.endZ[segment]);
+    };
+    if (stateSegment != SegmentBatch::OWN_START) {
+        state.position = endOf(stateSegment);
+        stateSegment = SegmentBatch::OWN_START;
+    }
+    for (size_t frame = batchDepth; frame < depth; frame++) {
+        if (stackSegments[frame] != SegmentBatch::OWN_START) {
+            stack[frame].position = endOf(stackSegments[frame]);
+            stackSegments[frame] = SegmentBatch::OWN_START;
+        }
+    }
+    batchDepth = depth;
+
+    uint32_t maxColorIndex = 0;
+    for (size_t i = 0; i < count; i++) {
+        maxColorIndex = std::max(maxColorIndex, batch.colorIndices[i]);
+    }
+    paletteColor(maxColorIndex);
+
+    switch (output) {
+    case TurtleOutput::Lines:
+        writeLines();
+        break;
+    case TurtleOutput::Segments:
+        writeSegments();
+        break;
+    case TurtleOutput::Mesh:
+        writeTubes();
+        break;
+    }
+    batch.count = 0;
+}
+
+// a segment continues the strip of the one written before it unless it
+// starts elsewhere or in another color. the breaks of the whole batch are
+// found at once, after which every segment writes its end and every break
+// a restart and a start
+void Turtle::writeLines() {
+    const SegmentBatch &batch = pending;
+    const size_t count = batch.count;
+
+    std::array<uint8_t, SegmentBatch::SIZE> breaks;
+    breaks[0] = lines.vertices.empty() ||
+                lines.vertices.back().position !=
+                    glm::vec3(batch.startX[0], batch.startY[0],
+                              batch.startZ[0]) ||
+                lines.vertices.back().colorIndex != batch.colorIndices[0];
+    for (size_t i = 1; i < count; i++) {
+        breaks[i] = (batch.startX[i] != batch.endX[i - 1]) |
+                    (batch.startY[i] != batch.endY[i - 1]) |
+                    (batch.startZ[i] != batch.endZ[i - 1]) |
+                    (batch.colorIndices[i] != batch.colorIndices[i - 1]);
+    }
+    size_t breakCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        breakCount += breaks[i];
+    }
+
+    // starts that continue a strip are the end before them, so the boxes
+    // of all segments bound exactly the vertices written
+    BatchBounds<SegmentBatch::SIZE> bounds;
+    for (size_t i = 0; i < count; i++) {
+        bounds.lowX[i] = std::min(batch.startX[i], batch.endX[i]);
+        bounds.lowY[i] = std::min(batch.startY[i], batch.endY[i]);
+        bounds.lowZ[i] = std::min(batch.startZ[i], batch.endZ[i]);
+        bounds.highX[i] = std::max(batch.startX[i], batch.endX[i]);
+        bounds.highY[i] = std::max(batch.startY[i], batch.endY[i]);
+        bounds.highZ[i] = std::max(batch.startZ[i], batch.endZ[i]);
+    }
+    foldBounds(bounds, count, lines.boundsMin, lines.boundsMax);
+
+    // the very first strip opens without a restart
+    const size_t firstVertex = lines.vertices.size();
+    const size_t firstIndex = lines.indices.size();
+    const size_t restartCount = breakCount - (firstIndex == 0 ? 1 : 0);
+    lines.vertices.resize(firstVertex + count + breakCount);
+    lines.indices.resize(firstIndex + count + breakCount + restartCount);
+    LineVertex *vertex = lines.vertices.data() + firstVertex;
+    uint32_t *index = lines.indices.data() + firstIndex;
+    auto next = static_cast<uint32_t>(firstVertex);
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t colorIndex = batch.colorIndices[i];
+        if (breaks[i]) {
+            if (index != lines.indices.data()) {
+                *index++ = PRIMITIVE_RESTART_INDEX;
+            }
+            *vertex++ = LineVertex{
+                .position = glm::vec3(batch.startX[i], batch.startY[i],
+                                      batch.startZ[i]),
+                .colorIndex = colorIndex,
+            };
+            *index++ = next++;
+        }
+        *vertex++ = LineVertex{
+            .position =
+                glm::vec3(batch.endX[i], batch.endY[i], batch.endZ[i]),
+            .colorIndex = colorIndex,
+        };
+        *index++ = next++;
+    }
+}
+
+void Turtle::writeSegments() {
+    const SegmentBatch &batch = pending;
+    const size_t count = batch.count;
+
+    BatchBounds<SegmentBatch::SIZE> bounds;
+    for (size_t i = 0; i < count; i++) {
+        const float radius = batch.halfWidths[i];
+        bounds.lowX[i] = std::min(batch.startX[i], batch.endX[i]) - radius;
+        bounds.lowY[i] = std::min(batch.startY[i], batch.endY[i]) - radius;
+        bounds.lowZ[i] = std::min(batch.startZ[i], batch.endZ[i]) - radius;
+        bounds.highX[i] = std::max(batch.startX[i], batch.endX[i]) + radius;
+        bounds.highY[i] = std::max(batch.startY[i], batch.endY[i]) + radius;
+        bounds.highZ[i] = std::max(batch.startZ[i], batch.endZ[i]) + radius;
+    }
+    foldBounds(bounds, count, segments.boundsMin, segments.boundsMax);
+
+    const size_t first = segments.segments.size();
+    segments.segments.resize(first + count);
+    Segment *out = segments.segments.data() + first;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = Segment{
+            .start = glm::vec3(batch.startX[i], batch.startY[i],
+                               batch.startZ[i]),
+            .radius = batch.halfWidths[i],
+            .end = glm::vec3(batch.endX[i], batch.endY[i], batch.endZ[i]),
+            .colorIndex = batch.colorIndices[i],
+        };
+    }
+}
+
+// every tube is the unit cylinder of buildUnitCylinder in the frame of its
+// segment, scaled to the half width. the loops over the batch have no
+// dependencies between segments, so they run several per instruction: the
+// rings are worked out one side at a time for all segments and then stored
+// straight into their vertices
+void Turtle::writeTubes() {
+    const SegmentBatch &batch = pending;
+    const size_t count = batch.count;
+
+    // right is orientation * +x and up orientation * UP, which are the first
+    // and the third column of the rotation matrix. a ring reaches
+    // radius * length(right, up) along every axis
+    std::array<float, SegmentBatch::SIZE> rightX, rightY, rightZ;
+    std::array<float, SegmentBatch::SIZE> upX, upY, upZ;
+    BatchBounds<SegmentBatch::SIZE> bounds;
+    for (size_t i = 0; i < count; i++) {
+        const float w = batch.w[i];
+        const float x = batch.x[i];
+        const float y = batch.y[i];
+        const float z = batch.z[i];
+        rightX[i] = 1.0f - 2.0f * (y * y + z * z);
+        rightY[i] = 2.0f * (x * y + w * z);
+        rightZ[i] = 2.0f * (x * z - w * y);
+        upX[i] = 2.0f * (x * z + w * y);
+        upY[i] = 2.0f * (y * z - w * x);
+        upZ[i] = 1.0f - 2.0f * (x * x + y * y);
+
+        const float radius = batch.halfWidths[i];
+        const float reachX =
+            radius * std::sqrt(rightX[i] * rightX[i] + upX[i] * upX[i]);
+        const float reachY =
+            radius * std::sqrt(rightY[i] * rightY[i] + upY[i] * upY[i]);
+        const float reachZ =
+            radius * std::sqrt(rightZ[i] * rightZ[i] + upZ[i] * upZ[i]);
+        bounds.lowX[i] = std::min(batch.startX[i], batch.endX[i]) - reachX;
+        bounds.lowY[i] = std::min(batch.startY[i], batch.endY[i]) - reachY;
+        bounds.lowZ[i] = std::min(batch.startZ[i], batch.endZ[i]) - reachZ;
+        bounds.highX[i] = std::max(batch.startX[i], batch.endX[i]) + reachX;
+        bounds.highY[i] = std::max(batch.startY[i], batch.endY[i]) + reachY;
+        bounds.highZ[i] = std::max(batch.startZ[i], batch.endZ[i]) + reachZ;
+    }
+    foldBounds(bounds, count, mesh.boundsMin, mesh.boundsMax);
+
+    const size_t firstVertex = mesh.vertices.size();
+    const size_t firstIndex = mesh.indices.size();
+    mesh.vertices.resize(firstVertex + TUBE_VERTICES * count);
+    mesh.indices.resize(firstIndex + TUBE_INDICES * count);
+    Vertex *vertices = mesh.vertices.data() + firstVertex;
+    uint32_t *indices = mesh.indices.data() + firstIndex;
+
+    std::array<float, SegmentBatch::SIZE> normalX, normalY, normalZ;
+    std::array<float, SegmentBatch::SIZE> offsetX, offsetY, offsetZ;
+    for (uint32_t side = 0; side < TUBE_SIDES; side++) {
+        const float cosine = TUBE_RING[side].x;
+        const float sine = TUBE_RING[side].y;
+        for (size_t i = 0; i < count; i++) {
+            normalX[i] = cosine * rightX[i] + sine * upX[i];
+            normalY[i] = cosine * rightY[i] + sine * upY[i];
+            normalZ[i] = cosine * rightZ[i] + sine * upZ[i];
+            offsetX[i] = normalX[i] * batch.halfWidths[i];
+            offsetY[i] = normalY[i] * batch.halfWidths[i];
+            offsetZ[i] = normalZ[i] * batch.halfWidths[i];
+        }
+
+        const float uvX = static_cast<float>(side) / TUBE_SIDES;
+        for (size_t i = 0; i < count; i++) {
+            const glm::vec3 normal(normalX[i], normalY[i], normalZ[i]);
+            const glm::vec3 offset(offsetX[i], offsetY[i], offsetZ[i]);
+            const glm::vec4 &color = palette[batch.colorIndices[i]];
+            Vertex *tube = vertices + TUBE_VERTICES * i;
+            tube[side] = Vertex{
+                .position = glm::vec3(batch.startX[i], batch.startY[i],
+                                      batch.startZ[i]) +
+                            offset,
+                .uvX = uvX,
+                .normal = normal,
+                .uvY = 0.0f,
+                .color = color,
+            };
+            tube[TUBE_SIDES + side] = Vertex{
+                .position =
+                    glm::vec3(batch.endX[i], batch.endY[i], batch.endZ[i]) +
+                    offset,
+                .uvX = uvX,
+                .normal = normal,
+                .uvY = 1.0f,
+                .color = color,
+            };
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const auto base =
+            static_cast<uint32_t>(firstVertex + TUBE_VERTICES * i);
+        for (uint32_t index = 0; index < TUBE_INDICES; index++) {
+            indices[TUBE_INDICES * i + index] = base + TUBE_QUADS[index];
+        }
+    }
+}
+
+const glm::vec4 &Turtle::paletteColor(uint32_t colorIndex) {
+    while (palette.size() <= colorIndex) {
+        palette.push_back(turnHue(
+            parameters.color,
+            COLOR_HUE_STEP * static_cast<float>(palette.size())));
+    }
+    return palette[colorIndex];
+}
+} // namespace lsv
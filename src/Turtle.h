@@ -0,0 +1,284 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "RendererTypes.h"
+#include "LSystem.h"
+
+namespace lsv {
+struct TurtleParameters {
+    float angle = 25.0f;
+    float stepLength = 1.0f;
+    // the width segments start with, ! narrows it from there
+    float width = 0.2f;
+    // the first palette color, ' turns its hue step by step for the others
+    glm::vec4 color{0.2f, 0.6f, 0.2f, 1.0f};
+};
+
+// the mesh draws every segment as a tube, a ring of TUBE_SIDES vertices at
+// its start and one at its end joined by a quad per side. mirrored by the
+// TUBE_ constants in mesh.slang and lsystem.slang
+constexpr uint32_t TUBE_SIDES = 6;
+constexpr uint32_t TUBE_VERTICES = 2 * TUBE_SIDES;
+constexpr uint32_t TUBE_INDICES = 6 * TUBE_SIDES;
+
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // when every segment was born as given by LSystem::expand, one per tube
+    // and empty when the mesh isn't animated
+    std::vector<float> births;
+    std::vector<Cluster> clusters;
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+};
+
+// clusters draw instances of a mesh the turtle knows nothing about, so their
+// indexCount is left at 0 for the caller to fill in
+struct SegmentData {
+    std::vector<Segment> segments;
+    std::vector<glm::vec4> palette;
+    std::vector<Cluster> clusters;
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+};
+
+// a segment starting where the previous one ended extends its strip,
+// clusters overlap by one index so strips continue across them
+struct LineData {
+    std::vector<LineVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec4> palette;
+    std::vector<Cluster> clusters;
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+};
+
+enum class TurtleOutput {
+    Mesh,
+    Segments,
+    Lines,
+};
+
+// values are mirrored by the COMMAND_ constants in lsystem.slang
+enum class TurtleCommand : uint8_t {
+    None,
+    Forward,
+    Move,
+    YawLeft,
+    YawRight,
+    PitchDown,
+    PitchUp,
+    RollLeft,
+    RollRight,
+    TurnAround,
+    Push,
+    Pop,
+    // ! thins the segments that follow by WIDTH_FACTOR, !(w) sets their width
+    DecrementWidth,
+    // ' moves on to the next palette color, '(c) picks color c
+    IncrementColor,
+};
+
+TurtleCommand turtleCommandFor(char symbol);
+
+// cylinder of radius 1 from y = 0 to y = 1 without caps, instanced once per
+// segment by vertSegmentMain
+MeshData buildUnitCylinder(uint32_t sides);
+
+class Turtle {
+public:
+    Turtle(TurtleParameters parameters, const SymbolTable &symbols,
+           TurtleOutput output = TurtleOutput::Mesh);
+
+    // sizes the outputs and the bracket stack for interpreting the modules,
+    // so that doing so never reallocates
+    void reserve(const ModuleString &modules);
+    // sizes the outputs for the symbol counts of a derivation that isn't
+    // built, the bracket stack grows as needed. at most maxSegments are
+    // reserved, beyond that the outputs grow as they are written
+    void reserve(std::span<const uint64_t> histogram,
+                 uint64_t maxSegments = UINT64_MAX);
+
+    // modules with parameters override the defaults, F(l) moves by l and the
+    // rotation commands turn by their first parameter in degrees
+    void step(SymbolId symbol, const float *moduleParameters);
+    // also keeps the birth of the segment the module draws, meshes only have
+    // births when every module was stepped this way
+    void step(SymbolId symbol, const float *moduleParameters, float birth);
+    void interpret(const ModuleString &modules);
+    // interprets a run of modules whose parameters start at
+    // moduleParameters, returns where the parameters of the next one start.
+    // long runs are split into chunks interpreted on all cores, which draws
+    // the same geometry up to rounding, with line strips broken between
+    // chunks
+    const float *interpret(std::span<const SymbolId> symbols,
+                           const float *moduleParameters);
+    // the same in exactly chunkCount chunks whatever the number of cores, 1
+    // interprets the modules one after the other
+    const float *interpret(std::span<const SymbolId> symbols,
+                           const float *moduleParameters, size_t chunkCount);
+
+    // interprets the derivation without expanding it, every (symbol, depth)
+    // subtree is interpreted once in its own local frame and then placed by
+    // transform composition wherever it occurs. returns false without doing
+    // anything when a successor has unbalanced brackets, since the subtree
+    // would then depend on the stack of its surroundings
+    bool interpretMemoized(const LSystem &lsystem, uint32_t generations);
+
+    MeshData finish();
+    SegmentData finishSegments();
+    LineData finishLines();
+
+    uint64_t getSegmentCount() const { return segmentCount; }
+
+private:
+    // absolute for the turtle itself. chunk effects and subtrees keep it
+    // relative to the frame they are placed in, with width as a factor and
+    // colorIndex as an offset
+    struct State {
+        glm::vec3 position;
+        glm::quat orientation;
+        float width;
+        uint32_t colorIndex;
+    };
+
+    // segments drawn but not written yet, one array per field so that
+    // flushSegments works through a whole batch in vector registers. the
+    // turtle moves without knowing where it is: a segment starts at the end
+    // of segment from of the batch, and flushSegments works out the
+    // positions once the batch is full
+    struct SegmentBatch {
+        static constexpr size_t SIZE = 128;
+        // from for a segment whose start was known when it was drawn
+        static constexpr int32_t OWN_START = -1;
+        // from for a segment whose start and end were both known
+        static constexpr int32_t OWN_ENDS = -2;
+
+        std::array<float, SIZE> startX, startY, startZ;
+        std::array<float, SIZE> endX, endY, endZ;
+        std::array<float, SIZE> w, x, y, z;
+        std::array<float, SIZE> lengths;
+        std::array<float, SIZE> halfWidths;
+        std::array<uint32_t, SIZE> colorIndices;
+        std::array<int32_t, SIZE> from;
+        size_t count{0};
+    };
+
+    // what interpreting a chunk does relative to its base, which is the state
+    // it starts in or, after popping frames pushed before it, the last of
+    // those frames
+    struct ChunkEffect {
+        uint32_t popCount;
+        State transform;
+        // pushed after the last of those pops and still open at the end,
+        // bottom first
+        std::vector<State> openFrames;
+        size_t maxDepth;
+        uint64_t segmentCount;
+        // !(w) or '(c) set the width or color outright, which the effect
+        // can't express relative to its base
+        bool setsAbsolute;
+    };
+
+    struct LocalSegment {
+        glm::vec3 start;
+        glm::vec3 end;
+        glm::quat orientation;
+        float width;
+        uint32_t colorIndex;
+    };
+
+    // a child too large to be flattened into its parent, placed at frame and
+    // emitted after the first segmentOffset segments of the parent
+    struct SubtreeCall {
+        uint32_t node;
+        uint32_t segmentOffset;
+        State frame;
+    };
+
+    struct SubtreeNode {
+        // the turtle state after the subtree relative to before it
+        State transform;
+        std::vector<LocalSegment> segments;
+        std::vector<SubtreeCall> calls;
+        uint64_t segmentCount;
+    };
+
+    TurtleParameters parameters;
+    TurtleOutput output;
+    std::vector<TurtleCommand> commands;
+    std::vector<uint8_t> arities;
+    // the turn of every rotation symbol by the default angle, computed once
+    // instead of per module
+    std::vector<glm::quat> rotations;
+
+    State state;
+    // the segment of the batch whose end is the position of state, which is
+    // stale until flushSegments. OWN_START when the position is current
+    int32_t stateSegment{SegmentBatch::OWN_START};
+    // only the first depth states are live, the rest is kept allocated
+    std::vector<State> stack;
+    // stateSegment of every frame of the stack, sized along with it
+    std::vector<int32_t> stackSegments;
+    size_t depth{0};
+    // the frames below it were pushed before the batch and are current
+    size_t batchDepth{0};
+    uint64_t segmentCount{0};
+    // the color of every index reached so far, the first is parameters.color
+    std::vector<glm::vec4> palette;
+    MeshData mesh;
+    SegmentBatch pending;
+    SegmentData segments;
+    LineData lines;
+
+    // a turtle with the symbol tables of configuration drawing into outputs
+    // of its own, starting at start on top of the given stack
+    Turtle(const Turtle &configuration, State start,
+           std::span<const State> incoming, size_t maxDepth);
+    void initializeOutputs();
+    void reserveSegments(uint64_t count);
+
+    const float *interpretSequentially(std::span<const SymbolId> symbols,
+                                       const float *moduleParameters);
+    const float *interpretInChunks(std::span<const SymbolId> symbols,
+                                   const float *moduleParameters,
+                                   size_t chunkCount);
+    // local placed in frame, frame itself for the identity
+    static State place(const State &frame, const State &local);
+    static State identity();
+    ChunkEffect summarize(std::span<const SymbolId> symbols,
+                          const float *moduleParameters) const;
+    // appends what the chunks drew in order, copying them concurrently
+    void appendChunks(std::span<Turtle> chunks);
+
+    // applies a movement, rotation, width or color change, push and pop are
+    // left to the caller
+    void move(State &turtleState, SymbolId symbol,
+              const float *moduleParameters) const;
+    // draws length along the heading of start, from the end of segment from
+    // of the batch. returns where the segment went in the batch, the caller
+    // flushes it once full
+    int32_t appendSegment(const State &start, int32_t from, float length);
+    // draws from the position, width and color of start to end
+    void emitSegment(const State &start, glm::vec3 end);
+    // works out the positions of the batched segments and writes them to
+    // the output, after which state and stack are current again
+    void flushSegments();
+    void writeLines();
+    void writeSegments();
+    void writeTubes();
+    const glm::vec4 &paletteColor(uint32_t colorIndex);
+
+    uint32_t buildSubtree(const LSystem &lsystem, SymbolId symbol,
+                          uint32_t depth, std::vector<SubtreeNode> &nodes,
+                          std::vector<int32_t> &nodeIndices) const;
+    void emitSubtree(const std::vector<SubtreeNode> &nodes, uint32_t node,
+                     State frame);
+};
+} // namespace lsv